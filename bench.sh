@@ -0,0 +1,35 @@
+#!/bin/bash
+
+TARGET=bin/freq
+COUNT=${COUNT:-20000000}
+
+bench_read() {
+  input=tmp_bench_input.txt
+  seq 1 $COUNT > $input
+
+  $TARGET -i bench/read.fq -o tmp_bench.ll
+  echo "bench/read.fq: $COUNT integers from stdin"
+  time (lli tmp_bench.ll < $input)
+}
+
+# 乱数で分岐するifを、分岐(-C 0)とselectで比べる
+bench_select() {
+  for cost in 0 8; do
+    $TARGET -C $cost -i bench/select.fq -o tmp_bench.ll
+    echo "bench/select.fq: -C $cost"
+    time (lli tmp_bench.ll)
+  done
+}
+
+# genを重ねたパイプラインと、手で1つのループにしたものを比べる
+bench_gen() {
+  for name in gen gen_fused; do
+    $TARGET -i bench/$name.fq -o tmp_bench.ll
+    echo "bench/$name.fq"
+    time (lli tmp_bench.ll)
+  done
+}
+
+bench_read
+bench_select
+bench_gen
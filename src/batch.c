@@ -0,0 +1,277 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "freq.h"
+#include "util.h"
+
+// 入力1つ分
+typedef struct {
+  char* path;
+  char* output;    // 出力先のパス
+  bool skipped;    // 出力先が他の入力とぶつかるのでコンパイルしない
+  bool ok;
+  double us;       // 読み込みから書き出しまで
+  size_t line;     // 0ならファイルの読み書きの失敗
+  size_t column;
+  char message[256];
+} Job;
+
+typedef struct {
+  Job* jobs;
+  size_t size;
+  size_t capacity;
+  pthread_mutex_t lock;
+  size_t next;     // 次に取るjob
+  const char* outdir;
+  unsigned flags;
+  size_t select_cost;
+} Batch;
+
+static double elapsed_us(const struct timespec* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void add_job(Batch* batch, const char* path, size_t len) {
+  if( batch->size == batch->capacity ) {
+    batch->capacity = batch->capacity ? batch->capacity * 2 : 256;
+    batch->jobs = (Job*)realloc(batch->jobs, sizeof(Job) * batch->capacity);
+  }
+  Job* job = &batch->jobs[batch->size++];
+  memset(job, 0, sizeof(Job));
+  job->path = (char*)malloc(len + 1);
+  memcpy(job->path, path, len);
+  job->path[len] = '\0';
+  job->output = NULL;
+}
+
+static int compare_job(const void* lhs, const void* rhs) {
+  return strcmp(((const Job*)lhs)->path, ((const Job*)rhs)->path);
+}
+
+// ディレクトリの中の*.fqを名前順に足す
+static bool list_directory(Batch* batch, const char* dir) {
+  DIR* dp = opendir(dir);
+  if( dp == NULL ) return false;
+  Buffer path;
+  init_buffer(&path);
+  struct dirent* entry;
+  while( (entry = readdir(dp)) != NULL ) {
+    const size_t len = strlen(entry->d_name);
+    if( len <= 3 || strcmp(entry->d_name + len - 3, ".fq") != 0 ) continue;
+    clear_buffer(&path);
+    buffer_printf(&path, "%s/%s", dir, entry->d_name);
+    add_job(batch, path.data, path.size);
+  }
+  closedir(dp);
+  free_buffer(&path);
+  qsort(batch->jobs, batch->size, sizeof(Job), compare_job);
+  return true;
+}
+
+// 1行に1つパスが書かれたファイルを読む
+static bool list_manifest(Batch* batch, const char* manifest) {
+  FILE* fp = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+  if( fp == NULL ) return false;
+  Buffer text;
+  init_buffer(&text);
+  read_all(fp, &text);
+  if( fp != stdin ) fclose(fp);
+
+  for( size_t pos = 0; pos < text.size; ) {
+    size_t end = pos;
+    while( end < text.size && text.data[end] != '\n' ) ++end;
+    size_t len = end - pos;
+    if( len > 0 && text.data[pos + len - 1] == '\r' ) --len;
+    if( len > 0 && text.data[pos] != '#' ) add_job(batch, text.data + pos, len);
+    pos = end + 1;
+  }
+  free_buffer(&text);
+  return true;
+}
+
+// 入力のパスから出力のパスを作る
+static void output_path(Buffer* out, const char* input, const char* outdir, unsigned flags) {
+  const char* name = input;
+  if( outdir ) {
+    const char* slash = strrchr(input, '/');
+    if( slash ) name = slash + 1;
+    buffer_printf(out, "%s/", outdir);
+  }
+  const char* slash = strrchr(name, '/');
+  const char* dot = strrchr(name, '.');
+  const size_t len = dot && (!slash || dot > slash) && dot != name ? (size_t)(dot - name) : strlen(name);
+  append_buffer(out, name, len);
+  buffer_printf(out, "%s", (flags & FREQ_BITCODE) ? ".bc" : ".ll");
+}
+
+// 出力先の順に並べる。同じなら入力の順
+static int compare_output(const void* lhs, const void* rhs) {
+  const Job* l = *(Job* const*)lhs;
+  const Job* r = *(Job* const*)rhs;
+  const int c = strcmp(l->output, r->output);
+  if( c != 0 ) return c;
+  return (l > r) - (l < r);
+}
+
+// 各入力の出力先を決める。-oで別のディレクトリの同じ名前のファイルが同じ出力先になったら、
+// 同時に書いて片方が消えてしまうので、最初のもの以外は失敗にする
+static void assign_outputs(Batch* batch) {
+  Buffer path;
+  init_buffer(&path);
+  for( size_t i = 0; i < batch->size; ++i ) {
+    Job* job = &batch->jobs[i];
+    clear_buffer(&path);
+    output_path(&path, job->path, batch->outdir, batch->flags);
+    job->output = (char*)malloc(path.size + 1);
+    memcpy(job->output, path.data, path.size);
+    job->output[path.size] = '\0';
+  }
+  free_buffer(&path);
+
+  Job** sorted = (Job**)malloc(sizeof(Job*) * (batch->size ? batch->size : 1));
+  for( size_t i = 0; i < batch->size; ++i ) sorted[i] = &batch->jobs[i];
+  qsort(sorted, batch->size, sizeof(Job*), compare_output);
+  Job* first = batch->size ? sorted[0] : NULL;
+  for( size_t i = 1; i < batch->size; ++i ) {
+    Job* job = sorted[i];
+    if( strcmp(job->output, first->output) != 0 ) {
+      first = job;
+      continue;
+    }
+    job->skipped = true;
+    job->ok = false;
+    job->line = 0;
+    snprintf(job->message, sizeof(job->message), "Output file '%s' is also written for '%s'.", job->output, first->path);
+  }
+  free(sorted);
+}
+
+static void fail_io(Job* job, const char* message) {
+  job->ok = false;
+  job->line = 0;
+  snprintf(job->message, sizeof(job->message), "%s", message);
+}
+
+static void compile_job(Batch* batch, FreqContext* ctx, Buffer* source, Job* job) {
+  if( job->skipped ) return;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  FILE* in = fopen(job->path, "r");
+  if( in == NULL ) {
+    fail_io(job, "Can't open input file.");
+    job->us = elapsed_us(&start);
+    return;
+  }
+  clear_buffer(source);
+  read_all(in, source);
+  fclose(in);
+
+  FreqBuffer output;
+  if( !freq_compile(ctx, source->data, source->size, batch->flags, &output) ) {
+    const FreqError* err = freq_error(ctx);
+    job->ok = false;
+    job->line = err->line;
+    job->column = err->column;
+    snprintf(job->message, sizeof(job->message), "%s", err->message);
+    job->us = elapsed_us(&start);
+    return;
+  }
+
+  FILE* out = fopen(job->output, "w");
+  if( out == NULL ) {
+    fail_io(job, "Can't open output file.");
+  } else {
+    const bool written = fwrite(output.data, sizeof(char), output.size, out) == output.size;
+    if( fclose(out) != 0 || !written ) fail_io(job, "Can't write output file.");
+    else job->ok = true;
+  }
+  job->us = elapsed_us(&start);
+}
+
+static void* run_worker(void* arg) {
+  Batch* batch = (Batch*)arg;
+  // contextはworkerごとに持って、入力をまたいで使い回す
+  FreqContext* ctx = freq_create();
+  freq_set_select_cost(ctx, batch->select_cost);
+  Buffer source;
+  init_buffer(&source);
+
+  for( ; ; ) {
+    pthread_mutex_lock(&batch->lock);
+    const size_t i = batch->next++;
+    pthread_mutex_unlock(&batch->lock);
+    if( i >= batch->size ) break;
+    compile_job(batch, ctx, &source, &batch->jobs[i]);
+  }
+
+  free_buffer(&source);
+  freq_destroy(ctx);
+  return NULL;
+}
+
+int run_batch(const char* list, const char* outdir, unsigned flags, size_t select_cost, size_t workers) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  Batch batch = { .jobs = NULL, .size = 0, .capacity = 0, .next = 0, .outdir = outdir, .flags = flags, .select_cost = select_cost };
+  pthread_mutex_init(&batch.lock, NULL);
+
+  struct stat st;
+  const bool is_dir = strcmp(list, "-") != 0 && stat(list, &st) == 0 && S_ISDIR(st.st_mode);
+  if( !(is_dir ? list_directory(&batch, list) : list_manifest(&batch, list)) ) {
+    fprintf(stderr, "Can't open batch list '%s'.\n", list);
+    return EXIT_FAILURE;
+  }
+  assign_outputs(&batch);
+
+  // 入力より多くスレッドを立てても仕方がない
+  if( workers == 0 ) workers = 1;
+  if( workers > batch.size ) workers = batch.size;
+  pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * (workers ? workers : 1));
+  size_t started = 0;
+  for( ; started < workers; ++started ) {
+    if( pthread_create(&threads[started], NULL, run_worker, &batch) != 0 ) break;
+  }
+  // スレッドを立てられなければ自分で回す
+  if( started == 0 ) run_worker(&batch);
+  for( size_t i = 0; i < started; ++i ) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+
+  // 失敗したものを入力の順に出す
+  size_t failed = 0;
+  double sum = 0, max = 0;
+  for( size_t i = 0; i < batch.size; ++i ) {
+    Job* job = &batch.jobs[i];
+    sum += job->us;
+    if( job->us > max ) max = job->us;
+    if( job->ok ) continue;
+    ++failed;
+    if( job->line ) fprintf(stderr, "%s:%zu:%zu: %s\n", job->path, job->line, job->column, job->message);
+    else fprintf(stderr, "%s: %s\n", job->path, job->message);
+  }
+  fprintf(stderr, "batch: %zu programs, %zu failed, %zu workers, %.1fms", batch.size, failed, started ? started : 1, elapsed_us(&start) / 1e3);
+  if( batch.size ) fprintf(stderr, ", mean: %.1fus, max: %.1fus", sum / batch.size, max);
+  fprintf(stderr, "\n");
+
+  for( size_t i = 0; i < batch.size; ++i ) {
+    free(batch.jobs[i].path);
+    free(batch.jobs[i].output);
+  }
+  free(batch.jobs);
+  pthread_mutex_destroy(&batch.lock);
+  return failed ? EXIT_FAILURE : 0;
+}
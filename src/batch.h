@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+
+// たくさんのプログラムを1つのプロセスでまとめてコンパイルする。
+// listがディレクトリならその中の*.fqを、それ以外なら1行に1つパスを書いたファイル("-"ならstdin)を読む。
+// 空行と#で始まる行は読み飛ばす。
+// 出力は入力ごとに、拡張子を.ll(flagsにFREQ_BITCODEがあれば.bc)に変えたファイルに書く。
+// outdirがNULLでなければ、入力と同じディレクトリではなくoutdirの下に書く。
+// 出力先が他の入力と同じになるものは、最初のもの以外をコンパイルせずに失敗にする。
+// select_costはfreq_set_select_costに渡す。
+// workers個のスレッドで並行にコンパイルし、失敗したものはpath:行:列: メッセージの形で、
+// 最後に全体の集計をstderrに出す。1つでも失敗したらEXIT_FAILUREを返す。
+int run_batch(const char* list, const char* outdir, unsigned flags, size_t select_cost, size_t workers);
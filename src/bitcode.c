@@ -0,0 +1,1839 @@
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitcode.h"
+
+// codegenが出力したテキストのIRをもう一度読み込んで、LLVM bitcodeとして書き出す。
+// libLLVMには依存せず、bitstreamの書き出しまでここで全部やる。
+// bitcodeの形式はLLVM 4.0以降のもの(module version 2, 相対value id, STRTAB)。
+// abbreviationはSTRTABのblob以外使わず、すべてUNABBREV_RECORDで書く。
+
+// ------------------------------------------------------------------ bitstream
+
+// block id
+#define BLOCK_MODULE 8
+#define BLOCK_PARAMATTR 9
+#define BLOCK_PARAMATTR_GROUP 10
+#define BLOCK_CONSTANTS 11
+#define BLOCK_FUNCTION 12
+#define BLOCK_IDENTIFICATION 13
+#define BLOCK_METADATA 15
+#define BLOCK_METADATA_ATTACHMENT 16
+#define BLOCK_TYPE 17
+#define BLOCK_METADATA_KIND 22
+#define BLOCK_STRTAB 23
+
+// 組み込みのabbreviation id
+#define ABBREV_END_BLOCK 0
+#define ABBREV_ENTER_SUBBLOCK 1
+#define ABBREV_DEFINE 2
+#define ABBREV_UNABBREV_RECORD 3
+
+#define MAX_BLOCK_DEPTH 8
+
+typedef struct {
+  uint32_t* words;
+  size_t size;
+  size_t capacity;
+  uint64_t current;
+  unsigned bits;
+  unsigned width;
+  size_t depth;
+  size_t starts[MAX_BLOCK_DEPTH];
+  unsigned widths[MAX_BLOCK_DEPTH];
+} BitWriter;
+
+static void push_word(BitWriter* w, uint32_t word) {
+  if( w->size == w->capacity ) {
+    w->capacity = w->capacity ? w->capacity * 2 : 1024;
+    w->words = (uint32_t*)realloc(w->words, sizeof(uint32_t) * w->capacity);
+  }
+  w->words[w->size++] = word;
+}
+
+static void emit(BitWriter* w, uint32_t value, unsigned width) {
+  w->current |= (uint64_t)value << w->bits;
+  w->bits += width;
+  if( w->bits >= 32 ) {
+    push_word(w, (uint32_t)w->current);
+    w->current >>= 32;
+    w->bits -= 32;
+  }
+}
+
+static void emit_vbr(BitWriter* w, uint64_t value, unsigned width) {
+  const uint64_t threshold = (uint64_t)1 << (width - 1);
+  while( value >= threshold ) {
+    emit(w, (uint32_t)((value & (threshold - 1)) | threshold), width);
+    value >>= width - 1;
+  }
+  emit(w, (uint32_t)value, width);
+}
+
+static void align32(BitWriter* w) {
+  if( w->bits == 0 ) return;
+  push_word(w, (uint32_t)w->current);
+  w->current = 0;
+  w->bits = 0;
+}
+
+static void enter_block(BitWriter* w, unsigned id, unsigned width) {
+  emit(w, ABBREV_ENTER_SUBBLOCK, w->width);
+  emit_vbr(w, id, 8);
+  emit_vbr(w, width, 4);
+  align32(w);
+  // block長はend_blockで埋める
+  w->starts[w->depth] = w->size;
+  w->widths[w->depth] = w->width;
+  ++w->depth;
+  push_word(w, 0);
+  w->width = width;
+}
+
+static void end_block(BitWriter* w) {
+  emit(w, ABBREV_END_BLOCK, w->width);
+  align32(w);
+  --w->depth;
+  const size_t start = w->starts[w->depth];
+  w->words[start] = (uint32_t)(w->size - start - 1);
+  w->width = w->widths[w->depth];
+}
+
+typedef struct {
+  uint64_t* data;
+  size_t size;
+  size_t capacity;
+} Record;
+
+static void record_push(Record* r, uint64_t value) {
+  if( r->size == r->capacity ) {
+    r->capacity = r->capacity ? r->capacity * 2 : 64;
+    r->data = (uint64_t*)realloc(r->data, sizeof(uint64_t) * r->capacity);
+  }
+  r->data[r->size++] = value;
+}
+
+static void emit_record(BitWriter* w, unsigned code, Record* r) {
+  emit(w, ABBREV_UNABBREV_RECORD, w->width);
+  emit_vbr(w, code, 6);
+  emit_vbr(w, r->size, 6);
+  for( size_t i = 0; i < r->size; ++i )
+    emit_vbr(w, r->data[i], 6);
+  r->size = 0;
+}
+
+static uint64_t signed_vbr(int64_t value) {
+  if( value >= 0 ) return (uint64_t)value << 1;
+  return ((uint64_t)(-value) << 1) | 1;
+}
+
+typedef enum {
+  TY_VOID,
+  TY_INT,
+  TY_PTR,
+  TY_ARRAY,
+  TY_STRUCT,
+  TY_FUNC,
+  TY_LABEL,
+} TypeKind;
+
+typedef struct {
+  TypeKind kind;
+  uint64_t size;   // TY_INT: bit幅, TY_ARRAY: 要素数
+  int elem;        // TY_PTR, TY_ARRAY: 要素の型, TY_FUNC: 返り値の型
+  int* members;    // TY_STRUCT: メンバの型, TY_FUNC: 引数の型
+  size_t members_size;
+  bool vararg;
+} Type;
+
+typedef enum {
+  OPND_LOCAL,
+  OPND_BLOCK,
+  OPND_GLOBAL,
+  OPND_INT,
+  OPND_NULL,
+  OPND_UNDEF,
+} OperandKind;
+
+typedef struct {
+  OperandKind kind;
+  int type;
+  const char* name;
+  size_t len;
+  int64_t value;
+  uint64_t id;     // 解決後のvalue id(OPND_BLOCKならblock番号)
+} Operand;
+
+typedef enum {
+  IN_BINOP,
+  IN_CAST,
+  IN_CMP,
+  IN_SELECT,
+  IN_PHI,
+  IN_BR,
+  IN_SWITCH,
+  IN_RET,
+  IN_ALLOCA,
+  IN_LOAD,
+  IN_STORE,
+  IN_GEP,
+  IN_CALL,
+  IN_UNREACHABLE,
+} InstKind;
+
+// "!N" で参照されるmetadata。slotがNULLならindexで直接指す(-1はnull)
+typedef struct {
+  const char* slot;
+  size_t len;
+  int index;
+} MetadataRef;
+
+#define MAX_ATTACHMENTS 4
+
+// 命令に付いた ", !kind !N"
+typedef struct {
+  int kind;
+  MetadataRef node;
+} Attachment;
+
+typedef struct {
+  InstKind kind;
+  int code;        // binop/castのopcode, icmpの述語, gepのinbounds
+  int type;        // 結果の型
+  int aux;         // alloca/load/gep: 対象の型, cast: 変換先の型, call: 関数型, binop: nuw/nsw/exactのフラグ
+  unsigned align;
+  Operand* ops;
+  size_t ops_size;
+  bool has_result;
+  Attachment attachments[MAX_ATTACHMENTS];
+  size_t attachments_size;
+} Inst;
+
+typedef enum {
+  CK_INT,
+  CK_NULL,
+  CK_UNDEF,
+  CK_AGGREGATE,
+  CK_STRING,
+  CK_GLOBAL,
+} ConstKind;
+
+typedef struct tConst {
+  ConstKind kind;
+  int type;
+  int64_t value;
+  struct tConst** elems;
+  size_t elems_size;
+  char* bytes;
+  size_t bytes_size;
+  const char* name;
+  size_t len;
+  uint64_t id;
+} Const;
+
+typedef struct {
+  const char* key;
+  size_t len;
+  int value;
+} NameEntry;
+
+typedef struct {
+  NameEntry* entries;
+  size_t capacity;
+  size_t size;
+} NameMap;
+
+typedef struct {
+  const char* name;
+  size_t len;
+  int type;        // 値の型(グローバル変数自体はこのポインタ)
+  unsigned linkage;
+  bool constant;
+  unsigned align;
+  unsigned unnamed_addr;
+  Const* init;
+} Global;
+
+typedef struct {
+  const char* name;
+  size_t len;
+  int type;        // 関数型
+  unsigned linkage;
+  bool defined;
+  Inst* insts;
+  size_t insts_size;
+  size_t insts_capacity;
+  size_t blocks;
+  bool nounwind;
+  NameMap values;  // 引数は (i << 1), 命令は (i << 1) | 1
+  NameMap labels;
+  // "define ... !prof !N {" のように関数に付いたmetadata
+  Attachment attachments[MAX_ATTACHMENTS];
+  size_t attachments_size;
+} Function;
+
+typedef enum {
+  MD_STRING,
+  MD_VALUE,
+  MD_NODE,
+} MetadataKind;
+
+typedef struct {
+  MetadataKind kind;
+  bool distinct;
+  char* bytes;         // MD_STRING
+  size_t bytes_size;
+  int type;            // MD_VALUE
+  int64_t value;
+  uint64_t value_id;
+  MetadataRef* ops;    // MD_NODE
+  size_t ops_size;
+  uint64_t id;         // 書き出すときのmetadata id
+} Metadata;
+
+typedef struct {
+  const char* name;
+  size_t len;
+} MetadataKindName;
+
+typedef enum {
+  LX_EOF,
+  LX_LOCAL,
+  LX_GLOBAL,
+  LX_WORD,
+  LX_INT,
+  LX_STRING,
+  LX_PUNCT,
+  LX_MDSTRING, // !"..."
+  LX_MDREF,    // !0
+  LX_MDNAME,   // !llvm.loop
+} LexType;
+
+typedef struct {
+  LexType type;
+  const char* str;
+  size_t len;
+  int64_t value;
+} Lex;
+
+typedef struct {
+  const char* src;
+  size_t len;
+  size_t pos;
+  Lex tok;
+
+  Arena* arena;
+  Error* error;
+  jmp_buf fail;
+
+  Type* types;
+  size_t types_size;
+  size_t types_capacity;
+
+  Global* globals;
+  size_t globals_size;
+  size_t globals_capacity;
+
+  Function* funcs;
+  size_t funcs_size;
+  size_t funcs_capacity;
+
+  NameMap names;   // グローバル変数は (i << 1), 関数は (i << 1) | 1
+
+  Metadata* mds;
+  size_t mds_size;
+  size_t mds_capacity;
+  NameMap md_slots;
+
+  MetadataKindName* md_kinds;
+  size_t md_kinds_size;
+  size_t md_kinds_capacity;
+  NameMap md_kind_names;
+} Assembler;
+
+// 変換中のデータはすべて呼び出し元のArenaから確保する
+static void* alloc(Assembler* as, size_t size) {
+  return arena_alloc(as->arena, size);
+}
+
+// 配列を倍々で伸ばす。古い領域はarenaごと最後に捨てる
+static void* grow(Assembler* as, void* data, size_t size, size_t* capacity, size_t elem) {
+  if( size < *capacity ) return data;
+  const size_t next = *capacity ? *capacity * 2 : 16;
+  void* p = alloc(as, next * elem);
+  if( size ) memcpy(p, data, size * elem);
+  *capacity = next;
+  return p;
+}
+
+static void fail(Assembler* as, const char* format, ...) {
+  size_t line = 1;
+  for( size_t i = 0; i < as->pos && i < as->len; ++i )
+    if( as->src[i] == '\n' ) ++line;
+
+  char message[200];
+  va_list va;
+  va_start(va, format);
+  vsnprintf(message, sizeof(message), format, va);
+  va_end(va);
+  set_error(as->error, as->pos, "bitcode: line %zu: %s", line, message);
+  longjmp(as->fail, 1);
+}
+
+// ------------------------------------------------------------------ name map
+
+static uint64_t hash_name(const char* key, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  for( size_t i = 0; i < len; ++i ) {
+    h ^= (unsigned char)key[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static NameEntry* map_find(NameMap* map, const char* key, size_t len) {
+  if( map->capacity == 0 ) return NULL;
+  size_t i = hash_name(key, len) & (map->capacity - 1);
+  for( ; ; i = (i + 1) & (map->capacity - 1) ) {
+    NameEntry* e = &map->entries[i];
+    if( !e->key ) return e;
+    if( e->len == len && memcmp(e->key, key, len) == 0 ) return e;
+  }
+}
+
+static bool map_get(NameMap* map, const char* key, size_t len, int* value) {
+  NameEntry* e = map_find(map, key, len);
+  if( !e || !e->key ) return false;
+  *value = e->value;
+  return true;
+}
+
+static void map_put(Assembler* as, NameMap* map, const char* key, size_t len, int value) {
+  if( (map->size + 1) * 2 > map->capacity ) {
+    NameMap next;
+    next.capacity = map->capacity ? map->capacity * 2 : 64;
+    next.size = 0;
+    next.entries = (NameEntry*)alloc(as, sizeof(NameEntry) * next.capacity);
+    memset(next.entries, 0, sizeof(NameEntry) * next.capacity);
+    for( size_t i = 0; i < map->capacity; ++i ) {
+      NameEntry* e = &map->entries[i];
+      if( e->key ) *map_find(&next, e->key, e->len) = *e;
+    }
+    next.size = map->size;
+    *map = next;
+  }
+  NameEntry* e = map_find(map, key, len);
+  if( e->key ) fail(as, "redefinition of '%.*s'", (int)len, key);
+  e->key = key;
+  e->len = len;
+  e->value = value;
+  ++map->size;
+}
+
+// ------------------------------------------------------------------ types
+
+static int intern_type(Assembler* as, Type t) {
+  for( size_t i = 0; i < as->types_size; ++i ) {
+    const Type* u = &as->types[i];
+    if( u->kind != t.kind || u->size != t.size || u->elem != t.elem ) continue;
+    if( u->vararg != t.vararg || u->members_size != t.members_size ) continue;
+    if( t.members_size && memcmp(u->members, t.members, sizeof(int) * t.members_size) != 0 ) continue;
+    return (int)i;
+  }
+  as->types = (Type*)grow(as, as->types, as->types_size, &as->types_capacity, sizeof(Type));
+  as->types[as->types_size] = t;
+  return (int)as->types_size++;
+}
+
+static int simple_type(Assembler* as, TypeKind kind, uint64_t size, int elem) {
+  Type t = { kind, size, elem, NULL, 0, false };
+  return intern_type(as, t);
+}
+
+static int int_type(Assembler* as, uint64_t width) {
+  return simple_type(as, TY_INT, width, -1);
+}
+
+static int ptr_type(Assembler* as, int elem) {
+  return simple_type(as, TY_PTR, 0, elem);
+}
+
+// ------------------------------------------------------------------ lexer
+
+static bool is_name_char(char c) {
+  return isalnum((unsigned char)c) || c == '.' || c == '_' || c == '$' || c == '-';
+}
+
+static void next(Assembler* as) {
+  for( ; ; ) {
+    while( as->pos < as->len && isspace((unsigned char)as->src[as->pos]) ) ++as->pos;
+    if( as->pos < as->len && as->src[as->pos] == ';' ) {
+      while( as->pos < as->len && as->src[as->pos] != '\n' ) ++as->pos;
+      continue;
+    }
+    break;
+  }
+
+  Lex* t = &as->tok;
+  t->str = as->src + as->pos;
+  t->len = 0;
+  t->value = 0;
+  if( as->pos >= as->len ) {
+    t->type = LX_EOF;
+    return;
+  }
+
+  const char c = as->src[as->pos];
+  const char c1 = as->pos + 1 < as->len ? as->src[as->pos + 1] : '\0';
+
+  if( c == '%' || c == '@' ) {
+    t->type = c == '%' ? LX_LOCAL : LX_GLOBAL;
+    size_t p = ++as->pos;
+    while( p < as->len && is_name_char(as->src[p]) ) ++p;
+    t->str = as->src + as->pos;
+    t->len = p - as->pos;
+    as->pos = p;
+    return;
+  }
+
+  if( isdigit((unsigned char)c) || (c == '-' && isdigit((unsigned char)c1)) ) {
+    size_t p = as->pos;
+    bool negative = false;
+    if( c == '-' ) { negative = true; ++p; }
+    uint64_t value = 0;
+    while( p < as->len && isdigit((unsigned char)as->src[p]) )
+      value = value * 10 + (uint64_t)(as->src[p++] - '0');
+    t->type = LX_INT;
+    t->value = negative ? -(int64_t)value : (int64_t)value;
+    t->len = p - as->pos;
+    as->pos = p;
+    return;
+  }
+
+  if( c == 'c' && c1 == '"' ) {
+    size_t p = as->pos + 2;
+    while( p < as->len && as->src[p] != '"' ) ++p;
+    t->type = LX_STRING;
+    t->str = as->src + as->pos + 2;
+    t->len = p - (as->pos + 2);
+    as->pos = p + 1;
+    return;
+  }
+
+  if( isalpha((unsigned char)c) || c == '_' || c == '.' ) {
+    if( c == '.' && c1 == '.' ) {
+      t->type = LX_PUNCT;
+      t->len = 3;
+      as->pos += 3;
+      return;
+    }
+    size_t p = as->pos;
+    while( p < as->len && is_name_char(as->src[p]) ) ++p;
+    t->type = LX_WORD;
+    t->len = p - as->pos;
+    as->pos = p;
+    return;
+  }
+
+  if( c == '!' && c1 == '"' ) {
+    size_t p = as->pos + 2;
+    while( p < as->len && as->src[p] != '"' ) ++p;
+    t->type = LX_MDSTRING;
+    t->str = as->src + as->pos + 2;
+    t->len = p - (as->pos + 2);
+    as->pos = p + 1;
+    return;
+  }
+
+  if( c == '!' && (isalnum((unsigned char)c1) || c1 == '.' || c1 == '_') ) {
+    size_t p = ++as->pos;
+    bool digits = true;
+    while( p < as->len && is_name_char(as->src[p]) ) {
+      if( !isdigit((unsigned char)as->src[p]) ) digits = false;
+      ++p;
+    }
+    t->type = digits ? LX_MDREF : LX_MDNAME;
+    t->str = as->src + as->pos;
+    t->len = p - as->pos;
+    as->pos = p;
+    return;
+  }
+
+  t->type = LX_PUNCT;
+  t->len = 1;
+  ++as->pos;
+}
+
+static bool is_punct(Assembler* as, char c) {
+  return as->tok.type == LX_PUNCT && as->tok.str[0] == c;
+}
+
+static bool is_word(Assembler* as, const char* word) {
+  return as->tok.type == LX_WORD && strlen(word) == as->tok.len && strncmp(word, as->tok.str, as->tok.len) == 0;
+}
+
+static bool accept_punct(Assembler* as, char c) {
+  if( !is_punct(as, c) ) return false;
+  next(as);
+  return true;
+}
+
+static bool accept_word(Assembler* as, const char* word) {
+  if( !is_word(as, word) ) return false;
+  next(as);
+  return true;
+}
+
+static void expect_punct(Assembler* as, char c) {
+  if( !accept_punct(as, c) ) fail(as, "'%c' expected, but got '%.*s'", c, (int)as->tok.len, as->tok.str);
+}
+
+static void expect_word(Assembler* as, const char* word) {
+  if( !accept_word(as, word) ) fail(as, "'%s' expected, but got '%.*s'", word, (int)as->tok.len, as->tok.str);
+}
+
+static int64_t expect_int(Assembler* as) {
+  if( as->tok.type != LX_INT ) fail(as, "integer expected, but got '%.*s'", (int)as->tok.len, as->tok.str);
+  const int64_t value = as->tok.value;
+  next(as);
+  return value;
+}
+
+// ------------------------------------------------------------------ parser
+
+static int parse_type(Assembler* as);
+static int intern_md_kind(Assembler* as, const char* name, size_t len);
+
+// '(' を読んだ後から、関数型の引数リストを ')' まで読む
+static int parse_func_type(Assembler* as, int ret) {
+  int params[256];
+  size_t size = 0;
+  bool vararg = false;
+  if( !accept_punct(as, ')') ) {
+    do {
+      if( as->tok.type == LX_PUNCT && as->tok.len == 3 ) {
+        next(as);
+        vararg = true;
+        break;
+      }
+      if( size >= 256 ) fail(as, "too many parameters");
+      params[size++] = parse_type(as);
+    } while( accept_punct(as, ',') );
+    expect_punct(as, ')');
+  }
+  Type t = { TY_FUNC, 0, ret, NULL, size, vararg };
+  t.members = (int*)alloc(as, sizeof(int) * (size ? size : 1));
+  memcpy(t.members, params, sizeof(int) * size);
+  return intern_type(as, t);
+}
+
+static int parse_type(Assembler* as) {
+  int type;
+  if( accept_word(as, "void") ) {
+    type = simple_type(as, TY_VOID, 0, -1);
+  } else if( accept_word(as, "label") ) {
+    type = simple_type(as, TY_LABEL, 0, -1);
+  } else if( as->tok.type == LX_WORD && as->tok.str[0] == 'i' && as->tok.len > 1 && isdigit((unsigned char)as->tok.str[1]) ) {
+    type = int_type(as, strtoull(as->tok.str + 1, NULL, 10));
+    next(as);
+  } else if( accept_punct(as, '[') ) {
+    const int64_t count = expect_int(as);
+    expect_word(as, "x");
+    const int elem = parse_type(as);
+    expect_punct(as, ']');
+    type = simple_type(as, TY_ARRAY, (uint64_t)count, elem);
+  } else if( accept_punct(as, '{') ) {
+    int members[256];
+    size_t size = 0;
+    if( !accept_punct(as, '}') ) {
+      do {
+        if( size >= 256 ) fail(as, "too many struct members");
+        members[size++] = parse_type(as);
+      } while( accept_punct(as, ',') );
+      expect_punct(as, '}');
+    }
+    Type t = { TY_STRUCT, 0, -1, NULL, size, false };
+    t.members = (int*)alloc(as, sizeof(int) * (size ? size : 1));
+    memcpy(t.members, members, sizeof(int) * size);
+    type = intern_type(as, t);
+  } else {
+    fail(as, "unsupported type '%.*s'", (int)as->tok.len, as->tok.str);
+  }
+
+  for( ; ; ) {
+    if( accept_punct(as, '*') ) type = ptr_type(as, type);
+    else if( accept_punct(as, '(') ) type = parse_func_type(as, type);
+    else return type;
+  }
+}
+
+static unsigned parse_linkage(Assembler* as) {
+  if( accept_word(as, "private") ) return 9;
+  if( accept_word(as, "internal") ) return 3;
+  if( accept_word(as, "appending") ) return 2;
+  accept_word(as, "external");
+  return 0;
+}
+
+// ", align N" が続いていれば読む
+static unsigned parse_align(Assembler* as) {
+  if( !is_punct(as, ',') ) return 0;
+  const size_t pos = as->pos;
+  const Lex tok = as->tok;
+  next(as);
+  if( !accept_word(as, "align") ) {
+    as->pos = pos;
+    as->tok = tok;
+    return 0;
+  }
+  return (unsigned)expect_int(as);
+}
+
+static unsigned encode_align(unsigned align) {
+  unsigned log = 0;
+  if( align == 0 ) return 0;
+  while( (1u << log) < align ) ++log;
+  return log + 1;
+}
+
+// c"..." の中身をバイト列にする
+static char* decode_string(Assembler* as, const char* str, size_t len, size_t* size) {
+  char* bytes = (char*)alloc(as, len + 1);
+  size_t n = 0;
+  for( size_t i = 0; i < len; ++i ) {
+    if( str[i] == '\\' && i + 2 < len + 1 && isxdigit((unsigned char)str[i + 1]) ) {
+      char hex[3] = { str[i + 1], str[i + 2], '\0' };
+      bytes[n++] = (char)strtol(hex, NULL, 16);
+      i += 2;
+    } else {
+      bytes[n++] = str[i];
+    }
+  }
+  *size = n;
+  return bytes;
+}
+
+static Const* parse_const(Assembler* as, int type) {
+  Const* c = (Const*)alloc(as, sizeof(Const));
+  memset(c, 0, sizeof(Const));
+  c->type = type;
+
+  if( as->tok.type == LX_INT ) {
+    c->kind = CK_INT;
+    c->value = expect_int(as);
+  } else if( accept_word(as, "true") ) {
+    c->kind = CK_INT;
+    c->value = 1;
+  } else if( accept_word(as, "false") ) {
+    c->kind = CK_INT;
+  } else if( accept_word(as, "null") || accept_word(as, "zeroinitializer") ) {
+    c->kind = CK_NULL;
+  } else if( accept_word(as, "undef") || accept_word(as, "poison") ) {
+    c->kind = CK_UNDEF;
+  } else if( as->tok.type == LX_GLOBAL ) {
+    c->kind = CK_GLOBAL;
+    c->name = as->tok.str;
+    c->len = as->tok.len;
+    next(as);
+  } else if( as->tok.type == LX_STRING ) {
+    c->kind = CK_STRING;
+    c->bytes = decode_string(as, as->tok.str, as->tok.len, &c->bytes_size);
+    next(as);
+  } else if( is_punct(as, '[') || is_punct(as, '{') ) {
+    const char close = is_punct(as, '[') ? ']' : '}';
+    next(as);
+    const Type* t = &as->types[type];
+    const size_t size = t->kind == TY_ARRAY ? t->size : t->members_size;
+    c->kind = CK_AGGREGATE;
+    c->elems = (Const**)alloc(as, sizeof(Const*) * (size ? size : 1));
+    for( size_t i = 0; i < size; ++i ) {
+      if( i ) expect_punct(as, ',');
+      const int elem_type = parse_type(as);
+      c->elems[i] = parse_const(as, elem_type);
+    }
+    c->elems_size = size;
+    expect_punct(as, close);
+  } else {
+    fail(as, "unsupported constant '%.*s'", (int)as->tok.len, as->tok.str);
+  }
+  return c;
+}
+
+static void parse_global(Assembler* as) {
+  Global g;
+  memset(&g, 0, sizeof(Global));
+  g.name = as->tok.str;
+  g.len = as->tok.len;
+  next(as);
+  expect_punct(as, '=');
+
+  const bool external = is_word(as, "external");
+  g.linkage = parse_linkage(as);
+  if( accept_word(as, "unnamed_addr") ) g.unnamed_addr = 1;
+  else if( accept_word(as, "local_unnamed_addr") ) g.unnamed_addr = 2;
+
+  if( accept_word(as, "constant") ) g.constant = true;
+  else expect_word(as, "global");
+
+  g.type = parse_type(as);
+  if( !external ) g.init = parse_const(as, g.type);
+  g.align = parse_align(as);
+
+  map_put(as, &as->names, g.name, g.len, (int)(as->globals_size << 1));
+  as->globals = (Global*)grow(as, as->globals, as->globals_size, &as->globals_capacity, sizeof(Global));
+  as->globals[as->globals_size++] = g;
+}
+
+static Function* add_function(Assembler* as) {
+  as->funcs = (Function*)grow(as, as->funcs, as->funcs_size, &as->funcs_capacity, sizeof(Function));
+  Function* f = &as->funcs[as->funcs_size];
+  memset(f, 0, sizeof(Function));
+  map_put(as, &as->names, as->tok.str, as->tok.len, (int)((as->funcs_size << 1) | 1));
+  ++as->funcs_size;
+  f->name = as->tok.str;
+  f->len = as->tok.len;
+  next(as);
+  return f;
+}
+
+// "!kind !N" を読んでattachmentsに追加する
+static void parse_attachment(Assembler* as, Attachment* attachments, size_t* size) {
+  if( as->tok.type != LX_MDNAME ) fail(as, "metadata attachment expected, but got '%.*s'", (int)as->tok.len, as->tok.str);
+  if( *size >= MAX_ATTACHMENTS ) fail(as, "too many metadata attachments");
+  Attachment* a = &attachments[(*size)++];
+  a->kind = intern_md_kind(as, as->tok.str, as->tok.len);
+  next(as);
+  if( as->tok.type != LX_MDREF ) fail(as, "metadata node expected, but got '%.*s'", (int)as->tok.len, as->tok.str);
+  a->node.slot = as->tok.str;
+  a->node.len = as->tok.len;
+  a->node.index = -1;
+  next(as);
+}
+
+// "ret @name(params)" を読む。名前付きの引数はf->valuesに登録する
+static void parse_prototype(Assembler* as, Function* f, int ret) {
+  expect_punct(as, '(');
+  int params[256];
+  size_t size = 0;
+  size_t unnamed = 0;
+  bool vararg = false;
+  if( !accept_punct(as, ')') ) {
+    do {
+      if( as->tok.type == LX_PUNCT && as->tok.len == 3 ) {
+        next(as);
+        vararg = true;
+        break;
+      }
+      if( size >= 256 ) fail(as, "too many parameters");
+      params[size] = parse_type(as);
+      // 引数の属性は読み飛ばす
+      while( as->tok.type == LX_WORD ) next(as);
+      if( as->tok.type == LX_LOCAL ) {
+        map_put(as, &f->values, as->tok.str, as->tok.len, (int)(size << 1));
+        next(as);
+      } else {
+        char* name = (char*)alloc(as, 24);
+        const int len = snprintf(name, 24, "%zu", unnamed++);
+        map_put(as, &f->values, name, (size_t)len, (int)(size << 1));
+      }
+      ++size;
+    } while( accept_punct(as, ',') );
+    expect_punct(as, ')');
+  }
+  Type t = { TY_FUNC, 0, ret, NULL, size, vararg };
+  t.members = (int*)alloc(as, sizeof(int) * (size ? size : 1));
+  memcpy(t.members, params, sizeof(int) * size);
+  f->type = intern_type(as, t);
+
+  // 関数属性はnounwindだけ書ける。他のものは黙って落とさずに止める
+  while( as->tok.type == LX_WORD && !is_word(as, "define") && !is_word(as, "declare") ) {
+    if( !accept_word(as, "nounwind") ) fail(as, "unsupported function attribute '%.*s'", (int)as->tok.len, as->tok.str);
+    f->nounwind = true;
+  }
+  if( is_punct(as, '#') ) fail(as, "attribute groups are not supported");
+  // "!kind !N"
+  while( as->tok.type == LX_MDNAME ) {
+    parse_attachment(as, f->attachments, &f->attachments_size);
+  }
+}
+
+static Inst* add_inst(Assembler* as, Function* f, InstKind kind, size_t ops_size) {
+  f->insts = (Inst*)grow(as, f->insts, f->insts_size, &f->insts_capacity, sizeof(Inst));
+  Inst* inst = &f->insts[f->insts_size++];
+  memset(inst, 0, sizeof(Inst));
+  inst->kind = kind;
+  inst->type = -1;
+  inst->aux = -1;
+  inst->ops_size = ops_size;
+  inst->ops = (Operand*)alloc(as, sizeof(Operand) * (ops_size ? ops_size : 1));
+  memset(inst->ops, 0, sizeof(Operand) * (ops_size ? ops_size : 1));
+  return inst;
+}
+
+static void parse_value(Assembler* as, int type, Operand* op) {
+  // phiやswitchはoperandをスタックに並べて読むので、前の値が残らないように全部埋める
+  memset(op, 0, sizeof(Operand));
+  op->type = type;
+  if( as->tok.type == LX_LOCAL || as->tok.type == LX_GLOBAL ) {
+    op->kind = as->tok.type == LX_LOCAL ? OPND_LOCAL : OPND_GLOBAL;
+    op->name = as->tok.str;
+    op->len = as->tok.len;
+    next(as);
+  } else if( as->tok.type == LX_INT ) {
+    op->kind = OPND_INT;
+    op->value = expect_int(as);
+  } else if( accept_word(as, "true") ) {
+    op->kind = OPND_INT;
+    op->value = 1;
+  } else if( accept_word(as, "false") ) {
+    op->kind = OPND_INT;
+  } else if( accept_word(as, "null") || accept_word(as, "zeroinitializer") ) {
+    op->kind = OPND_NULL;
+  } else if( accept_word(as, "undef") || accept_word(as, "poison") ) {
+    op->kind = OPND_UNDEF;
+  } else {
+    fail(as, "unsupported operand '%.*s'", (int)as->tok.len, as->tok.str);
+  }
+}
+
+static void parse_typed_value(Assembler* as, Operand* op) {
+  const int type = parse_type(as);
+  parse_value(as, type, op);
+}
+
+static void parse_label(Assembler* as, Operand* op) {
+  expect_word(as, "label");
+  if( as->tok.type != LX_LOCAL ) fail(as, "label expected");
+  op->kind = OPND_BLOCK;
+  op->name = as->tok.str;
+  op->len = as->tok.len;
+  next(as);
+}
+
+// ------------------------------------------------------------------ metadata
+
+static int add_metadata(Assembler* as, MetadataKind kind) {
+  as->mds = (Metadata*)grow(as, as->mds, as->mds_size, &as->mds_capacity, sizeof(Metadata));
+  Metadata* md = &as->mds[as->mds_size];
+  memset(md, 0, sizeof(Metadata));
+  md->kind = kind;
+  return (int)as->mds_size++;
+}
+
+static int intern_md_kind(Assembler* as, const char* name, size_t len) {
+  int kind;
+  if( map_get(&as->md_kind_names, name, len, &kind) ) return kind;
+  as->md_kinds = (MetadataKindName*)grow(as, as->md_kinds, as->md_kinds_size, &as->md_kinds_capacity, sizeof(MetadataKindName));
+  MetadataKindName k = { name, len };
+  as->md_kinds[as->md_kinds_size] = k;
+  map_put(as, &as->md_kind_names, name, len, (int)as->md_kinds_size);
+  return (int)as->md_kinds_size++;
+}
+
+// nodeの要素を1つ読む。文字列と値はその場で別のmetadataにする
+static void parse_metadata_ref(Assembler* as, MetadataRef* ref) {
+  memset(ref, 0, sizeof(MetadataRef));
+  ref->index = -1;
+  if( as->tok.type == LX_MDREF ) {
+    ref->slot = as->tok.str;
+    ref->len = as->tok.len;
+    next(as);
+  } else if( as->tok.type == LX_MDSTRING ) {
+    ref->index = add_metadata(as, MD_STRING);
+    Metadata* md = &as->mds[ref->index];
+    md->bytes = decode_string(as, as->tok.str, as->tok.len, &md->bytes_size);
+    next(as);
+  } else if( !accept_word(as, "null") ) {
+    Operand op;
+    memset(&op, 0, sizeof(Operand));
+    parse_typed_value(as, &op);
+    if( op.kind != OPND_INT ) fail(as, "unsupported metadata operand");
+    ref->index = add_metadata(as, MD_VALUE);
+    as->mds[ref->index].type = op.type;
+    as->mds[ref->index].value = op.value;
+  }
+}
+
+// "!N = [distinct] !{...}"
+static void parse_metadata(Assembler* as) {
+  const char* slot = as->tok.str;
+  const size_t len = as->tok.len;
+  next(as);
+  expect_punct(as, '=');
+  const bool distinct = accept_word(as, "distinct");
+  expect_punct(as, '!');
+  expect_punct(as, '{');
+  MetadataRef ops[64];
+  size_t size = 0;
+  if( !accept_punct(as, '}') ) {
+    do {
+      if( size >= 64 ) fail(as, "too many metadata operands");
+      parse_metadata_ref(as, &ops[size++]);
+    } while( accept_punct(as, ',') );
+    expect_punct(as, '}');
+  }
+  const int index = add_metadata(as, MD_NODE);
+  Metadata* md = &as->mds[index];
+  md->distinct = distinct;
+  md->ops_size = size;
+  md->ops = (MetadataRef*)alloc(as, sizeof(MetadataRef) * (size ? size : 1));
+  memcpy(md->ops, ops, sizeof(MetadataRef) * size);
+  map_put(as, &as->md_slots, slot, len, index);
+}
+
+typedef struct {
+  const char* name;
+  int code;
+} Opcode;
+
+static const Opcode binops[] = {
+  { "add", 0 }, { "sub", 1 }, { "mul", 2 }, { "udiv", 3 }, { "sdiv", 4 },
+  { "urem", 5 }, { "srem", 6 }, { "shl", 7 }, { "lshr", 8 }, { "ashr", 9 },
+  { "and", 10 }, { "or", 11 }, { "xor", 12 },
+};
+
+static const Opcode casts[] = {
+  { "trunc", 0 }, { "zext", 1 }, { "sext", 2 },
+  { "ptrtoint", 9 }, { "inttoptr", 10 }, { "bitcast", 11 },
+};
+
+static const Opcode predicates[] = {
+  { "eq", 32 }, { "ne", 33 }, { "ugt", 34 }, { "uge", 35 }, { "ult", 36 },
+  { "ule", 37 }, { "sgt", 38 }, { "sge", 39 }, { "slt", 40 }, { "sle", 41 },
+};
+
+static int find_opcode(Assembler* as, const Opcode* table, size_t size) {
+  for( size_t i = 0; i < size; ++i ) {
+    if( is_word(as, table[i].name) ) {
+      next(as);
+      return table[i].code;
+    }
+  }
+  return -1;
+}
+
+#define TABLE_SIZE(table) (sizeof(table) / sizeof(Opcode))
+
+// 1命令を読む。終端命令ならtrue
+static bool parse_inst(Assembler* as, Function* f) {
+  const char* name = NULL;
+  size_t len = 0;
+  if( as->tok.type == LX_LOCAL ) {
+    name = as->tok.str;
+    len = as->tok.len;
+    next(as);
+    expect_punct(as, '=');
+  }
+
+  Inst* inst;
+  bool terminator = false;
+  int code;
+  if( (code = find_opcode(as, binops, TABLE_SIZE(binops))) >= 0 ) {
+    // nuwとexactは1、nswは2。付けられる命令が重ならないのでopcodeで分けなくてよい
+    int flags = 0;
+    for( ;; ) {
+      if( accept_word(as, "nuw") || accept_word(as, "exact") ) flags |= 1;
+      else if( accept_word(as, "nsw") ) flags |= 2;
+      else break;
+    }
+    inst = add_inst(as, f, IN_BINOP, 2);
+    inst->code = code;
+    inst->aux = flags;
+    parse_typed_value(as, &inst->ops[0]);
+    expect_punct(as, ',');
+    parse_value(as, inst->ops[0].type, &inst->ops[1]);
+    inst->type = inst->ops[0].type;
+  } else if( (code = find_opcode(as, casts, TABLE_SIZE(casts))) >= 0 ) {
+    inst = add_inst(as, f, IN_CAST, 1);
+    inst->code = code;
+    parse_typed_value(as, &inst->ops[0]);
+    expect_word(as, "to");
+    inst->type = inst->aux = parse_type(as);
+  } else if( accept_word(as, "icmp") ) {
+    inst = add_inst(as, f, IN_CMP, 2);
+    if( (inst->code = find_opcode(as, predicates, TABLE_SIZE(predicates))) < 0 )
+      fail(as, "unknown icmp predicate '%.*s'", (int)as->tok.len, as->tok.str);
+    parse_typed_value(as, &inst->ops[0]);
+    expect_punct(as, ',');
+    parse_value(as, inst->ops[0].type, &inst->ops[1]);
+    inst->type = int_type(as, 1);
+  } else if( accept_word(as, "select") ) {
+    inst = add_inst(as, f, IN_SELECT, 3);
+    parse_typed_value(as, &inst->ops[2]);
+    expect_punct(as, ',');
+    parse_typed_value(as, &inst->ops[0]);
+    expect_punct(as, ',');
+    parse_typed_value(as, &inst->ops[1]);
+    inst->type = inst->ops[0].type;
+  } else if( accept_word(as, "phi") ) {
+    const int type = parse_type(as);
+    Operand incoming[512];
+    size_t size = 0;
+    do {
+      if( size + 2 > 512 ) fail(as, "too many phi operands");
+      expect_punct(as, '[');
+      parse_value(as, type, &incoming[size++]);
+      expect_punct(as, ',');
+      if( as->tok.type != LX_LOCAL ) fail(as, "label expected");
+      memset(&incoming[size], 0, sizeof(Operand));
+      incoming[size].kind = OPND_BLOCK;
+      incoming[size].name = as->tok.str;
+      incoming[size].len = as->tok.len;
+      ++size;
+      next(as);
+      expect_punct(as, ']');
+    } while( accept_punct(as, ',') );
+    inst = add_inst(as, f, IN_PHI, size);
+    memcpy(inst->ops, incoming, sizeof(Operand) * size);
+    inst->type = type;
+  } else if( accept_word(as, "br") ) {
+    terminator = true;
+    if( is_word(as, "label") ) {
+      inst = add_inst(as, f, IN_BR, 1);
+      parse_label(as, &inst->ops[0]);
+    } else {
+      inst = add_inst(as, f, IN_BR, 3);
+      parse_typed_value(as, &inst->ops[0]);
+      expect_punct(as, ',');
+      parse_label(as, &inst->ops[1]);
+      expect_punct(as, ',');
+      parse_label(as, &inst->ops[2]);
+    }
+  } else if( accept_word(as, "switch") ) {
+    // switch i32 %x, label %default [ i32 1, label %a i32 2, label %b ]
+    terminator = true;
+    Operand ops[512];
+    memset(ops, 0, sizeof(ops));
+    parse_typed_value(as, &ops[0]);
+    expect_punct(as, ',');
+    parse_label(as, &ops[1]);
+    size_t size = 2;
+    expect_punct(as, '[');
+    while( !accept_punct(as, ']') ) {
+      if( size + 2 > 512 ) fail(as, "too many switch cases");
+      parse_typed_value(as, &ops[size++]);
+      expect_punct(as, ',');
+      parse_label(as, &ops[size++]);
+    }
+    inst = add_inst(as, f, IN_SWITCH, size);
+    memcpy(inst->ops, ops, sizeof(Operand) * size);
+  } else if( accept_word(as, "ret") ) {
+    terminator = true;
+    if( accept_word(as, "void") ) {
+      inst = add_inst(as, f, IN_RET, 0);
+    } else {
+      inst = add_inst(as, f, IN_RET, 1);
+      parse_typed_value(as, &inst->ops[0]);
+    }
+  } else if( accept_word(as, "unreachable") ) {
+    terminator = true;
+    inst = add_inst(as, f, IN_UNREACHABLE, 0);
+  } else if( accept_word(as, "alloca") ) {
+    inst = add_inst(as, f, IN_ALLOCA, 1);
+    inst->aux = parse_type(as);
+    inst->ops[0].kind = OPND_INT;
+    inst->ops[0].type = int_type(as, 32);
+    inst->ops[0].value = 1;
+    inst->align = parse_align(as);
+    inst->type = ptr_type(as, inst->aux);
+  } else if( accept_word(as, "load") ) {
+    inst = add_inst(as, f, IN_LOAD, 1);
+    inst->type = inst->aux = parse_type(as);
+    expect_punct(as, ',');
+    parse_typed_value(as, &inst->ops[0]);
+    inst->align = parse_align(as);
+  } else if( accept_word(as, "store") ) {
+    inst = add_inst(as, f, IN_STORE, 2);
+    parse_typed_value(as, &inst->ops[1]);
+    expect_punct(as, ',');
+    parse_typed_value(as, &inst->ops[0]);
+    inst->align = parse_align(as);
+  } else if( accept_word(as, "getelementptr") ) {
+    const bool inbounds = accept_word(as, "inbounds");
+    const int source = parse_type(as);
+    Operand ops[64];
+    size_t size = 0;
+    while( accept_punct(as, ',') ) {
+      if( size >= 64 ) fail(as, "too many getelementptr indices");
+      parse_typed_value(as, &ops[size++]);
+    }
+    inst = add_inst(as, f, IN_GEP, size);
+    memcpy(inst->ops, ops, sizeof(Operand) * size);
+    inst->code = inbounds;
+    inst->aux = source;
+    // 結果の型をindexを辿って求める
+    int type = source;
+    for( size_t i = 2; i < size; ++i ) {
+      const Type* t = &as->types[type];
+      if( t->kind == TY_ARRAY ) type = t->elem;
+      else if( t->kind == TY_STRUCT ) type = t->members[ops[i].value];
+      else fail(as, "unsupported getelementptr index");
+    }
+    inst->type = ptr_type(as, type);
+  } else if( accept_word(as, "call") || (accept_word(as, "tail") && accept_word(as, "call")) ) {
+    int type = parse_type(as);
+    Operand callee;
+    memset(&callee, 0, sizeof(Operand));
+    parse_value(as, -1, &callee);
+    expect_punct(as, '(');
+    Operand args[256];
+    size_t size = 0;
+    if( !accept_punct(as, ')') ) {
+      do {
+        if( size >= 256 ) fail(as, "too many arguments");
+        parse_typed_value(as, &args[size++]);
+      } while( accept_punct(as, ',') );
+      expect_punct(as, ')');
+    }
+    // 関数型は宣言済みの関数ならその型、そうでなければ引数から組み立てる
+    int fn;
+    if( as->types[type].kind == TY_FUNC ) {
+      fn = type;
+      type = as->types[fn].elem;
+    } else if( callee.kind == OPND_GLOBAL && map_get(&as->names, callee.name, callee.len, &fn) && (fn & 1) ) {
+      fn = as->funcs[fn >> 1].type;
+    } else {
+      Type t = { TY_FUNC, 0, type, NULL, size, false };
+      t.members = (int*)alloc(as, sizeof(int) * (size ? size : 1));
+      for( size_t i = 0; i < size; ++i ) t.members[i] = args[i].type;
+      fn = intern_type(as, t);
+    }
+    callee.type = ptr_type(as, fn);
+    inst = add_inst(as, f, IN_CALL, size + 1);
+    inst->ops[0] = callee;
+    memcpy(inst->ops + 1, args, sizeof(Operand) * size);
+    inst->aux = fn;
+    inst->type = type;
+  } else {
+    fail(as, "unsupported instruction '%.*s'", (int)as->tok.len, as->tok.str);
+  }
+
+  inst->has_result = inst->kind != IN_STORE && inst->kind != IN_BR && inst->kind != IN_SWITCH && inst->kind != IN_RET
+    && inst->kind != IN_UNREACHABLE && as->types[inst->type].kind != TY_VOID;
+  if( name ) {
+    if( !inst->has_result ) fail(as, "void instruction can't be named");
+    map_put(as, &f->values, name, len, (int)(((f->insts_size - 1) << 1) | 1));
+  }
+
+  // ", !kind !N"
+  while( accept_punct(as, ',') ) {
+    parse_attachment(as, inst->attachments, &inst->attachments_size);
+  }
+  return terminator;
+}
+
+static void parse_body(Assembler* as, Function* f) {
+  expect_punct(as, '{');
+  bool need_block = true;
+  while( !accept_punct(as, '}') ) {
+    if( as->tok.type == LX_EOF ) fail(as, "unexpected end of input in function body");
+    // ラベル
+    if( (as->tok.type == LX_WORD || as->tok.type == LX_INT) && as->pos < as->len && as->src[as->pos] == ':' ) {
+      map_put(as, &f->labels, as->tok.str, as->tok.len, (int)f->blocks++);
+      ++as->pos;
+      next(as);
+      need_block = false;
+      continue;
+    }
+    // 終端命令の後ろはラベルが無くても新しいblockになる
+    if( need_block ) ++f->blocks;
+    need_block = parse_inst(as, f);
+  }
+}
+
+static void parse_module(Assembler* as) {
+  next(as);
+  while( as->tok.type != LX_EOF ) {
+    if( as->tok.type == LX_GLOBAL ) {
+      parse_global(as);
+    } else if( as->tok.type == LX_MDREF ) {
+      parse_metadata(as);
+    } else if( accept_word(as, "declare") ) {
+      parse_linkage(as);
+      const int ret = parse_type(as);
+      if( as->tok.type != LX_GLOBAL ) fail(as, "function name expected");
+      Function* f = add_function(as);
+      parse_prototype(as, f, ret);
+    } else if( accept_word(as, "define") ) {
+      const unsigned linkage = parse_linkage(as);
+      const int ret = parse_type(as);
+      if( as->tok.type != LX_GLOBAL ) fail(as, "function name expected");
+      Function* f = add_function(as);
+      f->linkage = linkage;
+      f->defined = true;
+      parse_prototype(as, f, ret);
+      parse_body(as, f);
+    } else {
+      fail(as, "unsupported top level entity '%.*s'", (int)as->tok.len, as->tok.str);
+    }
+  }
+}
+
+// ------------------------------------------------------------------ writer
+
+static uint64_t global_id(Assembler* as, const char* name, size_t len) {
+  int value;
+  if( !map_get(&as->names, name, len, &value) ) fail(as, "undefined global '@%.*s'", (int)len, name);
+  if( value & 1 ) return as->globals_size + (uint64_t)(value >> 1);
+  return (uint64_t)(value >> 1);
+}
+
+static void write_types(Assembler* as, BitWriter* w, Record* r) {
+  enter_block(w, BLOCK_TYPE, 4);
+  record_push(r, as->types_size);
+  emit_record(w, 1, r);  // NUMENTRY
+  for( size_t i = 0; i < as->types_size; ++i ) {
+    const Type* t = &as->types[i];
+    switch( t->kind ) {
+      case TY_VOID:
+        emit_record(w, 2, r);
+        break;
+      case TY_LABEL:
+        emit_record(w, 5, r);
+        break;
+      case TY_INT:
+        record_push(r, t->size);
+        emit_record(w, 7, r);
+        break;
+      case TY_PTR:
+        record_push(r, (uint64_t)t->elem);
+        record_push(r, 0);
+        emit_record(w, 8, r);
+        break;
+      case TY_ARRAY:
+        record_push(r, t->size);
+        record_push(r, (uint64_t)t->elem);
+        emit_record(w, 11, r);
+        break;
+      case TY_STRUCT:
+        record_push(r, 0);
+        for( size_t j = 0; j < t->members_size; ++j ) record_push(r, (uint64_t)t->members[j]);
+        emit_record(w, 18, r);
+        break;
+      case TY_FUNC:
+        record_push(r, t->vararg);
+        record_push(r, (uint64_t)t->elem);
+        for( size_t j = 0; j < t->members_size; ++j ) record_push(r, (uint64_t)t->members[j]);
+        emit_record(w, 21, r);
+        break;
+    }
+  }
+  end_block(w);
+}
+
+// 定数をCONSTANTS_BLOCKに書く。current_typeはSETTYPEを省くために使う
+static void write_constant(BitWriter* w, Record* r, int* current_type, ConstKind kind, int type, int64_t value) {
+  if( *current_type != type ) {
+    record_push(r, (uint64_t)type);
+    emit_record(w, 1, r);  // SETTYPE
+    *current_type = type;
+  }
+  switch( kind ) {
+    case CK_NULL:
+      emit_record(w, 2, r);
+      break;
+    case CK_UNDEF:
+      emit_record(w, 3, r);
+      break;
+    case CK_INT:
+      record_push(r, signed_vbr(value));
+      emit_record(w, 4, r);
+      break;
+    default:
+      break;
+  }
+}
+
+// グローバル変数の初期値に後置順でidを振る。
+// GLOBALVARのrecordに初期値のidが要るので、書き出しより先に済ませておく
+static void number_initializer(Assembler* as, Const* c, uint64_t* next_id) {
+  if( c->kind == CK_GLOBAL ) {
+    c->id = global_id(as, c->name, c->len);
+    return;
+  }
+  for( size_t i = 0; i < c->elems_size; ++i )
+    number_initializer(as, c->elems[i], next_id);
+  c->id = (*next_id)++;
+}
+
+// number_initializerと同じ順で書く
+static void write_initializer(BitWriter* w, Record* r, int* current_type, Const* c) {
+  if( c->kind == CK_GLOBAL ) return;
+  for( size_t i = 0; i < c->elems_size; ++i )
+    write_initializer(w, r, current_type, c->elems[i]);
+
+  if( c->kind == CK_AGGREGATE || c->kind == CK_STRING ) {
+    if( *current_type != c->type ) {
+      record_push(r, (uint64_t)c->type);
+      emit_record(w, 1, r);
+      *current_type = c->type;
+    }
+    if( c->kind == CK_AGGREGATE ) {
+      for( size_t i = 0; i < c->elems_size; ++i ) record_push(r, c->elems[i]->id);
+      emit_record(w, 7, r);
+    } else {
+      for( size_t i = 0; i < c->bytes_size; ++i ) record_push(r, (unsigned char)c->bytes[i]);
+      emit_record(w, 8, r);
+    }
+  } else {
+    write_constant(w, r, current_type, c->kind, c->type, c->value);
+  }
+}
+
+typedef struct {
+  OperandKind kind;
+  int type;
+  int64_t value;
+} FnConst;
+
+// 関数内で使う定数を集めてCONSTANTS_BLOCKに書き、各operandにidを振る。
+// 最初の命令のidを返す
+static uint64_t resolve_function(Assembler* as, Function* f, uint64_t base, BitWriter* w, Record* r) {
+  const size_t args = as->types[f->type].members_size;
+
+  FnConst* consts = NULL;
+  size_t consts_size = 0;
+  size_t consts_capacity = 0;
+  for( size_t i = 0; i < f->insts_size; ++i ) {
+    Inst* inst = &f->insts[i];
+    for( size_t j = 0; j < inst->ops_size; ++j ) {
+      Operand* op = &inst->ops[j];
+      if( op->kind != OPND_INT && op->kind != OPND_NULL && op->kind != OPND_UNDEF ) continue;
+      size_t k;
+      for( k = 0; k < consts_size; ++k ) {
+        if( consts[k].kind == op->kind && consts[k].type == op->type && consts[k].value == op->value ) break;
+      }
+      if( k == consts_size ) {
+        consts = (FnConst*)grow(as, consts, consts_size, &consts_capacity, sizeof(FnConst));
+        FnConst c = { op->kind, op->type, op->value };
+        consts[consts_size++] = c;
+      }
+      op->id = base + args + k;
+    }
+  }
+
+  if( consts_size ) {
+    enter_block(w, BLOCK_CONSTANTS, 4);
+    int current_type = -1;
+    for( size_t k = 0; k < consts_size; ++k ) {
+      const ConstKind kind = consts[k].kind == OPND_INT ? CK_INT : consts[k].kind == OPND_NULL ? CK_NULL : CK_UNDEF;
+      write_constant(w, r, &current_type, kind, consts[k].type, consts[k].value);
+    }
+    end_block(w);
+  }
+
+  // 命令の結果にidを振る
+  uint64_t* ids = (uint64_t*)alloc(as, sizeof(uint64_t) * (f->insts_size ? f->insts_size : 1));
+  uint64_t id = base + args + consts_size;
+  for( size_t i = 0; i < f->insts_size; ++i ) {
+    ids[i] = id;
+    if( f->insts[i].has_result ) ++id;
+  }
+
+  for( size_t i = 0; i < f->insts_size; ++i ) {
+    Inst* inst = &f->insts[i];
+    for( size_t j = 0; j < inst->ops_size; ++j ) {
+      Operand* op = &inst->ops[j];
+      int value;
+      switch( op->kind ) {
+        case OPND_LOCAL:
+          if( !map_get(&f->values, op->name, op->len, &value) )
+            fail(as, "undefined value '%%%.*s' in '@%.*s'", (int)op->len, op->name, (int)f->len, f->name);
+          op->id = (value & 1) ? ids[value >> 1] : base + (uint64_t)(value >> 1);
+          break;
+        case OPND_BLOCK:
+          if( !map_get(&f->labels, op->name, op->len, &value) )
+            fail(as, "undefined label '%%%.*s' in '@%.*s'", (int)op->len, op->name, (int)f->len, f->name);
+          op->id = (uint64_t)value;
+          break;
+        case OPND_GLOBAL:
+          op->id = global_id(as, op->name, op->len);
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  return base + args + consts_size;
+}
+
+static uint64_t metadata_id(Assembler* as, const MetadataRef* ref, bool* null) {
+  int index = ref->index;
+  if( ref->slot && !map_get(&as->md_slots, ref->slot, ref->len, &index) )
+    fail(as, "undefined metadata '!%.*s'", (int)ref->len, ref->slot);
+  *null = index < 0;
+  return *null ? 0 : as->mds[index].id;
+}
+
+// metadataのidは文字列、値、ノードの順に振る。値はmodule定数として後ろに足す
+static void number_metadata(Assembler* as, uint64_t* next_value) {
+  uint64_t id = 0;
+  for( MetadataKind kind = MD_STRING; kind <= MD_NODE; ++kind ) {
+    for( size_t i = 0; i < as->mds_size; ++i ) {
+      if( as->mds[i].kind == kind ) as->mds[i].id = id++;
+    }
+  }
+  for( size_t i = 0; i < as->mds_size; ++i ) {
+    if( as->mds[i].kind == MD_VALUE ) as->mds[i].value_id = (*next_value)++;
+  }
+}
+
+static void write_metadata(Assembler* as, BitWriter* w, Record* r) {
+  if( as->md_kinds_size ) {
+    enter_block(w, BLOCK_METADATA_KIND, 3);
+    for( size_t i = 0; i < as->md_kinds_size; ++i ) {
+      record_push(r, i);
+      for( size_t j = 0; j < as->md_kinds[i].len; ++j ) record_push(r, (unsigned char)as->md_kinds[i].name[j]);
+      emit_record(w, 6, r);  // KIND
+    }
+    end_block(w);
+  }
+
+  if( !as->mds_size ) return;
+  enter_block(w, BLOCK_METADATA, 3);
+  for( MetadataKind kind = MD_STRING; kind <= MD_NODE; ++kind ) {
+    for( size_t i = 0; i < as->mds_size; ++i ) {
+      const Metadata* md = &as->mds[i];
+      if( md->kind != kind ) continue;
+      switch( kind ) {
+        case MD_STRING:
+          for( size_t j = 0; j < md->bytes_size; ++j ) record_push(r, (unsigned char)md->bytes[j]);
+          emit_record(w, 1, r);  // STRING_OLD
+          break;
+        case MD_VALUE:
+          record_push(r, (uint64_t)md->type);
+          record_push(r, md->value_id);
+          emit_record(w, 2, r);  // VALUE
+          break;
+        case MD_NODE:
+          // 要素は id + 1 で、0がnull
+          for( size_t j = 0; j < md->ops_size; ++j ) {
+            bool null;
+            const uint64_t id = metadata_id(as, &md->ops[j], &null);
+            record_push(r, null ? 0 : id + 1);
+          }
+          emit_record(w, md->distinct ? 5 : 3, r);  // DISTINCT_NODE : NODE
+          break;
+      }
+    }
+  }
+  end_block(w);
+}
+
+static void push_attachments(Assembler* as, Record* r, const Attachment* attachments, size_t size) {
+  for( size_t j = 0; j < size; ++j ) {
+    bool null;
+    const uint64_t id = metadata_id(as, &attachments[j].node, &null);
+    if( null ) fail(as, "metadata attachment must be a node");
+    record_push(r, (uint64_t)attachments[j].kind);
+    record_push(r, id);
+  }
+}
+
+// metadataを関数のMETADATA_ATTACHMENTに書く。
+// 関数自身のものは [kind, md]... の偶数長、命令のものは先頭に命令番号を付けた奇数長のrecord。
+// 命令は結果の有無に関係なく数える
+static void write_attachments(Assembler* as, BitWriter* w, Record* r, Function* f) {
+  bool any = f->attachments_size > 0;
+  for( size_t i = 0; i < f->insts_size && !any; ++i ) any = f->insts[i].attachments_size > 0;
+  if( !any ) return;
+
+  enter_block(w, BLOCK_METADATA_ATTACHMENT, 3);
+  if( f->attachments_size ) {
+    push_attachments(as, r, f->attachments, f->attachments_size);
+    emit_record(w, 11, r);  // ATTACHMENT
+  }
+  for( size_t i = 0; i < f->insts_size; ++i ) {
+    const Inst* inst = &f->insts[i];
+    if( !inst->attachments_size ) continue;
+    record_push(r, i);
+    push_attachments(as, r, inst->attachments, inst->attachments_size);
+    emit_record(w, 11, r);  // ATTACHMENT
+  }
+  end_block(w);
+}
+
+// 相対idで書く。前方参照なら型も一緒に書く
+static void push_relative(Record* r, uint64_t inst_id, const Operand* op, bool with_type) {
+  record_push(r, (uint32_t)(inst_id - op->id));
+  if( with_type && op->id >= inst_id ) record_push(r, (uint64_t)op->type);
+}
+
+static void write_function(Assembler* as, BitWriter* w, Record* r, Function* f, uint64_t base) {
+  enter_block(w, BLOCK_FUNCTION, 4);
+  record_push(r, f->blocks);
+  emit_record(w, 1, r);  // DECLAREBLOCKS
+
+  uint64_t inst_id = resolve_function(as, f, base, w, r);
+
+  for( size_t i = 0; i < f->insts_size; ++i ) {
+    Inst* inst = &f->insts[i];
+    Operand* ops = inst->ops;
+    switch( inst->kind ) {
+      case IN_BINOP:
+        push_relative(r, inst_id, &ops[0], true);
+        push_relative(r, inst_id, &ops[1], false);
+        record_push(r, (uint64_t)inst->code);
+        if( inst->aux ) record_push(r, (uint64_t)inst->aux);
+        emit_record(w, 2, r);
+        break;
+      case IN_CAST:
+        push_relative(r, inst_id, &ops[0], true);
+        record_push(r, (uint64_t)inst->aux);
+        record_push(r, (uint64_t)inst->code);
+        emit_record(w, 3, r);
+        break;
+      case IN_CMP:
+        push_relative(r, inst_id, &ops[0], true);
+        push_relative(r, inst_id, &ops[1], false);
+        record_push(r, (uint64_t)inst->code);
+        emit_record(w, 28, r);
+        break;
+      case IN_SELECT:
+        push_relative(r, inst_id, &ops[0], true);
+        push_relative(r, inst_id, &ops[1], false);
+        push_relative(r, inst_id, &ops[2], true);
+        emit_record(w, 29, r);
+        break;
+      case IN_PHI:
+        record_push(r, (uint64_t)inst->type);
+        for( size_t j = 0; j < inst->ops_size; j += 2 ) {
+          record_push(r, signed_vbr((int64_t)inst_id - (int64_t)ops[j].id));
+          record_push(r, ops[j + 1].id);
+        }
+        emit_record(w, 16, r);
+        break;
+      case IN_BR:
+        if( inst->ops_size == 1 ) {
+          record_push(r, ops[0].id);
+        } else {
+          record_push(r, ops[1].id);
+          record_push(r, ops[2].id);
+          push_relative(r, inst_id, &ops[0], false);
+        }
+        emit_record(w, 11, r);
+        break;
+      case IN_SWITCH:
+        // 条件は相対id、caseの値は定数の絶対id
+        record_push(r, (uint64_t)ops[0].type);
+        push_relative(r, inst_id, &ops[0], false);
+        record_push(r, ops[1].id);
+        for( size_t j = 2; j < inst->ops_size; ++j ) record_push(r, ops[j].id);
+        emit_record(w, 12, r);
+        break;
+      case IN_RET:
+        if( inst->ops_size ) push_relative(r, inst_id, &ops[0], true);
+        emit_record(w, 10, r);
+        break;
+      case IN_UNREACHABLE:
+        emit_record(w, 15, r);
+        break;
+      case IN_ALLOCA:
+        record_push(r, (uint64_t)inst->aux);
+        record_push(r, (uint64_t)ops[0].type);
+        record_push(r, ops[0].id);
+        record_push(r, encode_align(inst->align) | (1u << 6));
+        emit_record(w, 19, r);
+        break;
+      case IN_LOAD:
+        push_relative(r, inst_id, &ops[0], true);
+        record_push(r, (uint64_t)inst->aux);
+        record_push(r, encode_align(inst->align));
+        record_push(r, 0);
+        emit_record(w, 20, r);
+        break;
+      case IN_STORE:
+        push_relative(r, inst_id, &ops[0], true);
+        push_relative(r, inst_id, &ops[1], true);
+        record_push(r, encode_align(inst->align));
+        record_push(r, 0);
+        emit_record(w, 44, r);
+        break;
+      case IN_GEP:
+        record_push(r, (uint64_t)inst->code);
+        record_push(r, (uint64_t)inst->aux);
+        for( size_t j = 0; j < inst->ops_size; ++j ) push_relative(r, inst_id, &ops[j], true);
+        emit_record(w, 43, r);
+        break;
+      case IN_CALL: {
+        const Type* fn = &as->types[inst->aux];
+        record_push(r, 0);          // paramattrs
+        record_push(r, 1u << 15);   // explicit type
+        record_push(r, (uint64_t)inst->aux);
+        push_relative(r, inst_id, &ops[0], true);
+        for( size_t j = 1; j < inst->ops_size; ++j )
+          push_relative(r, inst_id, &ops[j], j - 1 >= fn->members_size);
+        emit_record(w, 34, r);
+      }
+      break;
+    }
+    if( inst->has_result ) ++inst_id;
+  }
+  write_attachments(as, w, r, f);
+  end_block(w);
+}
+
+static void write_module(Assembler* as, BitWriter* w) {
+  Record r = { NULL, 0, 0 };
+
+  // 'BC' 0xC0DE
+  emit(w, 'B', 8);
+  emit(w, 'C', 8);
+  emit(w, 0x0, 4);
+  emit(w, 0xC, 4);
+  emit(w, 0xE, 4);
+  emit(w, 0xD, 4);
+
+  enter_block(w, BLOCK_IDENTIFICATION, 5);
+  const char* producer = "LLVM14.0.0";
+  for( const char* p = producer; *p; ++p ) record_push(&r, (unsigned char)*p);
+  emit_record(w, 1, &r);  // STRING
+  record_push(&r, 0);
+  emit_record(w, 2, &r);  // EPOCH
+  end_block(w);
+
+  // STRTABは最後に書くので、先に名前の位置を決めておく
+  size_t strtab_size = 0;
+  for( size_t i = 0; i < as->globals_size; ++i ) strtab_size += as->globals[i].len;
+  for( size_t i = 0; i < as->funcs_size; ++i ) strtab_size += as->funcs[i].len;
+
+  enter_block(w, BLOCK_MODULE, 3);
+  record_push(&r, 2);
+  emit_record(w, 1, &r);  // VERSION
+
+  // nounwindの関数が使う属性の組。関数の属性はindex 0xFFFFFFFFに置く
+  bool nounwind = false;
+  for( size_t i = 0; i < as->funcs_size; ++i ) nounwind = nounwind || as->funcs[i].nounwind;
+  if( nounwind ) {
+    enter_block(w, BLOCK_PARAMATTR_GROUP, 3);
+    record_push(&r, 1);           // group id
+    record_push(&r, 0xFFFFFFFF);  // 関数自身
+    record_push(&r, 0);           // enumの属性
+    record_push(&r, 18);          // nounwind
+    emit_record(w, 3, &r);  // GRP_CODE_ENTRY
+    end_block(w);
+    enter_block(w, BLOCK_PARAMATTR, 3);
+    record_push(&r, 1);
+    emit_record(w, 2, &r);  // ENTRY
+    end_block(w);
+  }
+
+  write_types(as, w, &r);
+
+  const uint64_t module_values = as->globals_size + as->funcs_size;
+  uint64_t values = module_values;
+  for( size_t i = 0; i < as->globals_size; ++i ) {
+    if( as->globals[i].init ) number_initializer(as, as->globals[i].init, &values);
+  }
+  number_metadata(as, &values);
+
+  uint64_t offset = 0;
+  for( size_t i = 0; i < as->globals_size; ++i ) {
+    const Global* g = &as->globals[i];
+    record_push(&r, offset);
+    record_push(&r, g->len);
+    record_push(&r, (uint64_t)g->type);
+    record_push(&r, (g->constant ? 1 : 0) | 2);
+    record_push(&r, g->init ? g->init->id + 1 : 0);
+    record_push(&r, g->linkage);
+    record_push(&r, encode_align(g->align));
+    record_push(&r, 0);
+    record_push(&r, 0);
+    record_push(&r, 0);
+    record_push(&r, g->unnamed_addr);
+    emit_record(w, 7, &r);  // GLOBALVAR
+    offset += g->len;
+  }
+
+  for( size_t i = 0; i < as->funcs_size; ++i ) {
+    const Function* f = &as->funcs[i];
+    record_push(&r, offset);
+    record_push(&r, f->len);
+    record_push(&r, (uint64_t)f->type);
+    record_push(&r, 0);  // callingconv
+    record_push(&r, f->defined ? 0 : 1);  // isproto
+    record_push(&r, f->linkage);
+    record_push(&r, f->nounwind ? 1 : 0);  // paramattr。属性のリストの番号 + 1
+    record_push(&r, 0);  // alignment
+    record_push(&r, 0);  // section
+    record_push(&r, 0);  // visibility
+    emit_record(w, 8, &r);  // FUNCTION
+    offset += f->len;
+  }
+
+  if( values != module_values ) {
+    enter_block(w, BLOCK_CONSTANTS, 4);
+    int current_type = -1;
+    for( size_t i = 0; i < as->globals_size; ++i ) {
+      if( as->globals[i].init ) write_initializer(w, &r, &current_type, as->globals[i].init);
+    }
+    for( size_t i = 0; i < as->mds_size; ++i ) {
+      if( as->mds[i].kind == MD_VALUE ) write_constant(w, &r, &current_type, CK_INT, as->mds[i].type, as->mds[i].value);
+    }
+    end_block(w);
+  }
+  write_metadata(as, w, &r);
+
+  for( size_t i = 0; i < as->funcs_size; ++i ) {
+    if( as->funcs[i].defined ) write_function(as, w, &r, &as->funcs[i], values);
+  }
+  end_block(w);
+
+  // STRTAB: blobを書くためだけにabbreviationを1つ定義する
+  enter_block(w, BLOCK_STRTAB, 3);
+  emit(w, ABBREV_DEFINE, w->width);
+  emit_vbr(w, 2, 5);
+  emit(w, 1, 1);      // literal
+  emit_vbr(w, 1, 8);  // STRTAB_BLOB
+  emit(w, 0, 1);
+  emit(w, 5, 3);      // blob
+  emit(w, 4, w->width);
+  emit_vbr(w, strtab_size, 6);
+  align32(w);
+  for( size_t i = 0; i < as->globals_size; ++i )
+    for( size_t j = 0; j < as->globals[i].len; ++j ) emit(w, (unsigned char)as->globals[i].name[j], 8);
+  for( size_t i = 0; i < as->funcs_size; ++i )
+    for( size_t j = 0; j < as->funcs[i].len; ++j ) emit(w, (unsigned char)as->funcs[i].name[j], 8);
+  align32(w);
+  end_block(w);
+
+  align32(w);
+  free(r.data);
+}
+
+bool write_bitcode(Arena* arena, const char* ir, size_t len, Buffer* output, Error* error) {
+  Assembler as;
+  memset(&as, 0, sizeof(Assembler));
+  as.src = ir;
+  as.len = len;
+  as.arena = arena;
+  as.error = error;
+
+  BitWriter w;
+  memset(&w, 0, sizeof(BitWriter));
+  w.width = 2;
+
+  if( setjmp(as.fail) ) {
+    free(w.words);
+    return false;
+  }
+
+  parse_module(&as);
+  write_module(&as, &w);
+
+  // bitstreamはlittle endianの32bit word列
+  reserve_buffer(output, output->size + w.size * 4);
+  for( size_t i = 0; i < w.size; ++i ) {
+    const uint32_t word = w.words[i];
+    const char bytes[4] = { word & 0xff, (word >> 8) & 0xff, (word >> 16) & 0xff, word >> 24 };
+    append_buffer(output, bytes, 4);
+  }
+  free(w.words);
+  return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "util.h"
+
+// テキストのLLVM-IRをLLVM bitcodeに変換してoutputに追記する。
+// 読めるのはcodegenが出力する範囲のIRだけ。
+// 作業用のメモリはarenaから取る。失敗したらerrorに理由を入れてfalseを返す。
+bool write_bitcode(Arena* arena, const char* ir, size_t len, Buffer* output, Error* error);
@@ -1,15 +1,43 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "codegen.h"
+#include "effect.h"
 #include "parser.h"
 
-CodeGen* create_codegen(FILE* fp, bool debug) {
-  CodeGen* g = (CodeGen*)malloc(sizeof(CodeGen));
-  g->output = fp;
+CodeGen* create_codegen(Arena* arena, Buffer* output, Error* error, bool debug) {
+  CodeGen* g = (CodeGen*)arena_alloc(arena, sizeof(CodeGen));
+  g->arena = arena;
+  g->block_label = 0;
+  g->metadata = g->metadata_tail = NULL;
+  g->metadata_index = 0;
+  g->instrument = NULL;
+  g->funcs = g->funcs_tail = NULL;
+  g->funcs_size = 0;
+  g->profile = NULL;
+  g->func_profile = NULL;
+  g->profiler = false;
+  g->stacks = NULL;
+  g->memoize = false;
+  g->memo_args = 0;
+  g->parloops = g->parloops_tail = NULL;
+  g->parloops_size = 0;
+  g->par_env = 0;
+  g->select_cost = SELECT_DEFAULT_COST;
+  g->output = output;
+  g->error = error;
   g->index = 0;
   g->label_index = 0;
+  g->locals_size = 0;
+  g->locals_pos = 0;
+  g->gens = NULL;
+  g->gen_site = NULL;
+  g->scope = 0;
+  g->gen_scopes = 0;
+  g->counting = true;
   g->debug = debug;
   return g;
 }
@@ -19,25 +47,66 @@ static void comment(CodeGen* g, const char* format, ...) {
 
   va_list va;
   va_start(va, format);
-  vfprintf(g->output, format, va);
+  buffer_vprintf(g->output, format, va);
   va_end(va);
 }
 
 static void gen(CodeGen* g, const char* format, ...) {
   va_list va;
   va_start(va, format);
-  vfprintf(g->output, format, va);
+  buffer_vprintf(g->output, format, va);
   va_end(va);
 }
 
-static size_t gen_alloca(CodeGen* g) {
-  const size_t mem = ++(g->index);
-  gen(g, "  %%%zu = alloca i32, align 4\n", mem);
-  return mem;
+// ラベルを出して、以降の命令がどのblockに入るかを覚えておく
+static void gen_label(CodeGen* g, size_t label) {
+  gen(g, "label.%zu:\n", label);
+  g->block_label = label;
+}
+
+static size_t gen_immediate(CodeGen* g, long long imm) {
+  const size_t reg = ++(g->index);
+  gen(g, "  %%%zu = add i32 0, %lld\n", reg, imm);
+  return reg;
+}
+
+// 変数のallocaの名前。展開したgenの変数は、呼び出し側の同じ名前の変数とぶつからないように番号を付ける
+static void gen_var(CodeGen* g, Token* token) {
+  if( g->scope ) gen(g, "%%gen.%zu.%.*s", g->scope, token->len, token->buffer + token->pos);
+  else gen(g, "%%%.*s", token->len, token->buffer + token->pos);
+}
+
+// startから後ろに出したallocaをentry blockに移す。関数の途中でgenを展開したときもallocaは先頭に置く
+static void move_to_entry(CodeGen* g, size_t start) {
+  move_buffer_tail(g->output, g->locals_pos, start);
+  g->locals_pos += g->output->size - start;
 }
 
 static void gen_named_alloca(CodeGen* g, Token* token) {
-  gen(g, "  %%%.*s = alloca i32, align 4\n", token->len, token->buffer + token->pos);
+  // 同じ名前のallocaを二回出すと不正なIRになるので、関数内で一度だけ出す
+  for( size_t i = 0; i < g->locals_size; ++i ) {
+    if( g->local_scopes[i] == g->scope && token_equals(g->locals[i], token) ) return;
+  }
+  if( g->locals_size >= MAX_LOCALS ) {
+    set_error(g->error, token->pos, "Too many local variables (max %d).", MAX_LOCALS);
+    return;
+  }
+  g->locals[g->locals_size] = token;
+  g->local_scopes[g->locals_size++] = g->scope;
+  const size_t start = g->output->size;
+  gen(g, "  ");
+  gen_var(g, token);
+  gen(g, " = alloca i32, align 4\n");
+  move_to_entry(g, start);
+}
+
+// letで宣言される変数のallocaを関数の先頭(entry block)にまとめて出す。
+// loopの中でallocaするとループが回るたびにスタックが伸びてしまうため。
+static void gen_locals(CodeGen* g, AST* ast) {
+  if( ast == NULL ) return;
+  if( ast->type == ST_LET || ast->type == ST_FOR || ast->type == ST_PARFOR || ast->type == ST_FOREACH ) gen_named_alloca(g, get_lhs(ast)->token);
+  for( AST** child = ast->children; *child; ++child )
+    gen_locals(g, *child);
 }
 
 static size_t gen_zext(CodeGen* g, const char* from, const char* to, size_t before) {
@@ -50,10 +119,6 @@ static void gen_store(CodeGen* g, size_t reg, size_t mem) {
   gen(g, "  store i32 %%%zu, i32* %%%zu, align 4\n", reg, mem);
 }
 
-static void gen_store_immediate(CodeGen* g, long long imm, size_t mem) {
-  gen(g, "  store i32 %ld, i32* %%%zu\n", imm, mem);
-}
-
 static size_t gen_load(CodeGen* g, size_t src) {
   const size_t dst = ++(g->index);
   gen(g, "  %%%zu = load i32, i32* %%%zu, align 4\n", dst, src);
@@ -62,7 +127,9 @@ static size_t gen_load(CodeGen* g, size_t src) {
 
 static size_t gen_named_load(CodeGen* g, Token* token) {
   const size_t dst = ++(g->index);
-  gen(g, "  %%%zu = load i32, i32* %%%.*s, align 4\n", dst, token->len, token->buffer + token->pos);
+  gen(g, "  %%%zu = load i32, i32* ", dst);
+  gen_var(g, token);
+  gen(g, ", align 4\n");
   return dst;
 }
 
@@ -97,11 +164,17 @@ static size_t gen_cmp(CodeGen* g, const char* cmp, size_t lhs, size_t rhs) {
 }
 
 static void gen_named_store(CodeGen* g, Token* lvar, size_t reg) {
-  gen(g, "  store i32 %%%zu, i32* %%%.*s, align 4\n", reg, lvar->len, lvar->buffer + lvar->pos);
+  gen(g, "  store i32 %%%zu, i32* ", reg);
+  gen_var(g, lvar);
+  gen(g, ", align 4\n");
 }
 
+static void gen_func_symbol(CodeGen* g, Token* ident);
+
 static size_t gen_func_define_name(CodeGen* g, Token* name) {
-  gen(g, "define i32 @%.*s(", name->len, name->buffer + name->pos);
+  gen(g, "define i32 ");
+  gen_func_symbol(g, name);
+  gen(g, "(");
   return g->index;
 }
 
@@ -122,32 +195,620 @@ static size_t gen_func_start_arg(CodeGen* g, size_t arg_reg, Token* name) {
   return g->index;
 }
 
-static size_t gen_func_end(CodeGen* g, size_t result_reg) {
-  comment(g, "  ; ------------- Returning result\n");
+// freqから呼べる組み込み関数。同じ名前の関数は定義できない
+typedef struct {
+  const char* name;
+  const char* symbol;
+} Builtin;
+
+static const Builtin builtins[] = {
+  { "print", "print" },
+  { "read", "freq.read" },
+  { "eof", "freq.eof" },
+};
+
+static const Builtin* find_builtin(Token* ident) {
+  for( size_t i = 0; i < (sizeof(builtins) / sizeof(Builtin)); ++i ) {
+    const Builtin* b = &builtins[ i ];
+    if( strlen(b->name) == ident->len && strncmp(b->name, ident->buffer + ident->pos, ident->len) == 0 ) return b;
+  }
+  return NULL;
+}
+
+// 関数のIR上の名前。ランタイムが宣言するlibcの関数(write, readなど)とぶつからないように、
+// mainと組み込み関数以外には@fq.を付ける
+static void gen_func_symbol(CodeGen* g, Token* ident) {
+  const Builtin* b = find_builtin(ident);
+  if( b ) gen(g, "@%s", b->symbol);
+  else if( ident->len == 4 && strncmp(ident->buffer + ident->pos, "main", 4) == 0 ) gen(g, "@main");
+  else gen(g, "@fq.%.*s", ident->len, ident->buffer + ident->pos);
+}
+
+static size_t gen_call(CodeGen* g, Token* ident, size_t* arg_regs, size_t size) {
+  const size_t reg = ++(g->index);
+  gen(g, "  %%%zu = call i32 ", reg);
+  gen_func_symbol(g, ident);
+  gen(g, "(");
+  for( size_t i = 0; i < size; ++i ) {
+    if( i != 0 ) gen(g, ", ");
+    gen(g, "i32 %%%zu", arg_regs[ i ]);
+  }
+  gen(g, ")\n");
+  return reg;
+}
+
+
+// metadataの番号を確保する。中身は最後にまとめて出す
+static size_t add_metadata(CodeGen* g, MetadataType type, uint64_t a, uint64_t b) {
+  MetadataNode* md = (MetadataNode*)arena_alloc(g->arena, sizeof(MetadataNode));
+  md->type = type;
+  md->id = g->metadata_index++;
+  md->a = a;
+  md->b = b;
+  md->next = NULL;
+  if( g->metadata_tail ) g->metadata_tail->next = md;
+  else g->metadata = md;
+  g->metadata_tail = md;
+  // !llvm.loopは自分自身 + mustprogress + ヒントの分だけ番号を使う
+  if( type == MD_LOOP ) g->metadata_index += 1 + (a ? 1 : 0) + (b ? 2 : 0);
+  return md->id;
+}
+
+// forのlatchに付ける!llvm.loop
+static size_t gen_loop_metadata(CodeGen* g, AST* ast) {
+  long unroll = 0;
+  long vectorize = 0;
+  for( AST** hint = ast->children + 4; *hint; ++hint ) {
+    if( (*hint)->type == ST_UNROLL ) unroll = (*hint)->val;
+    if( (*hint)->type == ST_VECTORIZE ) vectorize = (*hint)->val;
+  }
+  return add_metadata(g, MD_LOOP, (uint64_t)unroll, (uint64_t)vectorize);
+}
+
+static void generate_metadata(CodeGen* g) {
+  for( MetadataNode* md = g->metadata; md; md = md->next ) {
+    size_t id = md->id;
+    switch( md->type ) {
+      case MD_LOOP:
+        gen(g, "!%zu = distinct !{!%zu, !%zu", id, id, id + 1);
+        for( size_t i = id + 2; i < id + 2 + (md->a ? 1 : 0) + (md->b ? 2 : 0); ++i )
+          gen(g, ", !%zu", i);
+        gen(g, "}\n");
+        gen(g, "!%zu = !{!\"llvm.loop.mustprogress\"}\n", ++id);
+        if( md->a ) {
+          gen(g, "!%zu = !{!\"llvm.loop.unroll.count\", i32 %llu}\n", ++id, (unsigned long long)md->a);
+        }
+        if( md->b ) {
+          gen(g, "!%zu = !{!\"llvm.loop.vectorize.width\", i32 %llu}\n", ++id, (unsigned long long)md->b);
+          gen(g, "!%zu = !{!\"llvm.loop.vectorize.enable\", i1 true}\n", ++id);
+        }
+        break;
+      case MD_BRANCH_WEIGHTS:
+        gen(g, "!%zu = !{!\"branch_weights\", i32 %llu, i32 %llu}\n", id, (unsigned long long)md->a, (unsigned long long)md->b);
+        break;
+      case MD_ENTRY_COUNT:
+        gen(g, "!%zu = !{!\"function_entry_count\", i64 %llu}\n", id, (unsigned long long)md->a);
+        break;
+    }
+  }
+}
+
+// ------------------------------------------------------------------ PGO
+
+// 関数の中のif/loop/forに前順で分岐の番号を振ってvalに入れる。
+// 計装するときと重みを付けるときで同じ番号になるように、コードを出す前に済ませておく
+static void number_branches(AST* ast, size_t* size) {
+  if( ast == NULL ) return;
+  if( ast->type == ST_IF || ast->type == ST_LOOP || ast->type == ST_FOR ) ast->val = (long)(*size)++;
+  for( AST** child = ast->children; *child; ++child )
+    number_branches(*child, size);
+}
+
+// カウンタは関数ごとの配列で、0番目が呼ばれた回数、1 + 2 * 分岐番号 (+ 1) が分岐のtrue(false)
+static void gen_count(CodeGen* g, size_t counter) {
+  if( !g->instrument || !g->counting ) return;
+  Token* name = g->func_name;
+  const size_t ptr = ++(g->index);
+  gen(g, "  %%%zu = getelementptr inbounds [%zu x i64], [%zu x i64]* @freq.prof.%.*s, i64 0, i64 %zu\n",
+    ptr, g->counters, g->counters, (int)name->len, name->buffer + name->pos, counter);
+  gen(g, "  %%%zu = load i64, i64* %%%zu, align 8\n", ++(g->index), ptr);
+  gen(g, "  %%%zu = add i64 %%%zu, 1\n", g->index + 1, g->index);
+  ++(g->index);
+  gen(g, "  store i64 %%%zu, i64* %%%zu, align 8\n", g->index, ptr);
+}
+
+static size_t true_counter(AST* branch) {
+  return 1 + 2 * (size_t)branch->val;
+}
+
+static size_t false_counter(AST* branch) {
+  return 2 + 2 * (size_t)branch->val;
+}
+
+// プロファイルにその分岐の回数があれば取り出す
+static bool branch_counts(CodeGen* g, AST* branch, uint64_t* when_true, uint64_t* when_false) {
+  FuncProfile* f = g->func_profile;
+  // 展開したgenの本体の分岐には番号が無い
+  if( f == NULL || !g->counting ) return false;
+  *when_true = f->counts[true_counter(branch)];
+  *when_false = f->counts[false_counter(branch)];
+  return true;
+}
+
+// 条件分岐の命令の後ろに付ける ", !prof !N"。プロファイルが無ければ何も付けない
+static void gen_branch_weights(CodeGen* g, AST* branch) {
+  uint64_t t, f;
+  if( !branch_counts(g, branch, &t, &f) ) return;
+  // 重みはi32なので、大きすぎれば比を保って縮める
+  while( t > UINT32_MAX || f > UINT32_MAX ) {
+    t >>= 1;
+    f >>= 1;
+  }
+  gen(g, ", !prof !%zu", add_metadata(g, MD_BRANCH_WEIGHTS, t, f));
+}
+
+// ------------------------------------------------------------------ プロファイラ
+
+// 関数に入ったらcalling context tree(CCT)の子に降りて、呼び出し元のノードを%cyc.callerに覚えておく
+static void gen_profiler_enter(CodeGen* g) {
+  if( !g->profiler ) return;
+  gen(g, "  %%cyc.caller = call i32 @freq.cyc.enter(i32 %zu)\n", g->funcs_tail->id);
+}
+
+// retの直前に呼んで、呼び出し元のノードに戻る
+static void gen_profiler_leave(CodeGen* g) {
+  if( !g->profiler ) return;
+  gen(g, "  call void @freq.cyc.leave(i32 %zu, i32 %%cyc.caller)\n", g->funcs_tail->id);
+}
+
+// ------------------------------------------------------------------ メモ化
+
+// メモの表のエントリ数(2の冪)と、1回の検索で見るスロットの数
+#define MEMO_SIZE (4096)
+#define MEMO_PROBES (4)
+// これより引数の多い関数はメモ化しない
+#define MEMO_MAX_ARGS (4)
+
+// エントリは [使用中, 引数..., 結果] のi32の並び
+static size_t memo_width(CodeGen* g) {
+  return g->memo_args + 2;
+}
+
+// エントリのfield番目を指すポインタをregに入れる
+static void gen_memo_field(CodeGen* g, const char* reg, const char* slot, size_t field) {
+  Token* name = g->func_name;
+  const size_t width = memo_width(g);
+  gen(g, "  %%%s = getelementptr inbounds [%d x [%zu x i32]], [%d x [%zu x i32]]* @freq.memo.%.*s, i64 0, i64 %%%s, i64 %zu\n",
+    reg, MEMO_SIZE, width, MEMO_SIZE, width, (int)name->len, name->buffer + name->pos, slot, field);
+}
+
+// 関数の入口で引数をキーに表を引き、見つかればその結果を返す。
+// 見つからなければ、戻るときに結果を書くスロットを%memo.slotに決めて本体に進む。
+// 表から消すことはないので、空きスロットに当たればそれより先には無い。
+// 見たスロットがすべて他の引数で埋まっていれば、ハッシュの上位ビットで選んだ1つを追い出す
+static void gen_memo_lookup(CodeGen* g) {
+  if( !g->memo_args ) return;
+  const size_t args = g->memo_args;
+
+  gen(g, "  br label %%memo.lookup\n");
+  gen(g, "memo.lookup:\n");
+  // FNV-1aを引数ごとに回して、最後に上位ビットを混ぜる
+  gen(g, "  %%memo.h0 = add i32 0, -2128831035\n");
+  for( size_t i = 0; i < args; ++i ) {
+    gen(g, "  %%memo.x%zu = xor i32 %%memo.h%zu, %%%zu\n", i, i, i);
+    gen(g, "  %%memo.h%zu = mul i32 %%memo.x%zu, 16777619\n", i + 1, i);
+  }
+  gen(g, "  %%memo.high = lshr i32 %%memo.h%zu, 15\n", args);
+  gen(g, "  %%memo.hash = xor i32 %%memo.h%zu, %%memo.high\n", args);
+  gen(g, "  %%memo.way = lshr i32 %%memo.hash, %d\n", 32 - 2);
+  gen(g, "  %%memo.evict.offset = add i32 %%memo.hash, %%memo.way\n");
+  gen(g, "  %%memo.evict = and i32 %%memo.evict.offset, %d\n", MEMO_SIZE - 1);
+  gen(g, "  br label %%memo.probe.0\n");
+
+  for( size_t p = 0; p < MEMO_PROBES; ++p ) {
+    gen(g, "memo.probe.%zu:\n", p);
+    gen(g, "  %%memo.offset.%zu = add i32 %%memo.hash, %zu\n", p, p);
+    gen(g, "  %%memo.index.%zu = and i32 %%memo.offset.%zu, %d\n", p, p, MEMO_SIZE - 1);
+    gen(g, "  %%memo.slot.%zu = zext i32 %%memo.index.%zu to i64\n", p, p);
+    char reg[64], slot[64];
+    snprintf(slot, sizeof(slot), "memo.slot.%zu", p);
+    snprintf(reg, sizeof(reg), "memo.used.ptr.%zu", p);
+    gen_memo_field(g, reg, slot, 0);
+    gen(g, "  %%memo.used.%zu = load i32, i32* %%%s, align 4\n", p, reg);
+    gen(g, "  %%memo.empty.%zu = icmp eq i32 %%memo.used.%zu, 0\n", p, p);
+    gen(g, "  br i1 %%memo.empty.%zu, label %%memo.miss, label %%memo.compare.%zu\n", p, p);
+    gen(g, "memo.compare.%zu:\n", p);
+    gen(g, "  %%memo.same.%zu.0 = add i1 0, 1\n", p);
+    for( size_t i = 0; i < args; ++i ) {
+      snprintf(reg, sizeof(reg), "memo.key.ptr.%zu.%zu", p, i);
+      gen_memo_field(g, reg, slot, i + 1);
+      gen(g, "  %%memo.key.%zu.%zu = load i32, i32* %%%s, align 4\n", p, i, reg);
+      gen(g, "  %%memo.eq.%zu.%zu = icmp eq i32 %%memo.key.%zu.%zu, %%%zu\n", p, i, p, i, i);
+      gen(g, "  %%memo.same.%zu.%zu = and i1 %%memo.same.%zu.%zu, %%memo.eq.%zu.%zu\n", p, i + 1, p, i, p, i);
+    }
+    gen(g, "  br i1 %%memo.same.%zu.%zu, label %%memo.hit.%zu, label %%memo.probe.%zu\n", p, args, p, p + 1);
+    gen(g, "memo.hit.%zu:\n", p);
+    snprintf(reg, sizeof(reg), "memo.result.ptr.%zu", p);
+    gen_memo_field(g, reg, slot, args + 1);
+    gen(g, "  %%memo.result.%zu = load i32, i32* %%%s, align 4\n", p, reg);
+    gen_profiler_leave(g);
+    gen(g, "  ret i32 %%memo.result.%zu\n", p);
+  }
+  gen(g, "memo.probe.%d:\n", MEMO_PROBES);
+  gen(g, "  br label %%memo.miss\n");
+  gen(g, "memo.miss:\n");
+  gen(g, "  %%memo.victim = phi i32 ");
+  for( size_t p = 0; p < MEMO_PROBES; ++p ) {
+    gen(g, "[ %%memo.index.%zu, %%memo.probe.%zu ], ", p, p);
+  }
+  gen(g, "[ %%memo.evict, %%memo.probe.%d ]\n", MEMO_PROBES);
+  gen(g, "  %%memo.slot = zext i32 %%memo.victim to i64\n");
+}
+
+// 戻る前に引数と結果を表に書く
+static void gen_memo_store(CodeGen* g, size_t result_reg) {
+  if( !g->memo_args ) return;
+  // retは何箇所にもあるので、ポインタには番号付きのレジスタを使う
+  char reg[32];
+  for( size_t i = 0; i < g->memo_args; ++i ) {
+    snprintf(reg, sizeof(reg), "%zu", ++(g->index));
+    gen_memo_field(g, reg, "memo.slot", i + 1);
+    gen(g, "  store i32 %%%zu, i32* %%%s, align 4\n", i, reg);
+  }
+  snprintf(reg, sizeof(reg), "%zu", ++(g->index));
+  gen_memo_field(g, reg, "memo.slot", g->memo_args + 1);
+  gen(g, "  store i32 %%%zu, i32* %%%s, align 4\n", result_reg, reg);
+  snprintf(reg, sizeof(reg), "%zu", ++(g->index));
+  gen_memo_field(g, reg, "memo.slot", 0);
+  gen(g, "  store i32 1, i32* %%%s, align 4\n", reg);
+}
+
+// ------------------------------------------------------------------ 並列ループ
+
+// ワーカーの数の上限と、ワーカーごとのdequeに積める範囲の数
+#define PAR_MAX_WORKERS (64)
+#define PAR_DEQUE_SIZE (64)
+// 1ワーカーあたりこのくらいの数の塊に分かれるまで範囲を半分にしていく
+#define PAR_CHUNKS_PER_WORKER (8)
+// pthread_mutex_tとpthread_cond_tを置く領域。glibcではどちらも0埋めが静的な初期値
+#define PAR_SYNC_SIZE (64)
+
+// parforの本体が読む外の変数を、出てきた順に重複なくcapturesに足す。ループ変数は各回のものなので除く
+static size_t collect_captures(AST* ast, Token* var, Token** captures, size_t size) {
+  if( ast == NULL ) return size;
+  if( ast->type == ST_VAR && !token_equals(ast->token, var) ) {
+    bool found = false;
+    for( size_t i = 0; i < size && !found; ++i ) found = token_equals(captures[i], ast->token);
+    if( !found && size < MAX_LOCALS ) captures[size++] = ast->token;
+  }
+  for( AST** child = ast->children; *child; ++child )
+    size = collect_captures(*child, var, captures, size);
+  return size;
+}
+
+// 名前でgenを探す。同名のものは先に書かれた方を使う
+static AST* find_gen(CodeGen* g, Token* name) {
+  for( GenFunc* entry = g->gens; entry; entry = entry->next ) {
+    if( token_equals(entry->ast->token, name) ) return entry->ast;
+  }
+  return NULL;
+}
+
+// genがforの中で(間接的にも)自分自身を回しているか。展開が終わらなくなる
+static bool expanding(GenSite* site, AST* gen) {
+  for( ; site; site = site->outer ) {
+    if( site->gen == gen ) return true;
+  }
+  return false;
+}
+
+// 関数の中のparforが受け取る変数の数の最大。forで回すgenの本体にあるparforも、展開した先の関数で実行する
+static size_t count_par_env(CodeGen* g, AST* ast, GenSite* site) {
+  if( ast == NULL ) return 0;
+  size_t size = 0;
+  if( ast->type == ST_PARFOR ) {
+    Token* captures[MAX_LOCALS];
+    size = collect_captures(ast->children[3], get_lhs(ast)->token, captures, 0);
+  }
+  if( ast->type == ST_FOREACH ) {
+    AST* func = find_gen(g, ast->children[1]->token);
+    if( func && !expanding(site, func) ) {
+      GenSite inner = { .gen = func, .outer = site };
+      size = count_par_env(g, get_rhs(func), &inner);
+    }
+  }
+  for( AST** child = ast->children; *child; ++child ) {
+    const size_t inner = count_par_env(g, *child, site);
+    if( inner > size ) size = inner;
+  }
+  return size;
+}
+
+// 切り出した本体の関数名
+static void gen_parloop_symbol(CodeGen* g, ParLoop* loop) {
+  gen(g, "@freq.par.%.*s.%zu", (int)g->func_name->len, g->func_name->buffer + g->func_name->pos, loop->id);
+}
+
+// parforを実行する。本体が読む変数の今の値を%par.envに詰めて、本体を切り出した関数をランタイムに渡す
+static size_t gen_parfor(CodeGen* g, AST* ast, size_t from_reg, size_t to_reg) {
+  ParLoop* loop = (ParLoop*)arena_alloc(g->arena, sizeof(ParLoop));
+  loop->ast = ast;
+  loop->id = g->parloops_size++;
+  loop->counting = g->counting;
+  loop->next = NULL;
+  if( g->parloops_tail ) g->parloops_tail->next = loop;
+  else g->parloops = loop;
+  g->parloops_tail = loop;
+
+  Token* captures[MAX_LOCALS];
+  const size_t size = collect_captures(ast->children[3], get_lhs(ast)->token, captures, 0);
+  for( size_t i = 0; i < size; ++i ) {
+    const size_t value = gen_named_load(g, captures[i]);
+    const size_t ptr = ++(g->index);
+    gen(g, "  %%%zu = getelementptr inbounds [%zu x i32], [%zu x i32]* %%par.env, i64 0, i64 %zu\n", ptr, g->par_env, g->par_env, i);
+    gen_store(g, value, ptr);
+  }
+  size_t env = 0;
+  if( size ) {
+    env = ++(g->index);
+    gen(g, "  %%%zu = bitcast [%zu x i32]* %%par.env to i8*\n", env, g->par_env);
+  }
+  const size_t reg = ++(g->index);
+  gen(g, "  %%%zu = call i32 @freq.par.run(i32 (i8*, i32, i32)* ", reg);
+  gen_parloop_symbol(g, loop);
+  if( size ) gen(g, ", i8* %%%zu", env);
+  else gen(g, ", i8* null");
+  gen(g, ", i32 %%%zu, i32 %%%zu)\n", from_reg, to_reg);
+  return reg;
+}
+
+// 関数から戻る。プロファイラとメモ化の後始末もここでする
+static void gen_return(CodeGen* g, size_t result_reg) {
+  gen_profiler_leave(g);
+  gen_memo_store(g, result_reg);
   gen(g, "  ret i32 %%%zu\n", result_reg);
+}
+
+static void gen_func_end(CodeGen* g, size_t result_reg) {
+  comment(g, "  ; ------------- Returning result\n");
+  gen_return(g, result_reg);
   gen(g, "}\n");
-  return g->index;
 }
 
-static size_t gen_call(CodeGen* g, Token* ident, size_t reg) {
-  gen(g, "  call i32 (i32) @%.*s(i32 %%%zu)\n", ident->len, ident->buffer + ident->pos, reg);
-  return ++(g->index);
+// ------------------------------------------------------------------ select
+
+// 分岐せずに先に計算してはいけない式のコスト。どんな上限より大きい
+#define SELECT_NEVER ((size_t)1 << 20)
+// プロファイルで片方がこれだけ多く通っていれば、分岐はほぼ当たるので分岐のままにする
+#define SELECT_BIAS (64)
+
+static size_t add_cost(size_t lhs, size_t rhs) {
+  return lhs + rhs < SELECT_NEVER ? lhs + rhs : SELECT_NEVER;
 }
 
+// astを条件に関係なく計算するときのコスト(出す命令の数の目安)。
+// 呼び出し、代入、ループや、0除算のようにトラップしうるものはSELECT_NEVER
+static size_t select_cost(AST* ast) {
+  switch( ast->type ) {
+    case ST_NUM:
+    case ST_VAR:
+      return 1;
+    case ST_ADD:
+    case ST_SUB:
+    case ST_MUL:
+    case ST_EQUAL:
+    case ST_NOT_EQUAL:
+    case ST_LT:
+    case ST_LTEQ:
+    case ST_GT:
+    case ST_GTEQ:
+      return add_cost(1, add_cost(select_cost(get_lhs(ast)), select_cost(get_rhs(ast))));
+    case ST_DIV: {
+      // 割る数が0と-1にならない定数のときだけ
+      AST* rhs = get_rhs(ast);
+      if( rhs->type != ST_NUM || rhs->val == 0 || rhs->val == -1 || rhs->val < INT32_MIN || rhs->val > INT32_MAX ) return SELECT_NEVER;
+      return add_cost(2, select_cost(get_lhs(ast)));
+    }
+    case ST_IF:
+      // 入れ子のifは条件も先に計算することになる
+      return add_cost(1, add_cost(select_cost(ast->children[0]),
+        add_cost(select_cost(ast->children[1]), select_cost(ast->children[2]))));
+    case ST_BLOCK: {
+      // 空のblockは0を作る分だけ
+      if( !ast->children[0] ) return 1;
+      size_t cost = 0;
+      for( AST** stmt = ast->children; *stmt; ++stmt ) cost = add_cost(cost, select_cost(*stmt));
+      return cost;
+    }
+    default:
+      return SELECT_NEVER;
+  }
+}
+
+// ifを分岐ではなくselectで出すか。両腕とも安くて副作用が無ければ、両方計算して選ぶ
+static bool use_select(CodeGen* g, AST* ast) {
+  // 計装するときは腕ごとに数えるので分岐が要る
+  if( g->instrument || g->select_cost == 0 ) return false;
+  if( add_cost(select_cost(ast->children[1]), select_cost(ast->children[2])) > g->select_cost ) return false;
+  uint64_t t, f;
+  if( branch_counts(g, ast, &t, &f) && (t > f * SELECT_BIAS || f > t * SELECT_BIAS) ) return false;
+  return true;
+}
+
+// ------------------------------------------------------------------ gen
+
+static size_t gen_block(CodeGen* g, AST* ast);
+
+static size_t count_yields(AST* ast) {
+  if( ast == NULL ) return 0;
+  size_t count = ast->type == ST_YIELD ? 1 : 0;
+  for( AST** child = ast->children; *child; ++child ) count += count_yields(*child);
+  return count;
+}
+
+// for x in gen(args) stmt。genの本体をその場に展開して、yieldのところでxに値を入れてstmtへ飛ぶ。
+// stmtはyieldがいくつあっても1回だけ出し、最後にどのyieldから来たかをswitchで見て戻る。
+// llvm.coroでコルーチンを分割したときの再開の分岐と同じ形だが、状態は展開した先の関数の
+// allocaに置くのでフレームは要らず、作る側と使う側が1つのループになる
+static size_t gen_foreach(CodeGen* g, AST* ast) {
+  AST* call = ast->children[1];
+  Token* name = call->token;
+  AST* func = find_gen(g, name);
+  if( !func ) {
+    set_error(g->error, name->pos, "'%.*s'(%zu文字目)はgenではないのでforで回せません。", (int)name->len, name->buffer + name->pos, name->pos);
+    return gen_immediate(g, 0);
+  }
+  if( expanding(g->gen_site, func) ) {
+    set_error(g->error, name->pos, "genの'%.*s'(%zu文字目)は自分自身を(間接的にも)forで回せません。", (int)name->len, name->buffer + name->pos, name->pos);
+    return gen_immediate(g, 0);
+  }
+  AST** params = get_lhs(func)->children;
+  size_t arity = 0;
+  while( params[arity] ) ++arity;
+  size_t arg_regs[MAX_BLOCK_SIZE];
+  size_t size = 0;
+  for( AST** arg = call->children; *arg; ++arg ) {
+    arg_regs[ size++ ] = gen_block(g, *arg);
+  }
+  if( size != arity ) {
+    set_error(g->error, name->pos, "genの'%.*s'(%zu文字目)の引数は%zu個です。", (int)name->len, name->buffer + name->pos, name->pos, arity);
+    return gen_immediate(g, 0);
+  }
+
+  // 展開するたびに変数の番号を新しくする。yieldで止まっている間は外側のgenの変数も生きているので、
+  // 深さで番号を使い回すと、forの本体で回す別のgenに書き潰される
+  GenSite site = { .gen = func, .loop = ast, .outer = g->gen_site, .scope = g->scope, .id = ++g->gen_scopes,
+    .counting = g->counting, .exit_label = ++g->label_index, .body_label = ++g->label_index };
+  site.shared = count_yields(get_rhs(func)) > 1 || (site.outer && site.outer->shared);
+  g->gen_site = &site;
+  g->scope = site.id;
+  g->counting = false;
+  for( size_t i = 0; i < arity; ++i ) {
+    gen_named_alloca(g, params[i]->token);
+    gen_named_store(g, params[i]->token, arg_regs[i]);
+  }
+  gen_locals(g, get_rhs(func));
+  gen_block(g, get_rhs(func));
+  gen(g, "  br label %%label.%zu\n", site.exit_label);
+
+  g->gen_site = site.outer;
+  g->scope = site.scope;
+  g->counting = site.counting;
+  if( site.resumes_size ) {
+    gen_label(g, site.body_label);
+    if( site.shared ) {
+      gen(g, "  %%%zu = load i32, i32* %%yield.%zu.value, align 4\n", ++(g->index), site.id);
+      gen_named_store(g, get_lhs(ast)->token, g->index);
+    } else {
+      gen_named_store(g, get_lhs(ast)->token, site.value);
+    }
+    gen_block(g, ast->children[2]);
+    if( site.shared ) {
+      gen(g, "  %%%zu = load i32, i32* %%yield.%zu.resume, align 4\n", ++(g->index), site.id);
+      gen(g, "  switch i32 %%%zu, label %%label.%zu [", g->index, site.exit_label);
+      for( size_t i = 0; i < site.resumes_size; ++i ) {
+        gen(g, " i32 %zu, label %%label.%zu", site.resumes[i], site.resumes[i]);
+      }
+      gen(g, " ]\n");
+    } else {
+      gen(g, "  br label %%label.%zu\n", site.resumes[0]);
+    }
+  }
+  gen_label(g, site.exit_label);
+  return gen_immediate(g, 0);
+}
+
+// genの本体のyield。値と再開する先を置いてforの本体へ飛び、戻ってきたところから続きを出す
+static size_t gen_yield(CodeGen* g, AST* ast) {
+  const size_t reg = gen_block(g, get_lhs(ast));
+  GenSite* site = g->gen_site;
+  if( site->shared && !site->resumes_size ) {
+    const size_t start = g->output->size;
+    gen(g, "  %%yield.%zu.value = alloca i32, align 4\n", site->id);
+    gen(g, "  %%yield.%zu.resume = alloca i32, align 4\n", site->id);
+    move_to_entry(g, start);
+  }
+  if( site->resumes_size == site->resumes_capacity ) {
+    site->resumes_capacity = site->resumes_capacity ? site->resumes_capacity * 2 : 4;
+    size_t* resumes = (size_t*)arena_alloc(g->arena, sizeof(size_t) * site->resumes_capacity);
+    if( site->resumes_size ) memcpy(resumes, site->resumes, sizeof(size_t) * site->resumes_size);
+    site->resumes = resumes;
+  }
+  // 再開する先はラベルの番号をそのまま使う
+  const size_t resume = ++g->label_index;
+  site->resumes[ site->resumes_size++ ] = resume;
+  if( !site->shared ) {
+    // forの本体にはこのyieldからしか来ないので、レジスタのまま渡して戻ってきたところでも使える
+    site->value = reg;
+    gen(g, "  br label %%label.%zu\n", site->body_label);
+    gen_label(g, resume);
+    return reg;
+  }
+  gen(g, "  store i32 %%%zu, i32* %%yield.%zu.value, align 4\n", reg, site->id);
+  gen(g, "  store i32 %zu, i32* %%yield.%zu.resume, align 4\n", resume, site->id);
+  gen(g, "  br label %%label.%zu\n", site->body_label);
+  gen_label(g, resume);
+  // 再開したところは他のyieldからも来るので、yieldの前に計算したレジスタは使えない
+  gen(g, "  %%%zu = load i32, i32* %%yield.%zu.value, align 4\n", ++(g->index), site->id);
+  return g->index;
+}
+
+// genの本体にあって本体でyieldするfor。yieldから再開したところはheaderに支配されないことがあるので、
+// 誘導変数と上限をphiではなくallocaに置く
+static size_t gen_yielding_for(CodeGen* g, AST* ast, size_t from_reg, size_t to_reg) {
+  Token* var = get_lhs(ast)->token;
+  const size_t preheader_label = ++g->label_index;
+  const size_t header_label = ++g->label_index;
+  const size_t body_label = ++g->label_index;
+  const size_t latch_label = ++g->label_index;
+  const size_t exit_label = ++g->label_index;
+
+  const size_t start = g->output->size;
+  gen(g, "  %%for.%zu.iv.addr = alloca i32, align 4\n", header_label);
+  gen(g, "  %%for.%zu.to.addr = alloca i32, align 4\n", header_label);
+  move_to_entry(g, start);
+  gen(g, "  store i32 %%%zu, i32* %%for.%zu.iv.addr, align 4\n", from_reg, header_label);
+  gen(g, "  store i32 %%%zu, i32* %%for.%zu.to.addr, align 4\n", to_reg, header_label);
+  gen(g, "  br label %%label.%zu\n", preheader_label);
+  gen_label(g, preheader_label);
+  gen(g, "  br label %%label.%zu\n", header_label);
+
+  gen_label(g, header_label);
+  gen(g, "  %%for.%zu.iv = load i32, i32* %%for.%zu.iv.addr, align 4\n", header_label, header_label);
+  gen(g, "  %%for.%zu.to = load i32, i32* %%for.%zu.to.addr, align 4\n", header_label, header_label);
+  gen(g, "  %%%zu = icmp slt i32 %%for.%zu.iv, %%for.%zu.to\n", ++(g->index), header_label, header_label);
+  gen(g, "  br i1 %%%zu, label %%label.%zu, label %%label.%zu", g->index, body_label, exit_label);
+  gen_branch_weights(g, ast);
+  gen(g, "\n");
+
+  gen_label(g, body_label);
+  gen_count(g, true_counter(ast));
+  gen(g, "  store i32 %%for.%zu.iv, i32* ", header_label);
+  gen_var(g, var);
+  gen(g, ", align 4\n");
+  gen_block(g, ast->children[3]);
+  gen(g, "  br label %%label.%zu\n", latch_label);
+
+  gen_label(g, latch_label);
+  gen(g, "  %%%zu = load i32, i32* %%for.%zu.iv.addr, align 4\n", ++(g->index), header_label);
+  gen(g, "  %%for.%zu.next = add nsw i32 %%%zu, 1\n", header_label, g->index);
+  gen(g, "  store i32 %%for.%zu.next, i32* %%for.%zu.iv.addr, align 4\n", header_label, header_label);
+  gen(g, "  br label %%label.%zu, !llvm.loop !%zu\n", header_label, gen_loop_metadata(g, ast));
+
+  gen_label(g, exit_label);
+  gen_count(g, false_counter(ast));
+  return gen_immediate(g, 0);
+}
 
 static size_t gen_block(CodeGen* g, AST* ast) {
   switch( ast->type ) {
     case ST_NUM: {
       comment(g, "  ; ST_NUM\n");
-      const size_t mem = gen_alloca(g);
-      gen_store_immediate(g, ast->val, mem);
-      const size_t reg = gen_load(g, mem);
-      return reg;
+      return gen_immediate(g, ast->val);
     }
     break;
     case ST_LET: {
       comment(g, "  ; ST_LET\n");
-      gen_named_alloca(g, get_lhs(ast)->token);
       if( get_rhs(ast) ) {
         const size_t num_reg = gen_block(g, get_rhs(ast));
         gen_named_store(g, get_lhs(ast)->token, num_reg);
@@ -173,23 +834,47 @@ static size_t gen_block(CodeGen* g, AST* ast) {
     case ST_CALL: {
       comment(g, "  ; ST_CALL\n");
       Token* ident = ast->token;
-      // Currently , Only single argument function is implemented
-      // TODO: multiple arguments
-      const size_t reg = gen_block(g, get_lhs(ast));
-      return gen_call(g, ident, reg);
+      if( find_gen(g, ident) ) {
+        set_error(g->error, ident->pos, "genの'%.*s'(%zu文字目)はforで回すことしかできません。", (int)ident->len, ident->buffer + ident->pos, ident->pos);
+        return gen_immediate(g, 0);
+      }
+      size_t arg_regs[MAX_BLOCK_SIZE];
+      size_t size = 0;
+      for( AST** arg = ast->children; *arg; ++arg ) {
+        arg_regs[ size++ ] = gen_block(g, *arg);
+      }
+      return gen_call(g, ident, arg_regs, size);
     }
     break;
     case ST_RETURN: {
       comment(g, "  ; ST_RETURN\n");
       const size_t reg = gen_block(g, get_lhs(ast));
-      gen(g, "  ret i32 %%%zu\n", reg);
-      g->index++; // ret increment variable index (for label variable)
+      // genの中のreturnはgenを終わらせて、回しているforの後ろに抜ける
+      if( g->gen_site ) gen(g, "  br label %%label.%zu\n", g->gen_site->exit_label);
+      else gen_return(g, reg);
+      // retの後ろに続く命令は到達しないblockに入れる。
+      // ラベルを付けておけば、ifのphiがこのblockを前任として正しく指せる
+      gen_label(g, ++g->label_index);
       return reg;
     }
     break;
     case ST_IF: {
-      comment(g, "  ; ST_IF\n");
       AST* cond = ast->children[0];
+      if( use_select(g, ast) ) {
+        comment(g, "  ; ST_IF (select)\n");
+        const size_t cmp_reg = gen_block(g, cond);
+        const size_t bool_reg = ++(g->index);
+        gen(g, "  %%%zu = icmp ne i32 %%%zu, 0\n", bool_reg, cmp_reg);
+        const size_t if_true_reg = gen_block(g, ast->children[1]);
+        const size_t if_false_reg = gen_block(g, ast->children[2]);
+        const size_t result_reg = ++(g->index);
+        gen(g, "  %%%zu = select i1 %%%zu, i32 %%%zu, i32 %%%zu", result_reg, bool_reg, if_true_reg, if_false_reg);
+        // 重みはselectにも付けられる。後で分岐に戻すかをLLVMが決めるのに使う
+        gen_branch_weights(g, ast);
+        gen(g, "\n");
+        return result_reg;
+      }
+      comment(g, "  ; ST_IF\n");
 
       const size_t if_true_label = ++g->label_index;
       const size_t if_false_label = ++g->label_index;
@@ -198,40 +883,48 @@ static size_t gen_block(CodeGen* g, AST* ast) {
       // condition
       const size_t cmp_reg = gen_block(g, cond);
       gen(g, "  %%%zu = icmp ne i32 %%%zu, 0\n", ++(g->index), cmp_reg);
-      gen(g, "  br i1 %%%zu, label %%label.%zu, label %%label.%zu\n", g->index, if_true_label, if_false_label);
-
-      // when true
-      gen(g, "label.%zu:\n", if_true_label);
-      AST* when_true = ast->children[1];
-      const size_t before_true = g->label_index;
-      const size_t if_true_reg = gen_block(g, when_true);
-      size_t if_true_end_label = g->label_index;
-      if( if_true_end_label == before_true ) if_true_end_label = if_true_label;
-      gen(g, "  br label %%label.%zu\n", if_end_label);
-
-      // when false
-      gen(g, "label.%zu:\n", if_false_label);
-      AST* when_false = ast->children[2];
-      const size_t before_false = g->label_index;
-      const size_t if_false_reg = gen_block(g, when_false);
-      size_t if_false_end_label = g->label_index;
-      if( if_false_end_label == before_false ) if_false_end_label = if_false_label;
-      gen(g, "  br label %%label.%zu\n", if_end_label);
-
-      gen(g, "label.%zu:\n", if_end_label);
+      gen(g, "  br i1 %%%zu, label %%label.%zu, label %%label.%zu", g->index, if_true_label, if_false_label);
+      gen_branch_weights(g, ast);
+      gen(g, "\n");
+
+      // プロファイルでfalseの方が多く通っていれば、そちらのblockを先に置く
+      uint64_t true_count, false_count;
+      const bool false_first = branch_counts(g, ast, &true_count, &false_count) && false_count > true_count;
+
+      size_t if_true_reg = 0, if_true_end_label = 0, if_false_reg = 0, if_false_end_label = 0;
+      for( int arm = 0; arm < 2; ++arm ) {
+        if( (arm == 0) != false_first ) {
+          // when true
+          gen_label(g, if_true_label);
+          gen_count(g, true_counter(ast));
+          if_true_reg = gen_block(g, ast->children[1]);
+          if_true_end_label = g->block_label;
+        } else {
+          // when false
+          gen_label(g, if_false_label);
+          gen_count(g, false_counter(ast));
+          if_false_reg = gen_block(g, ast->children[2]);
+          if_false_end_label = g->block_label;
+        }
+        gen(g, "  br label %%label.%zu\n", if_end_label);
+      }
+
+      gen_label(g, if_end_label);
       const size_t result_reg = ++(g->index);
       gen(g, "  %%%zu = phi i32 [ %%%zu, %%label.%zu ], [ %%%zu, %%label.%zu ]\n", result_reg, if_true_reg, if_true_end_label, if_false_reg, if_false_end_label);
       return result_reg;
     }
     break;
     case ST_LOOP: {
-      comment(g, "  ; ST_IF\n");
+      comment(g, "  ; ST_LOOP\n");
       const size_t loop_retry_label = ++g->label_index;
       const size_t loop_end_label = ++g->label_index;
+      // 計装するときは、戻る辺を数えるためのblockを挟む
+      const size_t loop_continue_label = g->instrument ? ++g->label_index : loop_retry_label;
 
       // retry label..
       gen(g, "  br label %%label.%zu\n", loop_retry_label);
-      gen(g, "label.%zu:\n", loop_retry_label);
+      gen_label(g, loop_retry_label);
 
       // runnning a statement
       AST* stmt = ast->children[0];
@@ -239,14 +932,87 @@ static size_t gen_block(CodeGen* g, AST* ast) {
 
       // condition check
       gen(g, "  %%%zu = icmp ne i32 %%%zu, 0\n", ++(g->index), result_reg);
-      gen(g, "  br i1 %%%zu, label %%label.%zu, label %%label.%zu\n", g->index, loop_retry_label, loop_end_label);
-      gen(g, "label.%zu:\n", loop_end_label);
+      gen(g, "  br i1 %%%zu, label %%label.%zu, label %%label.%zu", g->index, loop_continue_label, loop_end_label);
+      gen_branch_weights(g, ast);
+      gen(g, "\n");
+      if( g->instrument ) {
+        gen_label(g, loop_continue_label);
+        gen_count(g, true_counter(ast));
+        gen(g, "  br label %%label.%zu\n", loop_retry_label);
+      }
+      gen_label(g, loop_end_label);
+      gen_count(g, false_counter(ast));
 
       return result_reg;
     }
     break;
+    case ST_FOR: {
+      comment(g, "  ; ST_FOR\n");
+      Token* var = get_lhs(ast)->token;
+      const size_t from_reg = gen_block(g, ast->children[1]);
+      const size_t to_reg = gen_block(g, ast->children[2]);
+      if( g->gen_site && g->gen_site->shared && count_yields(ast->children[3]) ) return gen_yielding_for(g, ast, from_reg, to_reg);
+
+      const size_t preheader_label = ++g->label_index;
+      const size_t header_label = ++g->label_index;
+      const size_t body_label = ++g->label_index;
+      const size_t latch_label = ++g->label_index;
+      const size_t exit_label = ++g->label_index;
+
+      // preheader: 範囲は一度だけ評価して、ここから入る
+      gen(g, "  br label %%label.%zu\n", preheader_label);
+      gen_label(g, preheader_label);
+      gen(g, "  br label %%label.%zu\n", header_label);
+
+      // header: 誘導変数はphiで持つ。latchで作る値を前方参照するので名前付きにする
+      gen_label(g, header_label);
+      gen(g, "  %%for.%zu.iv = phi i32 [ %%%zu, %%label.%zu ], [ %%for.%zu.next, %%label.%zu ]\n",
+        header_label, from_reg, preheader_label, header_label, latch_label);
+      gen(g, "  %%%zu = icmp slt i32 %%for.%zu.iv, %%%zu\n", ++(g->index), header_label, to_reg);
+      gen(g, "  br i1 %%%zu, label %%label.%zu, label %%label.%zu", g->index, body_label, exit_label);
+      gen_branch_weights(g, ast);
+      gen(g, "\n");
+
+      // body: ループ変数からは普通の変数として読めるようにする
+      gen_label(g, body_label);
+      gen_count(g, true_counter(ast));
+      gen(g, "  store i32 %%for.%zu.iv, i32* ", header_label);
+      gen_var(g, var);
+      gen(g, ", align 4\n");
+      gen_block(g, ast->children[3]);
+      gen(g, "  br label %%label.%zu\n", latch_label);
+
+      // latch
+      gen_label(g, latch_label);
+      gen(g, "  %%for.%zu.next = add nsw i32 %%for.%zu.iv, 1\n", header_label, header_label);
+      gen(g, "  br label %%label.%zu, !llvm.loop !%zu\n", header_label, gen_loop_metadata(g, ast));
+
+      gen_label(g, exit_label);
+      gen_count(g, false_counter(ast));
+      return gen_immediate(g, 0);
+    }
+    break;
+    case ST_PARFOR: {
+      comment(g, "  ; ST_PARFOR\n");
+      const size_t from_reg = gen_block(g, ast->children[1]);
+      const size_t to_reg = gen_block(g, ast->children[2]);
+      return gen_parfor(g, ast, from_reg, to_reg);
+    }
+    break;
+    case ST_FOREACH: {
+      comment(g, "  ; ST_FOREACH\n");
+      return gen_foreach(g, ast);
+    }
+    break;
+    case ST_YIELD: {
+      comment(g, "  ; ST_YIELD\n");
+      return gen_yield(g, ast);
+    }
+    break;
     case ST_BLOCK: {
       comment(g, "  ; ST_BLOCK\n");
+      // 空のblockは0になる
+      if( !ast->children[0] ) return gen_immediate(g, 0);
       size_t result_reg;
       for( AST** current = ast->children; *current; ++current ) {
         result_reg = gen_block(g, *current);
@@ -339,7 +1105,108 @@ static size_t gen_block(CodeGen* g, AST* ast) {
   return g->index;
 }
 
-void generate_func(CodeGen* g, AST* func) {
+// parforの本体を i32 (i8* env, i32 lo, i32 hi) の関数として出す。[lo, hi)を回して本体の値の合計を返す。
+// 変数は呼び出し元からenvで受け取った値で初期化した自分のallocaに置くので、各回の代入は外に漏れない
+static void generate_parloop(CodeGen* g, ParLoop* loop) {
+  AST* ast = loop->ast;
+  Token* var = get_lhs(ast)->token;
+  Token* captures[MAX_LOCALS];
+  const size_t size = collect_captures(ast->children[3], var, captures, 0);
+
+  gen(g, "define internal i32 ");
+  gen_parloop_symbol(g, loop);
+  gen(g, "(i8* %%par.env, i32 %%par.lo, i32 %%par.hi) nounwind {\n");
+  g->index = 0;
+  g->label_index = 0;
+  g->locals_size = 0;
+  g->locals_pos = g->output->size;
+  g->gen_scopes = 0;
+  g->counting = loop->counting;
+  g->memo_args = 0;
+  gen_named_alloca(g, var);
+  for( size_t i = 0; i < size; ++i ) gen_named_alloca(g, captures[i]);
+  gen_locals(g, ast->children[3]);
+  if( size ) gen(g, "  %%par.vars = bitcast i8* %%par.env to i32*\n");
+  for( size_t i = 0; i < size; ++i ) {
+    const size_t ptr = ++(g->index);
+    gen(g, "  %%%zu = getelementptr inbounds i32, i32* %%par.vars, i64 %zu\n", ptr, i);
+    gen_named_store(g, captures[i], gen_load(g, ptr));
+  }
+
+  const size_t preheader_label = ++g->label_index;
+  const size_t header_label = ++g->label_index;
+  const size_t body_label = ++g->label_index;
+  const size_t latch_label = ++g->label_index;
+  const size_t exit_label = ++g->label_index;
+  gen(g, "  br label %%label.%zu\n", preheader_label);
+  gen_label(g, preheader_label);
+  gen(g, "  br label %%label.%zu\n", header_label);
+
+  gen_label(g, header_label);
+  gen(g, "  %%par.iv = phi i32 [ %%par.lo, %%label.%zu ], [ %%par.next, %%label.%zu ]\n", preheader_label, latch_label);
+  gen(g, "  %%par.sum = phi i32 [ 0, %%label.%zu ], [ %%par.sum.next, %%label.%zu ]\n", preheader_label, latch_label);
+  gen(g, "  %%%zu = icmp slt i32 %%par.iv, %%par.hi\n", ++(g->index));
+  gen(g, "  br i1 %%%zu, label %%label.%zu, label %%label.%zu\n", g->index, body_label, exit_label);
+
+  gen_label(g, body_label);
+  gen(g, "  store i32 %%par.iv, i32* %%%.*s, align 4\n", var->len, var->buffer + var->pos);
+  const size_t value_reg = gen_block(g, ast->children[3]);
+  gen(g, "  br label %%label.%zu\n", latch_label);
+
+  gen_label(g, latch_label);
+  gen(g, "  %%par.sum.next = add i32 %%par.sum, %%%zu\n", value_reg);
+  gen(g, "  %%par.next = add nsw i32 %%par.iv, 1\n");
+  gen(g, "  br label %%label.%zu, !llvm.loop !%zu\n", header_label, add_metadata(g, MD_LOOP, 0, 0));
+
+  gen_label(g, exit_label);
+  gen(g, "  ret i32 %%par.sum\n");
+  gen(g, "}\n");
+}
+
+static void generate_func(CodeGen* g, AST* func) {
+  // 分岐に番号を振って、カウンタの数とプロファイルを決める
+  size_t branches = 0;
+  if( find_builtin(func->token) ) {
+    set_error(g->error, func->token->pos, "'%.*s'(%zu文字目)は組み込み関数なので、同じ名前の関数は定義できません。",
+      (int)func->token->len, func->token->buffer + func->token->pos, func->token->pos);
+    return;
+  }
+  number_branches(get_rhs(func), &branches);
+  g->func_name = func->token;
+  g->counters = 1 + 2 * branches;
+  g->func_profile = g->profile ? find_func_profile(g->profile, func->token) : NULL;
+  if( g->func_profile && g->func_profile->size != g->counters ) {
+    // ソースが変わって分岐の数が合わないプロファイルは使えない
+    set_error(g->error, func->token->pos, "関数'%.*s'のプロファイルがソースと合いません(カウンタが%zu個のはずが%zu個)。",
+      (int)func->token->len, func->token->buffer + func->token->pos, g->counters, g->func_profile->size);
+    return;
+  }
+  if( g->instrument ) {
+    gen(g, "@freq.prof.%.*s = internal global [%zu x i64] zeroinitializer, align 8\n",
+      (int)func->token->len, func->token->buffer + func->token->pos, g->counters);
+  }
+  // 副作用の無い再帰関数は、同じ引数での呼び出しを表から返す
+  size_t arity = 0;
+  for( AST** arg = get_lhs(func)->children; *arg; ++arg ) ++arity;
+  // parforから呼ばれる関数は表を複数のスレッドから同時に書き換えてしまうのでメモ化しない
+  const bool memoizable = (func->val & EFFECT_PURE) && (func->val & EFFECT_RECURSIVE) && !(func->val & EFFECT_PARALLEL);
+  g->memo_args = g->memoize && memoizable && arity > 0 && arity <= MEMO_MAX_ARGS ? arity : 0;
+  if( g->memo_args ) {
+    gen(g, "@freq.memo.%.*s = internal global [%d x [%zu x i32]] zeroinitializer, align 16\n",
+      (int)func->token->len, func->token->buffer + func->token->pos, MEMO_SIZE, memo_width(g));
+  }
+  EmittedFunc* emitted = (EmittedFunc*)arena_alloc(g->arena, sizeof(EmittedFunc));
+  // 最後に表を作るときには関数のASTはもう無いことがあるので、名前は写しておく
+  emitted->name = (Token*)arena_alloc(g->arena, sizeof(Token));
+  *emitted->name = *func->token;
+  emitted->name->next = NULL;
+  emitted->id = g->funcs_size++;
+  emitted->counters = g->counters;
+  emitted->next = NULL;
+  if( g->funcs_tail ) g->funcs_tail->next = emitted;
+  else g->funcs = emitted;
+  g->funcs_tail = emitted;
+
   gen_func_define_name(g, func->token);
   AST* args = get_lhs(func);
   // reset variable index!!
@@ -348,47 +1215,1142 @@ void generate_func(CodeGen* g, AST* func) {
   for( AST** arg = args->children; *arg; ++arg ) {
     gen_func_define_arg(g);
   }
-  gen_func_start(g);
+  if( g->func_profile ) {
+    gen(g, ") nounwind !prof !%zu {\n", add_metadata(g, MD_ENTRY_COUNT, g->func_profile->counts[0], 0));
+  } else {
+    gen_func_start(g);
+  }
 
   comment(g, "; --------- Store args\n");
   // reset variable index!!
   g->index = 0;
   g->label_index = 0;
+  g->locals_size = 0;
+  g->locals_pos = g->output->size;
+  g->gen_scopes = 0;
+  g->counting = true;
   // args
   for( AST** arg = args->children; *arg; ++arg ) {
     gen_func_start_arg(g, g->index++, (*arg)->token);
   }
+  // locals
+  gen_locals(g, get_rhs(func));
+  g->par_env = count_par_env(g, get_rhs(func), NULL);
+  if( g->par_env ) gen(g, "  %%par.env = alloca [%zu x i32], align 4\n", g->par_env);
+  g->parloops = g->parloops_tail = NULL;
+  gen_count(g, 0);
+  gen_profiler_enter(g);
+  gen_memo_lookup(g);
   size_t result_reg = gen_block(g, get_rhs(func));
   gen_func_end(g, result_reg);
+
+  for( ParLoop* loop = g->parloops; loop; loop = loop->next )
+    generate_parloop(g, loop);
 }
 
-void generate_header(CodeGen* g) {
-  gen(g, "%%FILE = type opaque\n");
-  gen(g, "@__stdinp = external global %%FILE*, align 8\n");
-  gen(g, "@__stdoutp = external global %%FILE*, align 8\n");
-  gen(g, "@__stderrp = external global %%FILE*, align 8\n");
+// printの出力は一旦このバッファに貯めて、溢れそうなときと終了時にだけwrite(2)する。
+// 1回のprintで書くのは高々 符号 + 10桁 + 改行 の12文字。
+#define PRINT_BUFFER_SIZE (65536)
+#define PRINT_DIGITS_SIZE (16)
+
+static void generate_print(CodeGen* g) {
+  const int size = PRINT_BUFFER_SIZE;
+  const int digits = PRINT_DIGITS_SIZE;
+
+  gen(g, "@freq.out.buf = internal global [%d x i8] zeroinitializer, align 16\n", size);
+  gen(g, "@freq.out.len = internal global i64 0, align 8\n");
   gen(g, "\n");
 
-  gen(g, "@str = private unnamed_addr constant [4 x i8] c\"%%d\\0A\\00\", align 1\n");
+  gen(g, "declare i64 @write(i32, i8*, i64)\n");
+  gen(g, "declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i1)\n");
   gen(g, "\n");
 
-  gen(g, "declare i32 @fprintf(%%FILE*, i8*, ...)\n");
-  gen(g, "declare i32 @printf(i8*, ...)\n");
-  gen(g, "declare i32 @atoi(...)\n");
+  // バッファの中身をすべてstdoutに書き出す。writeは途中までしか書かないことがあるので繰り返す。
+  gen(g, "define internal void @freq.flush() nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  %%len = load i64, i64* @freq.out.len, align 8\n");
+  gen(g, "  %%buf = getelementptr inbounds [%d x i8], [%d x i8]* @freq.out.buf, i64 0, i64 0\n", size, size);
+  gen(g, "  br label %%loop\n");
+  gen(g, "loop:\n");
+  gen(g, "  %%off = phi i64 [ 0, %%entry ], [ %%next, %%more ]\n");
+  gen(g, "  %%rest = sub i64 %%len, %%off\n");
+  gen(g, "  %%done = icmp sle i64 %%rest, 0\n");
+  gen(g, "  br i1 %%done, label %%end, label %%more\n");
+  gen(g, "more:\n");
+  gen(g, "  %%ptr = getelementptr inbounds i8, i8* %%buf, i64 %%off\n");
+  gen(g, "  %%written = call i64 @write(i32 1, i8* %%ptr, i64 %%rest)\n");
+  gen(g, "  %%next = add i64 %%off, %%written\n");
+  gen(g, "  %%failed = icmp sle i64 %%written, 0\n");
+  gen(g, "  br i1 %%failed, label %%end, label %%loop\n");
+  gen(g, "end:\n");
+  gen(g, "  store i64 0, i64* @freq.out.len, align 8\n");
+  gen(g, "  ret void\n");
+  gen(g, "}\n");
+  gen(g, "\n");
 
+  // 数値を後ろから一桁ずつ作業領域に書いてから、まとめてバッファにコピーする
   gen(g, "define i32 @print(i32) nounwind {\n");
-  gen(g, "  call i32 (i8*, ...) @printf(i8* getelementptr inbounds ([4 x i8], [4 x i8]* @str, i64 0, i64 0), i32 %%0)\n");
+  gen(g, "entry:\n");
+  gen(g, "  %%digits = alloca [%d x i8], align 1\n", digits);
+  gen(g, "  %%used = load i64, i64* @freq.out.len, align 8\n");
+  gen(g, "  %%full = icmp ugt i64 %%used, %d\n", size - digits);
+  gen(g, "  br i1 %%full, label %%flush, label %%format\n");
+  gen(g, "flush:\n");
+  gen(g, "  call void @freq.flush()\n");
+  gen(g, "  br label %%format\n");
+  gen(g, "format:\n");
+  gen(g, "  %%neg = icmp slt i32 %%0, 0\n");
+  gen(g, "  %%wide = sext i32 %%0 to i64\n");
+  gen(g, "  %%negated = sub i64 0, %%wide\n");
+  gen(g, "  %%abs = select i1 %%neg, i64 %%negated, i64 %%wide\n");
+  gen(g, "  %%newline = getelementptr inbounds [%d x i8], [%d x i8]* %%digits, i64 0, i64 %d\n", digits, digits, digits - 1);
+  gen(g, "  store i8 10, i8* %%newline, align 1\n");
+  gen(g, "  br label %%digit\n");
+  gen(g, "digit:\n");
+  gen(g, "  %%pos = phi i64 [ %d, %%format ], [ %%next.pos, %%digit ]\n", digits - 1);
+  gen(g, "  %%rest = phi i64 [ %%abs, %%format ], [ %%quot, %%digit ]\n");
+  gen(g, "  %%next.pos = sub i64 %%pos, 1\n");
+  gen(g, "  %%quot = udiv i64 %%rest, 10\n");
+  gen(g, "  %%rem = urem i64 %%rest, 10\n");
+  gen(g, "  %%rem8 = trunc i64 %%rem to i8\n");
+  gen(g, "  %%char = add i8 %%rem8, 48\n");
+  gen(g, "  %%slot = getelementptr inbounds [%d x i8], [%d x i8]* %%digits, i64 0, i64 %%next.pos\n", digits, digits);
+  gen(g, "  store i8 %%char, i8* %%slot, align 1\n");
+  gen(g, "  %%more = icmp ne i64 %%quot, 0\n");
+  gen(g, "  br i1 %%more, label %%digit, label %%copy\n");
+  gen(g, "copy:\n");
+  gen(g, "  %%minus.pos = sub i64 %%next.pos, 1\n");
+  gen(g, "  %%minus = getelementptr inbounds [%d x i8], [%d x i8]* %%digits, i64 0, i64 %%minus.pos\n", digits, digits);
+  gen(g, "  store i8 45, i8* %%minus, align 1\n");
+  gen(g, "  %%start = select i1 %%neg, i64 %%minus.pos, i64 %%next.pos\n");
+  gen(g, "  %%count = sub i64 %d, %%start\n", digits);
+  gen(g, "  %%src = getelementptr inbounds [%d x i8], [%d x i8]* %%digits, i64 0, i64 %%start\n", digits, digits);
+  gen(g, "  %%len = load i64, i64* @freq.out.len, align 8\n");
+  gen(g, "  %%dst = getelementptr inbounds [%d x i8], [%d x i8]* @freq.out.buf, i64 0, i64 %%len\n", size, size);
+  gen(g, "  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %%dst, i8* %%src, i64 %%count, i1 false)\n");
+  gen(g, "  %%new.len = add i64 %%len, %%count\n");
+  gen(g, "  store i64 %%new.len, i64* @freq.out.len, align 8\n");
   gen(g, "  ret i32 %%0\n");
   gen(g, "}\n");
   gen(g, "\n");
 }
 
-void generate_code(CodeGen* g, AST* root) {
+// read()はstdinをこのバッファ単位でread(2)して、手書きのループで数値を読む。
+#define READ_BUFFER_SIZE (65536)
+
+static void generate_read(CodeGen* g) {
+  const int size = READ_BUFFER_SIZE;
+
+  gen(g, "@freq.in.buf = internal global [%d x i8] zeroinitializer, align 16\n", size);
+  gen(g, "@freq.in.pos = internal global i64 0, align 8\n");
+  gen(g, "@freq.in.len = internal global i64 0, align 8\n");
+  gen(g, "@freq.in.eof = internal global i32 0, align 4\n");
+  gen(g, "\n");
+
+  gen(g, "declare i64 @read(i32, i8*, i64)\n");
+  gen(g, "\n");
+
+  // バッファを読み直す。入力が尽きていたらfalse。
+  // 入力を待つ前に、それまでにprintした分(プロンプトなど)を書き出しておく
+  gen(g, "define internal i1 @freq.fill() nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  call void @freq.flush()\n");
+  gen(g, "  %%buf = getelementptr inbounds [%d x i8], [%d x i8]* @freq.in.buf, i64 0, i64 0\n", size, size);
+  gen(g, "  %%got = call i64 @read(i32 0, i8* %%buf, i64 %d)\n", size);
+  gen(g, "  %%ok = icmp sgt i64 %%got, 0\n");
+  gen(g, "  %%len = select i1 %%ok, i64 %%got, i64 0\n");
+  gen(g, "  store i64 0, i64* @freq.in.pos, align 8\n");
+  gen(g, "  store i64 %%len, i64* @freq.in.len, align 8\n");
+  gen(g, "  ret i1 %%ok\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+
+  // 数字か、すぐ後に数字が続く'-'が来るまで読み飛ばし、そこから数字が続く限り読む。
+  // 数値がもう無ければ0を返し、eof()が1になる。
+  gen(g, "define i32 @freq.read() nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  %%pos = load i64, i64* @freq.in.pos, align 8\n");
+  gen(g, "  br label %%skip\n");
+  gen(g, "skip:\n");
+  gen(g, "  %%p = phi i64 [ %%pos, %%entry ], [ %%p.next, %%skip.next ], [ 0, %%skip.filled ], [ %%m.p, %%minus.char ]\n");
+  gen(g, "  %%len = load i64, i64* @freq.in.len, align 8\n");
+  gen(g, "  %%empty = icmp uge i64 %%p, %%len\n");
+  gen(g, "  br i1 %%empty, label %%skip.fill, label %%skip.char\n");
+  gen(g, "skip.fill:\n");
+  gen(g, "  %%skip.ok = call i1 @freq.fill()\n");
+  gen(g, "  br i1 %%skip.ok, label %%skip.filled, label %%eof\n");
+  gen(g, "skip.filled:\n");
+  gen(g, "  br label %%skip\n");
+  gen(g, "skip.char:\n");
+  gen(g, "  %%ptr = getelementptr inbounds [%d x i8], [%d x i8]* @freq.in.buf, i64 0, i64 %%p\n", size, size);
+  gen(g, "  %%c = load i8, i8* %%ptr, align 1\n");
+  gen(g, "  %%p.next = add i64 %%p, 1\n");
+  gen(g, "  %%is.minus = icmp eq i8 %%c, 45\n");
+  gen(g, "  %%digit = sub i8 %%c, 48\n");
+  gen(g, "  %%is.digit = icmp ult i8 %%digit, 10\n");
+  gen(g, "  br i1 %%is.digit, label %%number, label %%skip.other\n");
+  gen(g, "skip.other:\n");
+  gen(g, "  br i1 %%is.minus, label %%minus, label %%skip.next\n");
+  gen(g, "skip.next:\n");
+  gen(g, "  br label %%skip\n");
+  // '-'は次の文字が数字のときだけ符号にする。バッファの終わりなら読み足して見る
+  gen(g, "minus:\n");
+  gen(g, "  %%m.len = load i64, i64* @freq.in.len, align 8\n");
+  gen(g, "  %%m.end = icmp uge i64 %%p.next, %%m.len\n");
+  gen(g, "  br i1 %%m.end, label %%minus.fill, label %%minus.char\n");
+  gen(g, "minus.fill:\n");
+  gen(g, "  %%m.ok = call i1 @freq.fill()\n");
+  gen(g, "  br i1 %%m.ok, label %%minus.char, label %%eof\n");
+  gen(g, "minus.char:\n");
+  gen(g, "  %%m.p = phi i64 [ %%p.next, %%minus ], [ 0, %%minus.fill ]\n");
+  gen(g, "  %%m.ptr = getelementptr inbounds [%d x i8], [%d x i8]* @freq.in.buf, i64 0, i64 %%m.p\n", size, size);
+  gen(g, "  %%m.c = load i8, i8* %%m.ptr, align 1\n");
+  gen(g, "  %%m.d = sub i8 %%m.c, 48\n");
+  gen(g, "  %%m.is.digit = icmp ult i8 %%m.d, 10\n");
+  gen(g, "  %%m.q = add i64 %%m.p, 1\n");
+  gen(g, "  br i1 %%m.is.digit, label %%number, label %%skip\n");
+  gen(g, "number:\n");
+  gen(g, "  %%start = phi i64 [ %%p.next, %%skip.char ], [ %%m.q, %%minus.char ]\n");
+  gen(g, "  %%first.d = phi i8 [ %%digit, %%skip.char ], [ %%m.d, %%minus.char ]\n");
+  gen(g, "  %%negative = phi i1 [ 0, %%skip.char ], [ 1, %%minus.char ]\n");
+  gen(g, "  %%value = zext i8 %%first.d to i32\n");
+  gen(g, "  br label %%num\n");
+  gen(g, "num:\n");
+  gen(g, "  %%q = phi i64 [ %%start, %%number ], [ %%q.next, %%num.digit ], [ 0, %%num.filled ]\n");
+  gen(g, "  %%v = phi i32 [ %%value, %%number ], [ %%v.next, %%num.digit ], [ %%v, %%num.filled ]\n");
+  gen(g, "  %%num.len = load i64, i64* @freq.in.len, align 8\n");
+  gen(g, "  %%end = icmp uge i64 %%q, %%num.len\n");
+  gen(g, "  br i1 %%end, label %%num.fill, label %%num.char\n");
+  gen(g, "num.fill:\n");
+  gen(g, "  %%num.ok = call i1 @freq.fill()\n");
+  gen(g, "  br i1 %%num.ok, label %%num.filled, label %%finish\n");
+  gen(g, "num.filled:\n");
+  gen(g, "  br label %%num\n");
+  gen(g, "num.char:\n");
+  gen(g, "  %%num.ptr = getelementptr inbounds [%d x i8], [%d x i8]* @freq.in.buf, i64 0, i64 %%q\n", size, size);
+  gen(g, "  %%num.c = load i8, i8* %%num.ptr, align 1\n");
+  gen(g, "  %%num.d = sub i8 %%num.c, 48\n");
+  gen(g, "  %%num.is.digit = icmp ult i8 %%num.d, 10\n");
+  gen(g, "  br i1 %%num.is.digit, label %%num.digit, label %%done\n");
+  gen(g, "num.digit:\n");
+  gen(g, "  %%v.mul = mul i32 %%v, 10\n");
+  gen(g, "  %%v.add = zext i8 %%num.d to i32\n");
+  gen(g, "  %%v.next = add i32 %%v.mul, %%v.add\n");
+  gen(g, "  %%q.next = add i64 %%q, 1\n");
+  gen(g, "  br label %%num\n");
+  gen(g, "done:\n");
+  gen(g, "  store i64 %%q, i64* @freq.in.pos, align 8\n");
+  gen(g, "  br label %%finish\n");
+  gen(g, "finish:\n");
+  gen(g, "  %%negated = sub i32 0, %%v\n");
+  gen(g, "  %%result = select i1 %%negative, i32 %%negated, i32 %%v\n");
+  gen(g, "  store i32 0, i32* @freq.in.eof, align 4\n");
+  gen(g, "  ret i32 %%result\n");
+  gen(g, "eof:\n");
+  gen(g, "  store i32 1, i32* @freq.in.eof, align 4\n");
+  gen(g, "  ret i32 0\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+
+  // 直前のread()が数値を読めなかったら1
+  gen(g, "define i32 @freq.eof() nounwind {\n");
+  gen(g, "  %%flag = load i32, i32* @freq.in.eof, align 4\n");
+  gen(g, "  ret i32 %%flag\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+}
+
+static void generate_header(CodeGen* g) {
+  generate_print(g);
+  generate_read(g);
+}
+
+// c"..." の中身としてエスケープして出す
+static void gen_escaped(CodeGen* g, const char* str, size_t len) {
+  for( size_t i = 0; i < len; ++i ) {
+    const unsigned char c = (unsigned char)str[i];
+    if( c < 0x20 || c >= 0x7f || c == '"' || c == '\\' ) gen(g, "\\%02X", c);
+    else gen(g, "%c", c);
+  }
+}
+
+// 文字列の定数を出す
+static void gen_string(CodeGen* g, const char* name, const char* str) {
+  gen(g, "@%s = private unnamed_addr constant [%zu x i8] c\"", name, strlen(str) + 1);
+  gen_escaped(g, str, strlen(str));
+  gen(g, "\\00\"\n");
+}
+
+// gen_stringで出した定数の先頭を指すi8*をregに入れる
+static void gen_string_ptr(CodeGen* g, const char* reg, const char* name, const char* str) {
+  const size_t size = strlen(str) + 1;
+  gen(g, "  %%%s = getelementptr inbounds [%zu x i8], [%zu x i8]* @%s, i64 0, i64 0\n", reg, size, size, name);
+}
+
+// ファイルに書き出すときに使うlibcの関数。PGOとプロファイラで共有する
+static void generate_stdio(CodeGen* g) {
+  if( !g->instrument && !g->stacks ) return;
+  gen_string(g, "freq.io.write", "w");
+  gen(g, "declare i8* @fopen(i8*, i8*)\n");
+  gen(g, "declare i32 @fputs(i8*, i8*)\n");
+  gen(g, "declare i32 @fprintf(i8*, i8*, ...)\n");
+  gen(g, "declare i32 @fclose(i8*)\n");
+  gen(g, "\n");
+}
+
+// 計装したときは、終了時にカウンタをプロファイルとして書き出す
+static void generate_profile_dump(CodeGen* g) {
+  if( !g->instrument ) return;
+
+  gen_string(g, "freq.prof.path", g->instrument);
+  gen_string(g, "freq.prof.count", " %llu");
+  gen_string(g, "freq.prof.newline", "\n");
+  for( EmittedFunc* f = g->funcs; f; f = f->next ) {
+    gen(g, "@freq.prof.name.%.*s = private unnamed_addr constant [%zu x i8] c\"%.*s\\00\"\n",
+      (int)f->name->len, f->name->buffer + f->name->pos, f->name->len + 1, (int)f->name->len, f->name->buffer + f->name->pos);
+  }
+  gen(g, "\n");
+
+  gen(g, "define internal void @freq.prof.dump() nounwind {\n");
+  gen(g, "entry:\n");
+  gen_string_ptr(g, "path", "freq.prof.path", g->instrument);
+  gen_string_ptr(g, "mode", "freq.io.write", "w");
+  gen(g, "  %%fp = call i8* @fopen(i8* %%path, i8* %%mode)\n");
+  gen(g, "  %%failed = icmp eq i8* %%fp, null\n");
+  gen(g, "  br i1 %%failed, label %%done, label %%write\n");
+  gen(g, "write:\n");
+  gen_string_ptr(g, "count", "freq.prof.count", " %llu");
+  gen_string_ptr(g, "newline", "freq.prof.newline", "\n");
+  size_t k = 0;
+  for( EmittedFunc* f = g->funcs; f; f = f->next, ++k ) {
+    const int len = (int)f->name->len;
+    const char* name = f->name->buffer + f->name->pos;
+    gen(g, "  %%name.%zu = getelementptr inbounds [%zu x i8], [%zu x i8]* @freq.prof.name.%.*s, i64 0, i64 0\n",
+      k, f->name->len + 1, f->name->len + 1, len, name);
+    gen(g, "  call i32 @fputs(i8* %%name.%zu, i8* %%fp)\n", k);
+    for( size_t j = 0; j < f->counters; ++j ) {
+      gen(g, "  %%ptr.%zu.%zu = getelementptr inbounds [%zu x i64], [%zu x i64]* @freq.prof.%.*s, i64 0, i64 %zu\n",
+        k, j, f->counters, f->counters, len, name, j);
+      gen(g, "  %%value.%zu.%zu = load i64, i64* %%ptr.%zu.%zu, align 8\n", k, j, k, j);
+      gen(g, "  call i32 (i8*, i8*, ...) @fprintf(i8* %%fp, i8* %%count, i64 %%value.%zu.%zu)\n", k, j);
+    }
+    gen(g, "  call i32 @fputs(i8* %%newline, i8* %%fp)\n");
+  }
+  gen(g, "  call i32 @fclose(i8* %%fp)\n");
+  gen(g, "  br label %%done\n");
+  gen(g, "done:\n");
+  gen(g, "  ret void\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+}
+
+// CCTのノード数。ハッシュ表なので2の冪にして、埋まりすぎる前に打ち切る。
+// 打ち切った後に初めて出てきた呼び出し文脈は、呼び出し元のノードにまとめて数える
+#define CCT_SIZE (65536)
+#define CCT_LIMIT (CCT_SIZE / 4 * 3)
+
+#define PROFILE_HEADER "freq profile: %llu cycles\n   self%%           self      inclusive       calls  function\n"
+#define PROFILE_ROW    "%5llu.%llu%% %14llu %14llu %11llu  %s\n"
+#define PROFILE_DROPPED "(%llu calls beyond the call tree limit were counted in their callers)\n"
+
+// [size x type]のグローバルな配列のindex番目を指すポインタをregに入れる
+static void gen_cyc_slot(CodeGen* g, const char* reg, const char* array, const char* type, size_t size, const char* index) {
+  gen(g, "  %%%s = getelementptr inbounds [%zu x %s], [%zu x %s]* @freq.cyc.%s, i64 0, i64 %%%s\n",
+    reg, size, type, size, type, array, index);
+}
+
+// 関数名を同じ幅に揃えた表。関数番号で引く
+static size_t generate_profiler_names(CodeGen* g) {
+  size_t width = 1;
+  for( EmittedFunc* f = g->funcs; f; f = f->next ) {
+    if( f->name->len + 1 > width ) width = f->name->len + 1;
+  }
+  gen(g, "@freq.cyc.names = private unnamed_addr constant [%zu x [%zu x i8]] [", g->funcs_size, width);
+  for( EmittedFunc* f = g->funcs; f; f = f->next ) {
+    gen(g, "%s[%zu x i8] c\"", f->id ? ", " : "", width);
+    gen_escaped(g, f->name->buffer + f->name->pos, f->name->len);
+    for( size_t i = f->name->len; i < width; ++i ) gen(g, "\\00");
+    gen(g, "\"");
+  }
+  gen(g, "]\n");
+  return width;
+}
+
+// 関数の出入りでllvm.readcyclecounterを読み、呼び出し文脈(CCT)ごとの自分だけの時間と、
+// 関数ごとの呼び出し回数・再帰の一番外側から測った時間を数える。
+// プロファイラ自身にかかった時間はどのノードにも数えず、inclusiveもノードに数えた時間だけが
+// 進む時計(freq.cyc.clock)で測るので、selfとinclusiveは同じ基準で比べられる。
+static void generate_profiler(CodeGen* g) {
+  if( !g->profiler ) return;
+
+  const size_t nodes = CCT_SIZE + 1; // 最後の1つが根
+  const size_t funcs = g->funcs_size;
+  gen(g, "@freq.cyc.cur = internal global i32 %d, align 4\n", CCT_SIZE);
+  gen(g, "@freq.cyc.last = internal global i64 0, align 8\n");
+  gen(g, "@freq.cyc.clock = internal global i64 0, align 8\n");
+  gen(g, "@freq.cyc.nodes = internal global i32 0, align 4\n");
+  gen(g, "@freq.cyc.dropped = internal global i64 0, align 8\n");
+  // ノードの関数番号 + 1。0なら空き
+  gen(g, "@freq.cyc.func = internal global [%zu x i32] zeroinitializer, align 16\n", nodes);
+  gen(g, "@freq.cyc.parent = internal global [%zu x i32] zeroinitializer, align 16\n", nodes);
+  gen(g, "@freq.cyc.self = internal global [%zu x i64] zeroinitializer, align 16\n", nodes);
+  gen(g, "@freq.cyc.calls = internal global [%zu x i64] zeroinitializer, align 16\n", funcs);
+  gen(g, "@freq.cyc.inclusive = internal global [%zu x i64] zeroinitializer, align 16\n", funcs);
+  gen(g, "@freq.cyc.start = internal global [%zu x i64] zeroinitializer, align 16\n", funcs);
+  gen(g, "@freq.cyc.depth = internal global [%zu x i32] zeroinitializer, align 16\n", funcs);
+  gen(g, "@freq.cyc.total = internal global [%zu x i64] zeroinitializer, align 16\n", funcs);
+  gen(g, "@freq.cyc.shown = internal global [%zu x i8] zeroinitializer, align 16\n", funcs);
+  const size_t width = generate_profiler_names(g);
+  gen_string(g, "freq.cyc.header", PROFILE_HEADER);
+  gen_string(g, "freq.cyc.row", PROFILE_ROW);
+  gen_string(g, "freq.cyc.dropped.format", PROFILE_DROPPED);
+  gen(g, "\n");
+  gen(g, "declare i64 @llvm.readcyclecounter()\n");
+  gen(g, "declare i32 @dprintf(i32, i8*, ...)\n");
+  gen(g, "\n");
+
+  // 前回の区切りからnowまでの時間をnodeに足して、進めた後の時計を返す
+  gen(g, "define internal i64 @freq.cyc.charge(i32 %%node, i64 %%now) nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  %%last = load i64, i64* @freq.cyc.last, align 8\n");
+  gen(g, "  %%elapsed = sub i64 %%now, %%last\n");
+  gen(g, "  %%index = zext i32 %%node to i64\n");
+  gen_cyc_slot(g, "ptr", "self", "i64", nodes, "index");
+  gen(g, "  %%self = load i64, i64* %%ptr, align 8\n");
+  gen(g, "  %%sum = add i64 %%self, %%elapsed\n");
+  gen(g, "  store i64 %%sum, i64* %%ptr, align 8\n");
+  gen(g, "  %%clock = load i64, i64* @freq.cyc.clock, align 8\n");
+  gen(g, "  %%clock.next = add i64 %%clock, %%elapsed\n");
+  gen(g, "  store i64 %%clock.next, i64* @freq.cyc.clock, align 8\n");
+  gen(g, "  ret i64 %%clock.next\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+
+  // 今のノードの子のうち関数fのものをハッシュ表で探し、無ければ作って降りる
+  gen(g, "define internal i32 @freq.cyc.enter(i32 %%f) nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  %%now = call i64 @llvm.readcyclecounter()\n");
+  gen(g, "  %%cur = load i32, i32* @freq.cyc.cur, align 4\n");
+  gen(g, "  %%clock = call i64 @freq.cyc.charge(i32 %%cur, i64 %%now)\n");
+  gen(g, "  %%index = zext i32 %%f to i64\n");
+  gen_cyc_slot(g, "calls.ptr", "calls", "i64", funcs, "index");
+  gen(g, "  %%calls = load i64, i64* %%calls.ptr, align 8\n");
+  gen(g, "  %%calls.next = add i64 %%calls, 1\n");
+  gen(g, "  store i64 %%calls.next, i64* %%calls.ptr, align 8\n");
+  gen_cyc_slot(g, "depth.ptr", "depth", "i32", funcs, "index");
+  gen(g, "  %%depth = load i32, i32* %%depth.ptr, align 4\n");
+  gen(g, "  %%depth.next = add i32 %%depth, 1\n");
+  gen(g, "  store i32 %%depth.next, i32* %%depth.ptr, align 4\n");
+  gen(g, "  %%outermost = icmp eq i32 %%depth, 0\n");
+  gen(g, "  br i1 %%outermost, label %%start, label %%find\n");
+  gen(g, "start:\n");
+  gen_cyc_slot(g, "start.ptr", "start", "i64", funcs, "index");
+  gen(g, "  store i64 %%clock, i64* %%start.ptr, align 8\n");
+  gen(g, "  br label %%find\n");
+  gen(g, "find:\n");
+  gen(g, "  %%key = add i32 %%f, 1\n");
+  gen(g, "  %%mixed = mul i32 %%cur, 40503\n");
+  gen(g, "  %%hash = xor i32 %%mixed, %%key\n");
+  gen(g, "  %%first = and i32 %%hash, %d\n", CCT_SIZE - 1);
+  gen(g, "  br label %%probe\n");
+  gen(g, "probe:\n");
+  gen(g, "  %%slot = phi i32 [ %%first, %%find ], [ %%next.slot, %%next ]\n");
+  gen(g, "  %%slot.index = zext i32 %%slot to i64\n");
+  gen_cyc_slot(g, "func.ptr", "func", "i32", nodes, "slot.index");
+  gen(g, "  %%func = load i32, i32* %%func.ptr, align 4\n");
+  gen(g, "  %%empty = icmp eq i32 %%func, 0\n");
+  gen(g, "  br i1 %%empty, label %%insert, label %%check\n");
+  gen(g, "check:\n");
+  gen_cyc_slot(g, "parent.ptr", "parent", "i32", nodes, "slot.index");
+  gen(g, "  %%parent = load i32, i32* %%parent.ptr, align 4\n");
+  gen(g, "  %%same.func = icmp eq i32 %%func, %%key\n");
+  gen(g, "  %%same.parent = icmp eq i32 %%parent, %%cur\n");
+  gen(g, "  %%found = and i1 %%same.func, %%same.parent\n");
+  gen(g, "  br i1 %%found, label %%descend, label %%next\n");
+  gen(g, "next:\n");
+  gen(g, "  %%succ = add i32 %%slot, 1\n");
+  gen(g, "  %%next.slot = and i32 %%succ, %d\n", CCT_SIZE - 1);
+  gen(g, "  br label %%probe\n");
+  gen(g, "insert:\n");
+  gen(g, "  %%used = load i32, i32* @freq.cyc.nodes, align 4\n");
+  gen(g, "  %%full = icmp uge i32 %%used, %d\n", CCT_LIMIT);
+  gen(g, "  br i1 %%full, label %%overflow, label %%create\n");
+  gen(g, "create:\n");
+  gen(g, "  store i32 %%key, i32* %%func.ptr, align 4\n");
+  gen_cyc_slot(g, "new.parent.ptr", "parent", "i32", nodes, "slot.index");
+  gen(g, "  store i32 %%cur, i32* %%new.parent.ptr, align 4\n");
+  gen(g, "  %%used.next = add i32 %%used, 1\n");
+  gen(g, "  store i32 %%used.next, i32* @freq.cyc.nodes, align 4\n");
+  gen(g, "  br label %%descend\n");
+  gen(g, "descend:\n");
+  gen(g, "  store i32 %%slot, i32* @freq.cyc.cur, align 4\n");
+  gen(g, "  br label %%done\n");
+  gen(g, "overflow:\n");
+  gen(g, "  %%dropped = load i64, i64* @freq.cyc.dropped, align 8\n");
+  gen(g, "  %%dropped.next = add i64 %%dropped, 1\n");
+  gen(g, "  store i64 %%dropped.next, i64* @freq.cyc.dropped, align 8\n");
+  gen(g, "  br label %%done\n");
+  gen(g, "done:\n");
+  gen(g, "  %%end = call i64 @llvm.readcyclecounter()\n");
+  gen(g, "  store i64 %%end, i64* @freq.cyc.last, align 8\n");
+  gen(g, "  ret i32 %%cur\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+
+  // 呼び出し元のノードに戻る。再帰の一番外側から抜けたらinclusiveに足す
+  gen(g, "define internal void @freq.cyc.leave(i32 %%f, i32 %%caller) nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  %%now = call i64 @llvm.readcyclecounter()\n");
+  gen(g, "  %%cur = load i32, i32* @freq.cyc.cur, align 4\n");
+  gen(g, "  %%clock = call i64 @freq.cyc.charge(i32 %%cur, i64 %%now)\n");
+  gen(g, "  store i32 %%caller, i32* @freq.cyc.cur, align 4\n");
+  gen(g, "  %%index = zext i32 %%f to i64\n");
+  gen_cyc_slot(g, "depth.ptr", "depth", "i32", funcs, "index");
+  gen(g, "  %%depth = load i32, i32* %%depth.ptr, align 4\n");
+  gen(g, "  %%depth.next = sub i32 %%depth, 1\n");
+  gen(g, "  store i32 %%depth.next, i32* %%depth.ptr, align 4\n");
+  gen(g, "  %%outermost = icmp eq i32 %%depth.next, 0\n");
+  gen(g, "  br i1 %%outermost, label %%close, label %%done\n");
+  gen(g, "close:\n");
+  gen_cyc_slot(g, "start.ptr", "start", "i64", funcs, "index");
+  gen(g, "  %%start = load i64, i64* %%start.ptr, align 8\n");
+  gen(g, "  %%elapsed = sub i64 %%clock, %%start\n");
+  gen_cyc_slot(g, "inclusive.ptr", "inclusive", "i64", funcs, "index");
+  gen(g, "  %%inclusive = load i64, i64* %%inclusive.ptr, align 8\n");
+  gen(g, "  %%sum = add i64 %%inclusive, %%elapsed\n");
+  gen(g, "  store i64 %%sum, i64* %%inclusive.ptr, align 8\n");
+  gen(g, "  br label %%done\n");
+  gen(g, "done:\n");
+  gen(g, "  %%end = call i64 @llvm.readcyclecounter()\n");
+  gen(g, "  store i64 %%end, i64* @freq.cyc.last, align 8\n");
+  gen(g, "  ret void\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+
+  if( g->stacks ) {
+    gen_string(g, "freq.cyc.stacks.path", g->stacks);
+    gen_string(g, "freq.cyc.stacks.count", " %llu\n");
+    gen_string(g, "freq.cyc.stacks.separator", ";");
+    gen(g, "\n");
+
+    // 根からnodeまでの関数名を;で繋いで書く
+    gen(g, "define internal void @freq.cyc.path(i8* %%fp, i32 %%node) nounwind {\n");
+    gen(g, "entry:\n");
+    gen(g, "  %%index = zext i32 %%node to i64\n");
+    gen_cyc_slot(g, "parent.ptr", "parent", "i32", nodes, "index");
+    gen(g, "  %%parent = load i32, i32* %%parent.ptr, align 4\n");
+    gen(g, "  %%top = icmp eq i32 %%parent, %d\n", CCT_SIZE);
+    gen(g, "  br i1 %%top, label %%name, label %%up\n");
+    gen(g, "up:\n");
+    gen(g, "  call void @freq.cyc.path(i8* %%fp, i32 %%parent)\n");
+    gen_string_ptr(g, "separator", "freq.cyc.stacks.separator", ";");
+    gen(g, "  call i32 @fputs(i8* %%separator, i8* %%fp)\n");
+    gen(g, "  br label %%name\n");
+    gen(g, "name:\n");
+    gen_cyc_slot(g, "func.ptr", "func", "i32", nodes, "index");
+    gen(g, "  %%func = load i32, i32* %%func.ptr, align 4\n");
+    gen(g, "  %%f = sub i32 %%func, 1\n");
+    gen(g, "  %%f.index = zext i32 %%f to i64\n");
+    gen(g, "  %%str = getelementptr inbounds [%zu x [%zu x i8]], [%zu x [%zu x i8]]* @freq.cyc.names, i64 0, i64 %%f.index, i64 0\n",
+      funcs, width, funcs, width);
+    gen(g, "  call i32 @fputs(i8* %%str, i8* %%fp)\n");
+    gen(g, "  ret void\n");
+    gen(g, "}\n");
+    gen(g, "\n");
+
+    // 時間を使ったノードごとに "a;b;c cycles" の1行を書く(flamegraph.plなどのcollapsed形式)
+    gen(g, "define internal void @freq.cyc.stacks() nounwind {\n");
+    gen(g, "entry:\n");
+    gen_string_ptr(g, "path", "freq.cyc.stacks.path", g->stacks);
+    gen_string_ptr(g, "mode", "freq.io.write", "w");
+    gen(g, "  %%fp = call i8* @fopen(i8* %%path, i8* %%mode)\n");
+    gen(g, "  %%failed = icmp eq i8* %%fp, null\n");
+    gen(g, "  br i1 %%failed, label %%done, label %%start\n");
+    gen(g, "start:\n");
+    gen_string_ptr(g, "count", "freq.cyc.stacks.count", " %llu\n");
+    gen(g, "  br label %%loop\n");
+    gen(g, "loop:\n");
+    gen(g, "  %%i = phi i64 [ 0, %%start ], [ %%i.next, %%next ]\n");
+    gen(g, "  %%more = icmp ult i64 %%i, %d\n", CCT_SIZE);
+    gen(g, "  br i1 %%more, label %%body, label %%close\n");
+    gen(g, "body:\n");
+    gen_cyc_slot(g, "func.ptr", "func", "i32", nodes, "i");
+    gen(g, "  %%func = load i32, i32* %%func.ptr, align 4\n");
+    gen_cyc_slot(g, "self.ptr", "self", "i64", nodes, "i");
+    gen(g, "  %%self = load i64, i64* %%self.ptr, align 8\n");
+    gen(g, "  %%used = icmp ne i32 %%func, 0\n");
+    gen(g, "  %%hot = icmp ne i64 %%self, 0\n");
+    gen(g, "  %%emit = and i1 %%used, %%hot\n");
+    gen(g, "  br i1 %%emit, label %%write, label %%next\n");
+    gen(g, "write:\n");
+    gen(g, "  %%node = trunc i64 %%i to i32\n");
+    gen(g, "  call void @freq.cyc.path(i8* %%fp, i32 %%node)\n");
+    gen(g, "  call i32 (i8*, i8*, ...) @fprintf(i8* %%fp, i8* %%count, i64 %%self)\n");
+    gen(g, "  br label %%next\n");
+    gen(g, "next:\n");
+    gen(g, "  %%i.next = add i64 %%i, 1\n");
+    gen(g, "  br label %%loop\n");
+    gen(g, "close:\n");
+    gen(g, "  call i32 @fclose(i8* %%fp)\n");
+    gen(g, "  br label %%done\n");
+    gen(g, "done:\n");
+    gen(g, "  ret void\n");
+    gen(g, "}\n");
+    gen(g, "\n");
+  }
+
+  // 関数ごとにselfを集計して、selfの大きい順にstderrへ出す
+  gen(g, "define internal void @freq.cyc.report() nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  br label %%sum\n");
+  gen(g, "sum:\n");
+  gen(g, "  %%i = phi i64 [ 0, %%entry ], [ %%i.next, %%sum.next ]\n");
+  gen(g, "  %%sum.more = icmp ult i64 %%i, %d\n", CCT_SIZE);
+  gen(g, "  br i1 %%sum.more, label %%sum.body, label %%grand\n");
+  gen(g, "sum.body:\n");
+  gen_cyc_slot(g, "func.ptr", "func", "i32", nodes, "i");
+  gen(g, "  %%func = load i32, i32* %%func.ptr, align 4\n");
+  gen(g, "  %%used = icmp ne i32 %%func, 0\n");
+  gen(g, "  br i1 %%used, label %%sum.add, label %%sum.next\n");
+  gen(g, "sum.add:\n");
+  gen(g, "  %%f = sub i32 %%func, 1\n");
+  gen(g, "  %%f.index = zext i32 %%f to i64\n");
+  gen_cyc_slot(g, "self.ptr", "self", "i64", nodes, "i");
+  gen(g, "  %%self = load i64, i64* %%self.ptr, align 8\n");
+  gen_cyc_slot(g, "total.ptr", "total", "i64", funcs, "f.index");
+  gen(g, "  %%total = load i64, i64* %%total.ptr, align 8\n");
+  gen(g, "  %%total.next = add i64 %%total, %%self\n");
+  gen(g, "  store i64 %%total.next, i64* %%total.ptr, align 8\n");
+  gen(g, "  br label %%sum.next\n");
+  gen(g, "sum.next:\n");
+  gen(g, "  %%i.next = add i64 %%i, 1\n");
+  gen(g, "  br label %%sum\n");
+  gen(g, "grand:\n");
+  gen(g, "  %%k = phi i64 [ 0, %%sum ], [ %%k.next, %%grand.body ]\n");
+  gen(g, "  %%all = phi i64 [ 0, %%sum ], [ %%all.next, %%grand.body ]\n");
+  gen(g, "  %%grand.more = icmp ult i64 %%k, %zu\n", funcs);
+  gen(g, "  br i1 %%grand.more, label %%grand.body, label %%header\n");
+  gen(g, "grand.body:\n");
+  gen_cyc_slot(g, "part.ptr", "total", "i64", funcs, "k");
+  gen(g, "  %%part = load i64, i64* %%part.ptr, align 8\n");
+  gen(g, "  %%all.next = add i64 %%all, %%part\n");
+  gen(g, "  %%k.next = add i64 %%k, 1\n");
+  gen(g, "  br label %%grand\n");
+  gen(g, "header:\n");
+  gen_string_ptr(g, "header.format", "freq.cyc.header", PROFILE_HEADER);
+  gen(g, "  call i32 (i32, i8*, ...) @dprintf(i32 2, i8* %%header.format, i64 %%all)\n");
+  gen(g, "  %%nothing = icmp eq i64 %%all, 0\n");
+  gen(g, "  %%denominator = select i1 %%nothing, i64 1, i64 %%all\n");
+  gen(g, "  br label %%rank\n");
+  // まだ出していない中でselfが最大の関数を探す
+  gen(g, "rank:\n");
+  gen(g, "  %%r = phi i64 [ 0, %%header ], [ %%r.next, %%row ]\n");
+  gen(g, "  %%rank.more = icmp ult i64 %%r, %zu\n", funcs);
+  gen(g, "  br i1 %%rank.more, label %%scan, label %%tail\n");
+  gen(g, "scan:\n");
+  gen(g, "  %%j = phi i64 [ 0, %%rank ], [ %%j.next, %%scan.body ]\n");
+  gen(g, "  %%best = phi i64 [ %zu, %%rank ], [ %%best.next, %%scan.body ]\n", funcs);
+  gen(g, "  %%best.self = phi i64 [ 0, %%rank ], [ %%best.self.next, %%scan.body ]\n");
+  gen(g, "  %%scan.more = icmp ult i64 %%j, %zu\n", funcs);
+  gen(g, "  br i1 %%scan.more, label %%scan.body, label %%row\n");
+  gen(g, "scan.body:\n");
+  gen_cyc_slot(g, "shown.ptr", "shown", "i8", funcs, "j");
+  gen(g, "  %%shown = load i8, i8* %%shown.ptr, align 1\n");
+  gen(g, "  %%fresh = icmp eq i8 %%shown, 0\n");
+  gen_cyc_slot(g, "candidate.ptr", "total", "i64", funcs, "j");
+  gen(g, "  %%candidate = load i64, i64* %%candidate.ptr, align 8\n");
+  gen(g, "  %%none = icmp eq i64 %%best, %zu\n", funcs);
+  gen(g, "  %%greater = icmp ugt i64 %%candidate, %%best.self\n");
+  gen(g, "  %%better = or i1 %%none, %%greater\n");
+  gen(g, "  %%take = and i1 %%fresh, %%better\n");
+  gen(g, "  %%best.next = select i1 %%take, i64 %%j, i64 %%best\n");
+  gen(g, "  %%best.self.next = select i1 %%take, i64 %%candidate, i64 %%best.self\n");
+  gen(g, "  %%j.next = add i64 %%j, 1\n");
+  gen(g, "  br label %%scan\n");
+  gen(g, "row:\n");
+  gen_cyc_slot(g, "best.shown.ptr", "shown", "i8", funcs, "best");
+  gen(g, "  store i8 1, i8* %%best.shown.ptr, align 1\n");
+  gen_cyc_slot(g, "calls.ptr", "calls", "i64", funcs, "best");
+  gen(g, "  %%calls = load i64, i64* %%calls.ptr, align 8\n");
+  gen_cyc_slot(g, "inclusive.ptr", "inclusive", "i64", funcs, "best");
+  gen(g, "  %%inclusive = load i64, i64* %%inclusive.ptr, align 8\n");
+  gen(g, "  %%scaled = mul i64 %%best.self, 1000\n");
+  gen(g, "  %%permille = udiv i64 %%scaled, %%denominator\n");
+  gen(g, "  %%percent = udiv i64 %%permille, 10\n");
+  gen(g, "  %%decimal = urem i64 %%permille, 10\n");
+  gen(g, "  %%name = getelementptr inbounds [%zu x [%zu x i8]], [%zu x [%zu x i8]]* @freq.cyc.names, i64 0, i64 %%best, i64 0\n",
+    funcs, width, funcs, width);
+  gen_string_ptr(g, "row.format", "freq.cyc.row", PROFILE_ROW);
+  gen(g, "  call i32 (i32, i8*, ...) @dprintf(i32 2, i8* %%row.format, i64 %%percent, i64 %%decimal, i64 %%best.self, i64 %%inclusive, i64 %%calls, i8* %%name)\n");
+  gen(g, "  %%r.next = add i64 %%r, 1\n");
+  gen(g, "  br label %%rank\n");
+  gen(g, "tail:\n");
+  gen(g, "  %%dropped = load i64, i64* @freq.cyc.dropped, align 8\n");
+  gen(g, "  %%any.dropped = icmp ne i64 %%dropped, 0\n");
+  gen(g, "  br i1 %%any.dropped, label %%warn, label %%done\n");
+  gen(g, "warn:\n");
+  gen_string_ptr(g, "dropped.format", "freq.cyc.dropped.format", PROFILE_DROPPED);
+  gen(g, "  call i32 (i32, i8*, ...) @dprintf(i32 2, i8* %%dropped.format, i64 %%dropped)\n");
+  gen(g, "  br label %%done\n");
+  gen(g, "done:\n");
+  if( g->stacks ) gen(g, "  call void @freq.cyc.stacks()\n");
+  gen(g, "  ret void\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+}
+
+// ワーカーwのdequeのロックを指すi8*をregに入れる
+static void gen_par_deque_lock(CodeGen* g, const char* reg, const char* worker) {
+  gen(g, "  %%%s = getelementptr inbounds [%d x [%d x i8]], [%d x [%d x i8]]* @freq.par.dq.lock, i64 0, i64 %%%s, i64 0\n",
+    reg, PAR_MAX_WORKERS, PAR_SYNC_SIZE, PAR_MAX_WORKERS, PAR_SYNC_SIZE, worker);
+}
+
+// ワーカーwのdequeのtopかbottomを指すi32*をregに入れる
+static void gen_par_deque_end(CodeGen* g, const char* reg, const char* end, const char* worker) {
+  gen(g, "  %%%s = getelementptr inbounds [%d x i32], [%d x i32]* @freq.par.dq.%s, i64 0, i64 %%%s\n",
+    reg, PAR_MAX_WORKERS, PAR_MAX_WORKERS, end, worker);
+}
+
+// ワーカーwのdequeのslot番目の範囲の端(loかhi)を指すi32*をregに入れる
+static void gen_par_deque_slot(CodeGen* g, const char* reg, const char* bound, const char* worker, const char* slot) {
+  gen(g, "  %%%s = getelementptr inbounds [%d x [%d x i32]], [%d x [%d x i32]]* @freq.par.dq.%s, i64 0, i64 %%%s, i64 %%%s\n",
+    reg, PAR_MAX_WORKERS, PAR_DEQUE_SIZE, PAR_MAX_WORKERS, PAR_DEQUE_SIZE, bound, worker, slot);
+}
+
+// dequeから範囲を1つ取り出す。ownerは自分のdequeの下から、盗むときは他人のdequeの上から取る。
+// 空になったらtopとbottomを0に戻して、下に積める場所を空ける
+static void generate_par_take(CodeGen* g, const char* name, bool owner) {
+  gen(g, "define internal i1 @freq.par.%s(i32 %%w, i32* %%lo.out, i32* %%hi.out) nounwind {\n", name);
+  gen(g, "entry:\n");
+  gen(g, "  %%index = zext i32 %%w to i64\n");
+  gen_par_deque_lock(g, "lock", "index");
+  gen(g, "  call i32 @pthread_mutex_lock(i8* %%lock)\n");
+  gen_par_deque_end(g, "top.ptr", "top", "index");
+  gen_par_deque_end(g, "bottom.ptr", "bottom", "index");
+  gen(g, "  %%top = load i32, i32* %%top.ptr, align 4\n");
+  gen(g, "  %%bottom = load i32, i32* %%bottom.ptr, align 4\n");
+  gen(g, "  %%empty = icmp eq i32 %%top, %%bottom\n");
+  gen(g, "  br i1 %%empty, label %%reset, label %%take\n");
+  gen(g, "take:\n");
+  if( owner ) {
+    gen(g, "  %%taken = sub i32 %%bottom, 1\n");
+    gen(g, "  store i32 %%taken, i32* %%bottom.ptr, align 4\n");
+  } else {
+    gen(g, "  %%taken = add i32 %%top, 0\n");
+    gen(g, "  %%top.next = add i32 %%top, 1\n");
+    gen(g, "  store i32 %%top.next, i32* %%top.ptr, align 4\n");
+  }
+  gen(g, "  %%slot = zext i32 %%taken to i64\n");
+  gen_par_deque_slot(g, "lo.ptr", "lo", "index", "slot");
+  gen_par_deque_slot(g, "hi.ptr", "hi", "index", "slot");
+  gen(g, "  %%lo = load i32, i32* %%lo.ptr, align 4\n");
+  gen(g, "  %%hi = load i32, i32* %%hi.ptr, align 4\n");
+  gen(g, "  store i32 %%lo, i32* %%lo.out, align 4\n");
+  gen(g, "  store i32 %%hi, i32* %%hi.out, align 4\n");
+  gen(g, "  br label %%done\n");
+  gen(g, "reset:\n");
+  gen(g, "  store i32 0, i32* %%top.ptr, align 4\n");
+  gen(g, "  store i32 0, i32* %%bottom.ptr, align 4\n");
+  gen(g, "  br label %%done\n");
+  gen(g, "done:\n");
+  gen(g, "  %%found = phi i1 [ true, %%take ], [ false, %%reset ]\n");
+  gen(g, "  call i32 @pthread_mutex_unlock(i8* %%lock)\n");
+  gen(g, "  ret i1 %%found\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+}
+
+// parforのランタイム。呼び出したスレッドをワーカー0として、固定数のワーカーで範囲を分け合う。
+// ワーカーはそれぞれ範囲のdequeを持ち、取り出した範囲が大きければ半分を自分のdequeに積んで残りを続ける。
+// 手が空いたワーカーは他のワーカーのdequeから盗み、盗めなければ積まれるか全て終わるまで眠る。
+// 部分和は全体のロックの下で足し合わせる。
+// プロファイラや計装のカウンタはスレッドを考えていないので、そのときはワーカー1つで回す
+static void generate_parallel(CodeGen* g) {
+  if( !g->parloops_size ) return;
+
+  const int workers = PAR_MAX_WORKERS;
+  const int deque = PAR_DEQUE_SIZE;
+  const int sync = PAR_SYNC_SIZE;
+  const int limit = g->profiler || g->instrument ? 1 : PAR_MAX_WORKERS;
+  gen(g, "@freq.par.lock = internal global [%d x i8] zeroinitializer, align 16\n", sync);
+  gen(g, "@freq.par.wake = internal global [%d x i8] zeroinitializer, align 16\n", sync);
+  gen(g, "@freq.par.done = internal global [%d x i8] zeroinitializer, align 16\n", sync);
+  gen(g, "@freq.par.queued = internal global [%d x i8] zeroinitializer, align 16\n", sync);
+  // 以下はすべて@freq.par.lockの下で読み書きする。ただしfnからgrainまではジョブの間変わらない
+  gen(g, "@freq.par.workers = internal global i32 0, align 4\n");
+  gen(g, "@freq.par.busy = internal global i32 0, align 4\n");
+  gen(g, "@freq.par.generation = internal global i32 0, align 4\n");
+  gen(g, "@freq.par.finished = internal global i32 0, align 4\n");
+  gen(g, "@freq.par.fn = internal global i32 (i8*, i32, i32)* null, align 8\n");
+  gen(g, "@freq.par.env = internal global i8* null, align 8\n");
+  gen(g, "@freq.par.grain = internal global i64 0, align 8\n");
+  gen(g, "@freq.par.remaining = internal global i64 0, align 8\n");
+  gen(g, "@freq.par.sum = internal global i32 0, align 4\n");
+  // ジョブの途中でdequeに範囲を積んだ回数。手が空いたワーカーが眠る前に、探した後に積まれていないかを見る
+  gen(g, "@freq.par.pushes = internal global i32 0, align 4\n");
+  // ワーカーごとのdeque。[top, bottom)に範囲が入っている
+  gen(g, "@freq.par.dq.lock = internal global [%d x [%d x i8]] zeroinitializer, align 16\n", workers, sync);
+  gen(g, "@freq.par.dq.top = internal global [%d x i32] zeroinitializer, align 16\n", workers);
+  gen(g, "@freq.par.dq.bottom = internal global [%d x i32] zeroinitializer, align 16\n", workers);
+  gen(g, "@freq.par.dq.lo = internal global [%d x [%d x i32]] zeroinitializer, align 16\n", workers, deque);
+  gen(g, "@freq.par.dq.hi = internal global [%d x [%d x i32]] zeroinitializer, align 16\n", workers, deque);
+  gen_string(g, "freq.par.threads", "FREQ_THREADS");
+  gen(g, "\n");
+  gen(g, "declare i32 @pthread_create(i64*, i8*, i8* (i8*)*, i8*)\n");
+  gen(g, "declare i32 @pthread_mutex_lock(i8*)\n");
+  gen(g, "declare i32 @pthread_mutex_unlock(i8*)\n");
+  gen(g, "declare i32 @pthread_cond_wait(i8*, i8*)\n");
+  gen(g, "declare i32 @pthread_cond_signal(i8*)\n");
+  gen(g, "declare i32 @pthread_cond_broadcast(i8*)\n");
+  gen(g, "declare i64 @sysconf(i32)\n");
+  gen(g, "declare i8* @getenv(i8*)\n");
+  gen(g, "declare i32 @atoi(i8*)\n");
+  gen(g, "\n");
+
+  // 自分のdequeの下に範囲を積む。いっぱいならfalse
+  gen(g, "define internal i1 @freq.par.push(i32 %%w, i32 %%lo, i32 %%hi) nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  %%index = zext i32 %%w to i64\n");
+  gen_par_deque_lock(g, "lock", "index");
+  gen(g, "  call i32 @pthread_mutex_lock(i8* %%lock)\n");
+  gen_par_deque_end(g, "bottom.ptr", "bottom", "index");
+  gen(g, "  %%bottom = load i32, i32* %%bottom.ptr, align 4\n");
+  gen(g, "  %%full = icmp eq i32 %%bottom, %d\n", deque);
+  gen(g, "  br i1 %%full, label %%done, label %%push\n");
+  gen(g, "push:\n");
+  gen(g, "  %%slot = zext i32 %%bottom to i64\n");
+  gen_par_deque_slot(g, "lo.ptr", "lo", "index", "slot");
+  gen_par_deque_slot(g, "hi.ptr", "hi", "index", "slot");
+  gen(g, "  store i32 %%lo, i32* %%lo.ptr, align 4\n");
+  gen(g, "  store i32 %%hi, i32* %%hi.ptr, align 4\n");
+  gen(g, "  %%bottom.next = add i32 %%bottom, 1\n");
+  gen(g, "  store i32 %%bottom.next, i32* %%bottom.ptr, align 4\n");
+  gen(g, "  br label %%done\n");
+  gen(g, "done:\n");
+  gen(g, "  call i32 @pthread_mutex_unlock(i8* %%lock)\n");
+  gen(g, "  %%pushed = xor i1 %%full, true\n");
+  gen(g, "  ret i1 %%pushed\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+
+  generate_par_take(g, "pop", true);
+  generate_par_take(g, "steal", false);
+
+  // ワーカーwとして、今のジョブの範囲が無くなるまで取り出しては実行する
+  gen(g, "define internal void @freq.par.work(i32 %%w) nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  %%lo.ptr = alloca i32, align 4\n");
+  gen(g, "  %%hi.ptr = alloca i32, align 4\n");
+  gen(g, "  %%lock = getelementptr inbounds [%d x i8], [%d x i8]* @freq.par.lock, i64 0, i64 0\n", sync, sync);
+  gen(g, "  %%queued = getelementptr inbounds [%d x i8], [%d x i8]* @freq.par.queued, i64 0, i64 0\n", sync, sync);
+  gen(g, "  %%workers = load i32, i32* @freq.par.workers, align 4\n");
+  gen(g, "  call i32 @pthread_mutex_lock(i8* %%lock)\n");
+  gen(g, "  %%seen.first = load i32, i32* @freq.par.pushes, align 4\n");
+  gen(g, "  call i32 @pthread_mutex_unlock(i8* %%lock)\n");
+  gen(g, "  br label %%find\n");
+  // seenは探し始める前に見たpushesの値
+  gen(g, "find:\n");
+  gen(g, "  %%seen = phi i32 [ %%seen.first, %%entry ], [ %%seen.body, %%body.done ], [ %%pushes, %%rescan ]\n");
+  gen(g, "  %%own = call i1 @freq.par.pop(i32 %%w, i32* %%lo.ptr, i32* %%hi.ptr)\n");
+  gen(g, "  br i1 %%own, label %%run, label %%victim\n");
+  gen(g, "victim:\n");
+  gen(g, "  %%k = phi i32 [ 1, %%find ], [ %%k.next, %%victim.next ]\n");
+  gen(g, "  %%more = icmp ult i32 %%k, %%workers\n");
+  gen(g, "  br i1 %%more, label %%victim.try, label %%idle\n");
+  gen(g, "victim.try:\n");
+  gen(g, "  %%offset = add i32 %%w, %%k\n");
+  gen(g, "  %%v = urem i32 %%offset, %%workers\n");
+  gen(g, "  %%stolen = call i1 @freq.par.steal(i32 %%v, i32* %%lo.ptr, i32* %%hi.ptr)\n");
+  gen(g, "  br i1 %%stolen, label %%run, label %%victim.next\n");
+  gen(g, "victim.next:\n");
+  gen(g, "  %%k.next = add i32 %%k, 1\n");
+  gen(g, "  br label %%victim\n");
+  // どこにも無ければ、他のワーカーが実行中の範囲から積むか、全て終わるまで眠る。
+  // 探した後に積まれていれば起こされないので、眠らずに探し直す
+  gen(g, "idle:\n");
+  gen(g, "  call i32 @pthread_mutex_lock(i8* %%lock)\n");
+  gen(g, "  br label %%idle.check\n");
+  gen(g, "idle.check:\n");
+  gen(g, "  %%remaining = load i64, i64* @freq.par.remaining, align 8\n");
+  gen(g, "  %%finished = icmp eq i64 %%remaining, 0\n");
+  gen(g, "  br i1 %%finished, label %%exit, label %%idle.pushed\n");
+  gen(g, "idle.pushed:\n");
+  gen(g, "  %%pushes = load i32, i32* @freq.par.pushes, align 4\n");
+  gen(g, "  %%stale = icmp eq i32 %%pushes, %%seen\n");
+  gen(g, "  br i1 %%stale, label %%sleep, label %%rescan\n");
+  gen(g, "sleep:\n");
+  gen(g, "  call i32 @pthread_cond_wait(i8* %%queued, i8* %%lock)\n");
+  gen(g, "  br label %%idle.check\n");
+  gen(g, "rescan:\n");
+  gen(g, "  call i32 @pthread_mutex_unlock(i8* %%lock)\n");
+  gen(g, "  br label %%find\n");
+  gen(g, "run:\n");
+  gen(g, "  %%lo = load i32, i32* %%lo.ptr, align 4\n");
+  gen(g, "  %%hi.first = load i32, i32* %%hi.ptr, align 4\n");
+  gen(g, "  %%grain = load i64, i64* @freq.par.grain, align 8\n");
+  gen(g, "  %%lo.wide = sext i32 %%lo to i64\n");
+  gen(g, "  br label %%split\n");
+  gen(g, "split:\n");
+  gen(g, "  %%hi = phi i32 [ %%hi.first, %%run ], [ %%mid, %%split.half ]\n");
+  gen(g, "  %%hi.wide = sext i32 %%hi to i64\n");
+  gen(g, "  %%count = sub i64 %%hi.wide, %%lo.wide\n");
+  gen(g, "  %%large = icmp sgt i64 %%count, %%grain\n");
+  gen(g, "  br i1 %%large, label %%split.try, label %%body\n");
+  gen(g, "split.try:\n");
+  gen(g, "  %%half = lshr i64 %%count, 1\n");
+  gen(g, "  %%mid.wide = add i64 %%lo.wide, %%half\n");
+  gen(g, "  %%mid = trunc i64 %%mid.wide to i32\n");
+  gen(g, "  %%pushed = call i1 @freq.par.push(i32 %%w, i32 %%mid, i32 %%hi)\n");
+  gen(g, "  br i1 %%pushed, label %%split.half, label %%body\n");
+  // 積んだことを眠っているワーカーに知らせる
+  gen(g, "split.half:\n");
+  gen(g, "  call i32 @pthread_mutex_lock(i8* %%lock)\n");
+  gen(g, "  %%pushes.old = load i32, i32* @freq.par.pushes, align 4\n");
+  gen(g, "  %%pushes.new = add i32 %%pushes.old, 1\n");
+  gen(g, "  store i32 %%pushes.new, i32* @freq.par.pushes, align 4\n");
+  gen(g, "  call i32 @pthread_cond_signal(i8* %%queued)\n");
+  gen(g, "  call i32 @pthread_mutex_unlock(i8* %%lock)\n");
+  gen(g, "  br label %%split\n");
+  gen(g, "body:\n");
+  gen(g, "  %%fn = load i32 (i8*, i32, i32)*, i32 (i8*, i32, i32)** @freq.par.fn, align 8\n");
+  gen(g, "  %%env = load i8*, i8** @freq.par.env, align 8\n");
+  gen(g, "  %%partial = call i32 %%fn(i8* %%env, i32 %%lo, i32 %%hi)\n");
+  gen(g, "  call i32 @pthread_mutex_lock(i8* %%lock)\n");
+  gen(g, "  %%sum = load i32, i32* @freq.par.sum, align 4\n");
+  gen(g, "  %%sum.next = add i32 %%sum, %%partial\n");
+  gen(g, "  store i32 %%sum.next, i32* @freq.par.sum, align 4\n");
+  gen(g, "  %%left = load i64, i64* @freq.par.remaining, align 8\n");
+  gen(g, "  %%left.next = sub i64 %%left, %%count\n");
+  gen(g, "  store i64 %%left.next, i64* @freq.par.remaining, align 8\n");
+  gen(g, "  %%seen.body = load i32, i32* @freq.par.pushes, align 4\n");
+  gen(g, "  %%drained = icmp eq i64 %%left.next, 0\n");
+  gen(g, "  br i1 %%drained, label %%body.drained, label %%body.done\n");
+  // 全て終わったので、眠っているワーカーを全員起こして帰らせる
+  gen(g, "body.drained:\n");
+  gen(g, "  call i32 @pthread_cond_broadcast(i8* %%queued)\n");
+  gen(g, "  br label %%body.done\n");
+  gen(g, "body.done:\n");
+  gen(g, "  call i32 @pthread_mutex_unlock(i8* %%lock)\n");
+  gen(g, "  br label %%find\n");
+  gen(g, "exit:\n");
+  gen(g, "  call i32 @pthread_mutex_unlock(i8* %%lock)\n");
+  gen(g, "  ret void\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+
+  // ワーカー1以降のスレッド。ジョブが始まるたびに起きて手伝い、終わったらfinishedを増やして眠る
+  gen(g, "define internal i8* @freq.par.worker(i8* %%arg) nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  %%id = ptrtoint i8* %%arg to i64\n");
+  gen(g, "  %%w = trunc i64 %%id to i32\n");
+  gen(g, "  %%lock = getelementptr inbounds [%d x i8], [%d x i8]* @freq.par.lock, i64 0, i64 0\n", sync, sync);
+  gen(g, "  %%wake = getelementptr inbounds [%d x i8], [%d x i8]* @freq.par.wake, i64 0, i64 0\n", sync, sync);
+  gen(g, "  %%done = getelementptr inbounds [%d x i8], [%d x i8]* @freq.par.done, i64 0, i64 0\n", sync, sync);
+  gen(g, "  call i32 @pthread_mutex_lock(i8* %%lock)\n");
+  gen(g, "  br label %%wait\n");
+  gen(g, "wait:\n");
+  gen(g, "  %%seen = phi i32 [ 0, %%entry ], [ %%generation, %%joined ]\n");
+  gen(g, "  br label %%check\n");
+  gen(g, "check:\n");
+  gen(g, "  %%generation = load i32, i32* @freq.par.generation, align 4\n");
+  gen(g, "  %%stale = icmp eq i32 %%generation, %%seen\n");
+  gen(g, "  br i1 %%stale, label %%sleep, label %%help\n");
+  gen(g, "sleep:\n");
+  gen(g, "  call i32 @pthread_cond_wait(i8* %%wake, i8* %%lock)\n");
+  gen(g, "  br label %%check\n");
+  gen(g, "help:\n");
+  gen(g, "  call i32 @pthread_mutex_unlock(i8* %%lock)\n");
+  gen(g, "  call void @freq.par.work(i32 %%w)\n");
+  gen(g, "  call i32 @pthread_mutex_lock(i8* %%lock)\n");
+  gen(g, "  %%finished = load i32, i32* @freq.par.finished, align 4\n");
+  gen(g, "  %%finished.next = add i32 %%finished, 1\n");
+  gen(g, "  store i32 %%finished.next, i32* @freq.par.finished, align 4\n");
+  gen(g, "  %%workers = load i32, i32* @freq.par.workers, align 4\n");
+  gen(g, "  %%helpers = sub i32 %%workers, 1\n");
+  gen(g, "  %%last = icmp eq i32 %%finished.next, %%helpers\n");
+  gen(g, "  br i1 %%last, label %%notify, label %%joined\n");
+  gen(g, "notify:\n");
+  gen(g, "  call i32 @pthread_cond_signal(i8* %%done)\n");
+  gen(g, "  br label %%joined\n");
+  gen(g, "joined:\n");
+  gen(g, "  br label %%wait\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+
+  // ワーカーの数を決めてスレッドを作る。@freq.par.lockを持って呼ぶ。
+  // FREQ_THREADSがあればその数、無ければオンラインのCPUの数にする
+  gen(g, "define internal void @freq.par.start() nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  %%thread = alloca i64, align 8\n");
+  gen_string_ptr(g, "name", "freq.par.threads", "FREQ_THREADS");
+  gen(g, "  %%value = call i8* @getenv(i8* %%name)\n");
+  gen(g, "  %%unset = icmp eq i8* %%value, null\n");
+  gen(g, "  br i1 %%unset, label %%online, label %%parse\n");
+  gen(g, "parse:\n");
+  gen(g, "  %%parsed = call i32 @atoi(i8* %%value)\n");
+  gen(g, "  %%parsed.wide = sext i32 %%parsed to i64\n");
+  gen(g, "  br label %%count\n");
+  gen(g, "online:\n");
+  gen(g, "  %%cpus = call i64 @sysconf(i32 84)\n"); // _SC_NPROCESSORS_ONLN
+  gen(g, "  br label %%count\n");
+  gen(g, "count:\n");
+  gen(g, "  %%want = phi i64 [ %%parsed.wide, %%parse ], [ %%cpus, %%online ]\n");
+  gen(g, "  %%few = icmp slt i64 %%want, 1\n");
+  gen(g, "  %%at.least = select i1 %%few, i64 1, i64 %%want\n");
+  gen(g, "  %%many = icmp sgt i64 %%at.least, %d\n", limit);
+  gen(g, "  %%clamped = select i1 %%many, i64 %d, i64 %%at.least\n", limit);
+  gen(g, "  %%workers = trunc i64 %%clamped to i32\n");
+  gen(g, "  store i32 %%workers, i32* @freq.par.workers, align 4\n");
+  gen(g, "  br label %%spawn\n");
+  gen(g, "spawn:\n");
+  gen(g, "  %%i = phi i32 [ 1, %%count ], [ %%i.next, %%spawned ]\n");
+  gen(g, "  %%more = icmp slt i32 %%i, %%workers\n");
+  gen(g, "  br i1 %%more, label %%create, label %%done\n");
+  gen(g, "create:\n");
+  gen(g, "  %%i.wide = zext i32 %%i to i64\n");
+  gen(g, "  %%arg = inttoptr i64 %%i.wide to i8*\n");
+  gen(g, "  %%error = call i32 @pthread_create(i64* %%thread, i8* null, i8* (i8*)* @freq.par.worker, i8* %%arg)\n");
+  gen(g, "  %%failed = icmp ne i32 %%error, 0\n");
+  gen(g, "  br i1 %%failed, label %%shrink, label %%spawned\n");
+  gen(g, "spawned:\n");
+  gen(g, "  %%i.next = add i32 %%i, 1\n");
+  gen(g, "  br label %%spawn\n");
+  // 作れなかったら、作れた分だけで回す
+  gen(g, "shrink:\n");
+  gen(g, "  store i32 %%i, i32* @freq.par.workers, align 4\n");
+  gen(g, "  br label %%done\n");
+  gen(g, "done:\n");
+  gen(g, "  ret void\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+
+  // fn(env, lo, hi)を[lo, hi)を分けて並列に呼び、結果の合計を返す。
+  // 全てのワーカーが戻ってくるまで待つので、戻った後にenvが使われることはない。
+  // ジョブの実行中に呼ばれたとき(本体から呼んだ関数の中のparfor)は、呼んだスレッドでそのまま回す
+  gen(g, "define internal i32 @freq.par.run(i32 (i8*, i32, i32)* %%fn, i8* %%env, i32 %%lo, i32 %%hi) nounwind {\n");
+  gen(g, "entry:\n");
+  gen(g, "  %%empty = icmp sge i32 %%lo, %%hi\n");
+  gen(g, "  br i1 %%empty, label %%nothing, label %%enter\n");
+  gen(g, "nothing:\n");
+  gen(g, "  ret i32 0\n");
+  gen(g, "enter:\n");
+  gen(g, "  %%lock = getelementptr inbounds [%d x i8], [%d x i8]* @freq.par.lock, i64 0, i64 0\n", sync, sync);
+  gen(g, "  %%wake = getelementptr inbounds [%d x i8], [%d x i8]* @freq.par.wake, i64 0, i64 0\n", sync, sync);
+  gen(g, "  %%done = getelementptr inbounds [%d x i8], [%d x i8]* @freq.par.done, i64 0, i64 0\n", sync, sync);
+  gen(g, "  call i32 @pthread_mutex_lock(i8* %%lock)\n");
+  gen(g, "  %%started = load i32, i32* @freq.par.workers, align 4\n");
+  gen(g, "  %%unstarted = icmp eq i32 %%started, 0\n");
+  gen(g, "  br i1 %%unstarted, label %%start, label %%ready\n");
+  gen(g, "start:\n");
+  gen(g, "  call void @freq.par.start()\n");
+  gen(g, "  br label %%ready\n");
+  gen(g, "ready:\n");
+  gen(g, "  %%workers = load i32, i32* @freq.par.workers, align 4\n");
+  gen(g, "  %%busy = load i32, i32* @freq.par.busy, align 4\n");
+  gen(g, "  %%nested = icmp ne i32 %%busy, 0\n");
+  gen(g, "  %%alone = icmp eq i32 %%workers, 1\n");
+  gen(g, "  %%serial = or i1 %%nested, %%alone\n");
+  gen(g, "  br i1 %%serial, label %%inline, label %%parallel\n");
+  gen(g, "inline:\n");
+  gen(g, "  call i32 @pthread_mutex_unlock(i8* %%lock)\n");
+  gen(g, "  %%result.inline = call i32 %%fn(i8* %%env, i32 %%lo, i32 %%hi)\n");
+  gen(g, "  ret i32 %%result.inline\n");
+  gen(g, "parallel:\n");
+  gen(g, "  store i32 1, i32* @freq.par.busy, align 4\n");
+  gen(g, "  store i32 (i8*, i32, i32)* %%fn, i32 (i8*, i32, i32)** @freq.par.fn, align 8\n");
+  gen(g, "  store i8* %%env, i8** @freq.par.env, align 8\n");
+  gen(g, "  store i32 0, i32* @freq.par.sum, align 4\n");
+  gen(g, "  store i32 0, i32* @freq.par.finished, align 4\n");
+  gen(g, "  %%lo.wide = sext i32 %%lo to i64\n");
+  gen(g, "  %%hi.wide = sext i32 %%hi to i64\n");
+  gen(g, "  %%count = sub i64 %%hi.wide, %%lo.wide\n");
+  gen(g, "  store i64 %%count, i64* @freq.par.remaining, align 8\n");
+  gen(g, "  %%workers.wide = zext i32 %%workers to i64\n");
+  gen(g, "  %%chunks = mul i64 %%workers.wide, %d\n", PAR_CHUNKS_PER_WORKER);
+  gen(g, "  %%grain.raw = udiv i64 %%count, %%chunks\n");
+  gen(g, "  %%tiny = icmp ult i64 %%grain.raw, 1\n");
+  gen(g, "  %%grain = select i1 %%tiny, i64 1, i64 %%grain.raw\n");
+  gen(g, "  store i64 %%grain, i64* @freq.par.grain, align 8\n");
+  gen(g, "  call i1 @freq.par.push(i32 0, i32 %%lo, i32 %%hi)\n");
+  gen(g, "  %%generation = load i32, i32* @freq.par.generation, align 4\n");
+  gen(g, "  %%generation.next = add i32 %%generation, 1\n");
+  gen(g, "  store i32 %%generation.next, i32* @freq.par.generation, align 4\n");
+  gen(g, "  call i32 @pthread_cond_broadcast(i8* %%wake)\n");
+  gen(g, "  call i32 @pthread_mutex_unlock(i8* %%lock)\n");
+  gen(g, "  call void @freq.par.work(i32 0)\n");
+  gen(g, "  call i32 @pthread_mutex_lock(i8* %%lock)\n");
+  gen(g, "  %%helpers = sub i32 %%workers, 1\n");
+  gen(g, "  br label %%join\n");
+  gen(g, "join:\n");
+  gen(g, "  %%finished = load i32, i32* @freq.par.finished, align 4\n");
+  gen(g, "  %%all = icmp eq i32 %%finished, %%helpers\n");
+  gen(g, "  br i1 %%all, label %%collect, label %%sleep\n");
+  gen(g, "sleep:\n");
+  gen(g, "  call i32 @pthread_cond_wait(i8* %%done, i8* %%lock)\n");
+  gen(g, "  br label %%join\n");
+  gen(g, "collect:\n");
+  gen(g, "  %%sum = load i32, i32* @freq.par.sum, align 4\n");
+  gen(g, "  store i32 0, i32* @freq.par.busy, align 4\n");
+  gen(g, "  call i32 @pthread_mutex_unlock(i8* %%lock)\n");
+  gen(g, "  ret i32 %%sum\n");
+  gen(g, "}\n");
+  gen(g, "\n");
+}
+
+// 終了時に呼ぶ関数。printのバッファを吐き出し、計装していればプロファイルを書き、
+// プロファイラを有効にしていれば結果を出す
+static void generate_dtors(CodeGen* g) {
+  const char* dtors[3];
+  size_t size = 0;
+  dtors[size++] = "freq.flush";
+  if( g->instrument ) dtors[size++] = "freq.prof.dump";
+  if( g->profiler ) dtors[size++] = "freq.cyc.report";
+  gen(g, "@llvm.global_dtors = appending global [%zu x { i32, void ()*, i8* }] [", size);
+  for( size_t i = 0; i < size; ++i ) {
+    gen(g, "%s{ i32, void ()*, i8* } { i32 65535, void ()* @%s, i8* null }", i ? ", " : "", dtors[i]);
+  }
+  gen(g, "]\n");
+}
+
+void generate_prologue(CodeGen* g) {
   generate_header(g);
+}
+
+// genは関数として出さずに覚えておいて、forで回すところに展開する
+static void add_gen(CodeGen* g, AST* ast) {
+  GenFunc* entry = (GenFunc*)arena_alloc(g->arena, sizeof(GenFunc));
+  entry->ast = ast;
+  entry->next = NULL;
+  GenFunc** tail = &g->gens;
+  while( *tail ) tail = &(*tail)->next;
+  *tail = entry;
+}
+
+bool generate_function(CodeGen* g, AST* func) {
+  if( func->type == ST_GEN ) add_gen(g, func);
+  else generate_func(g, func);
+  return !g->error->failed;
+}
 
-  size_t result_reg;
+bool generate_epilogue(CodeGen* g) {
+  generate_stdio(g);
+  generate_profile_dump(g);
+  generate_profiler(g);
+  generate_parallel(g);
+  generate_dtors(g);
+  generate_metadata(g);
+  return !g->error->failed;
+}
+
+bool generate_code(CodeGen* g, AST* root) {
+  generate_prologue(g);
+  // genは使うところより後ろに書かれていてもよいので、先に全部覚えておく
+  for( AST** current = root->children; *current; ++current ) {
+    if( (*current)->type == ST_GEN ) add_gen(g, *current);
+  }
   for( AST** current = root->children; *current; ++current ) {
-    generate_func(g, *current);
+    if( (*current)->type == ST_FUNC && !generate_function(g, *current) ) return false;
   }
+  return generate_epilogue(g);
 }
 
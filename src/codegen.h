@@ -3,13 +3,110 @@
 #include <stdbool.h>
 
 #include "parser.h"
+#include "profile.h"
+
+#define MAX_LOCALS 1024
+// 両腕をselectで計算するifの、両腕のコストの合計の上限の既定値
+#define SELECT_DEFAULT_COST (8)
+
+typedef enum {
+  MD_LOOP,            // forの!llvm.loop。aがunroll、bがvectorize(0ならヒント無し)
+  MD_BRANCH_WEIGHTS,  // 分岐の!prof。aがtrue、bがfalseの重み
+  MD_ENTRY_COUNT,     // 関数の!prof。aが呼ばれた回数
+} MetadataType;
+
+// 最後にまとめて出すmetadata
+typedef struct tMetadataNode {
+  MetadataType type;
+  size_t id;
+  uint64_t a;
+  uint64_t b;
+  struct tMetadataNode* next;
+} MetadataNode;
+
+// 出力した関数。PGOのプロファイルやプロファイラの表を最後に作るときに使う
+typedef struct tEmittedFunc {
+  Token* name;
+  size_t id;       // 出力した順の番号
+  size_t counters;
+  struct tEmittedFunc* next;
+} EmittedFunc;
+
+// 関数の外に切り出すparforの本体。今の関数を出し終えてから別の関数として出す
+typedef struct tParLoop {
+  AST* ast;
+  size_t id;       // モジュール全体での通し番号
+  bool counting;   // 本体の分岐を数えるか。展開したgenの中のparforなら数えない
+  struct tParLoop* next;
+} ParLoop;
+
+// genの定義。関数としては出さずに、forで回すところに本体を展開する
+typedef struct tGenFunc {
+  AST* ast;
+  struct tGenFunc* next;
+} GenFunc;
+
+// 展開しているgenの本体から見た、それを回しているfor
+typedef struct tGenSite {
+  AST* gen;
+  AST* loop;                 // ST_FOREACH
+  struct tGenSite* outer;    // forを書いたところが別のgenの本体なら、そのgenのfor
+  size_t scope;              // forを書いたところの変数の番号
+  size_t id;                 // 展開したgenの変数の番号。yieldが渡す値と再開する先もこの番号で置く
+  bool counting;             // forを書いたところで分岐を数えるか
+  size_t exit_label;         // genの本体が終わったら抜ける先
+  size_t body_label;         // forの本体。yieldはここへ飛ぶ
+  bool shared;               // yieldが2つ以上あるか、外側のgenがそうなら。forの本体に何箇所からも来るので、
+                             // yieldをまたぐ値はallocaに置く
+  size_t value;              // sharedでなければ、yieldした値のレジスタ
+  size_t* resumes;           // yieldの直後のラベル。forの本体の最後にswitchでここへ戻る
+  size_t resumes_size;
+  size_t resumes_capacity;
+} GenSite;
 
 typedef struct {
-  FILE* output;
+  Arena* arena;
+  Buffer* output;
+  Error* error;
   size_t index;
   size_t label_index;
+  size_t block_label; // 今命令を出しているblockのラベル
+  Token* locals[MAX_LOCALS];
+  size_t local_scopes[MAX_LOCALS];
+  size_t locals_size;
+  size_t locals_pos;         // 次のallocaを差し込む位置。今出している関数のentry blockの中
+  GenFunc* gens;
+  GenSite* gen_site;         // 展開しているgenの本体を出しているなら、それを回しているfor
+  size_t scope;              // 変数の名前に付ける番号。関数自身の変数なら0、展開したgenの変数なら1から
+  size_t gen_scopes;         // 今の関数で展開したgenの数。展開するたびに変数の番号を新しくする
+  bool counting;             // 今出しているコードの分岐にこの関数の番号が振ってあるか
+  MetadataNode* metadata;
+  MetadataNode* metadata_tail;
+  size_t metadata_index;
+  const char* instrument;    // 計装するならプロファイルの書き出し先
+  EmittedFunc* funcs;
+  EmittedFunc* funcs_tail;
+  size_t funcs_size;
+  Profile* profile;          // 分岐の重みに使うプロファイル
+  FuncProfile* func_profile; // 今出している関数のプロファイル
+  Token* func_name;
+  size_t counters;           // 今出している関数のカウンタの数
+  bool profiler;             // 関数ごとの呼び出し回数とサイクル数を測って、終了時に表示する
+  const char* stacks;        // プロファイラのcollapsed stackの書き出し先
+  bool memoize;              // 副作用の無い再帰関数の結果をメモ化する
+  size_t memo_args;          // 今出している関数をメモ化するなら引数の数。しないなら0
+  ParLoop* parloops;         // 今出している関数のparfor
+  ParLoop* parloops_tail;
+  size_t parloops_size;      // モジュール全体のparforの数
+  size_t par_env;            // 今出している関数のparforが外から受け取る変数の数の最大
+  size_t select_cost;        // ifを分岐せずselectで出す両腕のコストの上限。0ならしない
   bool debug;
 } CodeGen;
 
-CodeGen* create_codegen(FILE* output, bool debug);
-void generate_code(CodeGen* gen, AST* root);
+CodeGen* create_codegen(Arena* arena, Buffer* output, Error* error, bool debug);
+bool generate_code(CodeGen* gen, AST* root);
+// generate_codeを関数ごとに分けたもの。先頭の宣言、関数を1つずつ、最後に全体の表の順に呼ぶ。
+// 関数をまたいで持つものはgenのarenaに置くので、渡した関数のASTは出し終えたら捨ててよい
+void generate_prologue(CodeGen* gen);
+bool generate_function(CodeGen* gen, AST* func);
+bool generate_epilogue(CodeGen* gen);
@@ -0,0 +1,182 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "effect.h"
+#include "eval.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "codegen.h"
+#include "bitcode.h"
+
+void init_compiler(Compiler* c, bool debug, bool bitcode) {
+  init_arena(&c->arena);
+  init_arena(&c->module_arena);
+  init_buffer(&c->ir);
+  init_buffer(&c->output);
+  init_error(&c->error);
+  c->debug = debug;
+  c->bitcode = bitcode;
+  c->instrument = NULL;
+  init_arena(&c->profile_arena);
+  c->profile = NULL;
+  c->profiler = false;
+  c->stacks = NULL;
+  c->memoize = true;
+  c->select_cost = SELECT_DEFAULT_COST;
+  c->threads = 1;
+}
+
+// 呼び出し側の文字列はコンパイルまで生きているとは限らないのでコピーして持つ
+static void replace_string(char** dst, const char* src) {
+  free(*dst);
+  *dst = NULL;
+  if( src ) {
+    *dst = (char*)malloc(strlen(src) + 1);
+    strcpy(*dst, src);
+  }
+}
+
+void set_instrument(Compiler* c, const char* path) {
+  replace_string(&c->instrument, path);
+}
+
+void set_profiler(Compiler* c, bool enabled, const char* stacks) {
+  c->profiler = enabled;
+  replace_string(&c->stacks, enabled ? stacks : NULL);
+}
+
+bool set_profile(Compiler* c, const char* text, size_t len) {
+  reset_arena(&c->profile_arena);
+  c->profile = NULL;
+  if( !text ) return true;
+
+  init_error(&c->error);
+  // 関数名はテキストを指すので、呼び出し側のバッファではなく手元にコピーしておく
+  char* copy = (char*)arena_alloc(&c->profile_arena, len + 1);
+  memcpy(copy, text, len);
+  copy[len] = '\0';
+  Profile* profile = (Profile*)arena_alloc(&c->profile_arena, sizeof(Profile));
+  if( !parse_profile(&c->profile_arena, copy, len, profile, &c->error) ) return false;
+  c->profile = profile;
+  return true;
+}
+
+// compileとcompile_streamで共通のコード生成の設定
+static CodeGen* create_compiler_codegen(Compiler* c, Arena* arena, Buffer* output) {
+  CodeGen* gen = create_codegen(arena, output, &c->error, c->debug && !c->bitcode);
+  gen->instrument = c->instrument;
+  gen->profile = c->profile;
+  gen->profiler = c->profiler;
+  gen->stacks = c->stacks;
+  gen->memoize = c->memoize;
+  gen->select_cost = c->select_cost;
+  return gen;
+}
+
+bool compile(Compiler* c, const char* source, size_t len) {
+  // 前回の結果を捨てる。確保済みの領域はそのまま
+  reset_arena(&c->arena);
+  clear_buffer(&c->ir);
+  clear_buffer(&c->output);
+  init_error(&c->error);
+
+  // 入力からTokenを作成。スレッド数が0ならCPUの数だけ使う
+  size_t threads = c->threads;
+  if( threads == 0 ) {
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (size_t)online : 1;
+  }
+  Token* token = tokenize_parallel(&c->arena, source, len, threads, &c->error);
+  if( !token ) return false;
+  if( c->debug ) print_tokens(token);
+
+  // TokenをASTに変換
+  Parser* parser = parse(&c->arena, token, &c->error);
+  if( !parser ) return false;
+  if( c->debug ) {
+    for( AST** node = parser->ast->children; *node; ++node )
+      print_ast(*node, 0);
+  }
+
+  // 関数の副作用を調べる。メモ化できる関数を決めたり、parforの本体を確かめるのに使う
+  if( !analyze_effects(&c->arena, parser->ast, &c->error) ) return false;
+  // 副作用の無い関数を定数で呼んでいるところはコンパイル時に計算しておく
+  evaluate_constants(&c->arena, parser->ast);
+
+  // コード生成
+  // bitcodeなら一旦テキストのIRを出して、それを変換する
+  CodeGen* gen = create_compiler_codegen(c, &c->arena, c->bitcode ? &c->ir : &c->output);
+  if( !generate_code(gen, parser->ast) ) return false;
+  if( !c->bitcode ) return true;
+
+  return write_bitcode(&c->arena, c->ir.data, c->ir.size, &c->output, &c->error);
+}
+
+// 出来たところまでを書き出して空にする
+static bool flush_output(Compiler* c, OutputWriter write, void* user) {
+  if( c->output.size && !write(user, c->output.data, c->output.size) ) {
+    set_error(&c->error, 0, "出力に書き込めませんでした。");
+    return false;
+  }
+  clear_buffer(&c->output);
+  return true;
+}
+
+bool compile_stream(Compiler* c, const char* source, size_t len, OutputWriter write, void* user) {
+  reset_arena(&c->arena);
+  reset_arena(&c->module_arena);
+  clear_buffer(&c->output);
+  init_error(&c->error);
+  if( c->bitcode ) {
+    set_error(&c->error, 0, "bitcodeは関数ごとに出力できません。");
+    return false;
+  }
+
+  // tokenizerとparserの状態はarenaの先頭に置き、関数ごとのtokenとASTはその後ろに確保して毎回捨てる
+  Tokenizer* tokenizer = create_tokenizer(&c->arena, source, len, &c->error);
+  Parser* parser = create_stream_parser(&c->arena, tokenizer, &c->error);
+  // 出した関数の副作用と、最後に出す表の材料は関数をまたいで持つ
+  EffectTable* effects = create_effect_table(&c->module_arena);
+  CodeGen* gen = create_compiler_codegen(c, &c->module_arena, &c->output);
+  // メモ化するかは呼び出しグラフ全体を見ないと決められない
+  gen->memoize = false;
+
+  generate_prologue(gen);
+  if( !flush_output(c, write, user) ) return false;
+  ArenaMark mark = arena_mark(&c->arena);
+  AST* func;
+  while( (func = parse_next_func(parser)) ) {
+    if( c->debug ) print_ast(func, 0);
+    // 同名の関数は先に書かれた方を使う
+    if( !has_effect_summary(effects, func->token) ) {
+      if( !analyze_function_effects(&c->arena, func, effects, &c->error) ) return false;
+      if( !generate_function(gen, func) ) return false;
+      if( !flush_output(c, write, user) ) return false;
+      // genは後ろの関数に展開するので、tokenとASTを捨てずに残す
+      if( func->type == ST_GEN ) {
+        mark = arena_mark(&c->arena);
+        continue;
+      }
+    }
+    arena_release(&c->arena, mark);
+  }
+  if( c->error.failed ) return false;
+
+  if( !generate_epilogue(gen) ) return false;
+  return flush_output(c, write, user);
+}
+
+void free_compiler(Compiler* c) {
+  free(c->instrument);
+  free(c->stacks);
+  free_arena(&c->profile_arena);
+  free_arena(&c->arena);
+  free_arena(&c->module_arena);
+  free_buffer(&c->ir);
+  free_buffer(&c->output);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "profile.h"
+#include "util.h"
+
+// 1回のコンパイルに必要なものをまとめたもの。
+// 同じCompilerで何度もcompileすると、ArenaやBufferの領域はそのまま使い回される。
+typedef struct {
+  Arena arena;
+  Arena module_arena;    // compile_streamで関数をまたいで持つもの
+  Buffer ir;      // bitcodeを出すときの中間のテキストIR
+  Buffer output;  // コンパイル結果(IRかbitcode)
+  Error error;
+  bool debug;
+  bool bitcode;
+  char* instrument;      // 計装するならプロファイルの書き出し先
+  Arena profile_arena;   // プロファイルはコンパイルをまたいで持つので別のArenaに置く
+  Profile* profile;
+  bool profiler;         // 実行時に関数ごとのサイクル数を測る
+  char* stacks;          // プロファイラのcollapsed stackの書き出し先
+  bool memoize;          // 副作用の無い再帰関数をメモ化する
+  size_t select_cost;    // ifをselectで出す両腕のコストの上限。0ならしない
+  size_t threads;        // 大きな入力を字句解析するスレッドの数。0ならCPUの数
+} Compiler;
+
+void init_compiler(Compiler* compiler, bool debug, bool bitcode);
+// 成功したらoutputに結果が入る。失敗したらerrorに理由が入ってfalseを返す。
+bool compile(Compiler* compiler, const char* source, size_t len);
+// compile_streamの出力先。falseを返したらコンパイルをやめる
+typedef bool (*OutputWriter)(void* user, const char* data, size_t size);
+// 関数を1つparseするたびにコードを生成してwriteに渡し、その関数のtokenとASTを捨てる。
+// 全体を見ないとできないこと(mainから使われない関数の省略、メモ化、コンパイル時の評価)はしない。
+// bitcodeは出せない。失敗したときも、それまでの関数の分は書き終えている
+bool compile_stream(Compiler* compiler, const char* source, size_t len, OutputWriter write, void* user);
+// pathがNULLなら計装をやめる
+void set_instrument(Compiler* compiler, const char* path);
+// 計装したプログラムが書き出したプロファイルを読む。textがNULLなら捨てる
+bool set_profile(Compiler* compiler, const char* text, size_t len);
+// enabledならプロファイラを埋め込む。stacksがNULLでなければcollapsed stackも書き出す
+void set_profiler(Compiler* compiler, bool enabled, const char* stacks);
+void free_compiler(Compiler* compiler);
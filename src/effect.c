@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "effect.h"
+
+// 呼び出しグラフの頂点
+typedef struct {
+  AST* ast;
+  size_t* callees;   // 呼び出し先の関数の番号
+  size_t callees_size;
+  bool impure;
+  bool parallel;     // parforの本体から呼ばれる
+  // Tarjanの強連結成分分解で使う
+  size_t index;
+  size_t low;
+  bool visited;
+  bool on_stack;
+} Node;
+
+typedef struct {
+  Node* nodes;
+  Node** sorted; // 名前順
+  size_t size;
+  EffectTable* known; // 先に調べ終えた関数。NULLなら無し
+  size_t* stack;
+  size_t stack_size;
+  size_t next_index;
+} Graph;
+
+static int compare_node(const void* lhs, const void* rhs) {
+  return compare_tokens((*(Node* const*)lhs)->ast->token, (*(Node* const*)rhs)->ast->token);
+}
+
+static Node* find_node(Graph* graph, Token* name) {
+  size_t lo = 0;
+  size_t hi = graph->size;
+  while( lo < hi ) {
+    const size_t mid = (lo + hi) / 2;
+    const int c = compare_tokens(name, graph->sorted[mid]->ast->token);
+    if( c == 0 ) return graph->sorted[mid];
+    if( c < 0 ) hi = mid;
+    else lo = mid + 1;
+  }
+  return NULL;
+}
+
+// astの中の呼び出しを数える
+static size_t count_calls(AST* ast) {
+  if( ast == NULL ) return 0;
+  size_t size = ast->type == ST_CALL ? 1 : 0;
+  for( AST** child = ast->children; *child; ++child )
+    size += count_calls(*child);
+  return size;
+}
+
+static size_t hash_name(Token* name) {
+  size_t h = 14695981039346656037ULL;
+  for( size_t i = 0; i < name->len; ++i )
+    h = (h ^ (unsigned char)name->buffer[name->pos + i]) * 1099511628211ULL;
+  return h % EFFECT_TABLE_SIZE;
+}
+
+static EffectSummary* find_summary(EffectTable* table, Token* name) {
+  if( table == NULL ) return NULL;
+  for( EffectSummary* s = table->buckets[hash_name(name)]; s; s = s->next ) {
+    if( token_equals(&s->name, name) ) return s;
+  }
+  return NULL;
+}
+
+// グラフに無い関数を呼んでも副作用が無いと言えるか。先に調べた関数で副作用が無いものだけ
+static bool known_pure(Graph* graph, Token* name) {
+  EffectSummary* s = find_summary(graph->known, name);
+  return s && s->pure;
+}
+
+// 呼び出し先を辺として足す。定義の無い関数を呼んでいたら副作用あり
+static void collect_calls(Graph* graph, Node* node, AST* ast) {
+  if( ast == NULL ) return;
+  if( ast->type == ST_CALL ) {
+    Node* callee = find_node(graph, ast->token);
+    if( callee ) node->callees[node->callees_size++] = (size_t)(callee - graph->nodes);
+    else if( !known_pure(graph, ast->token) ) node->impure = true;
+  }
+  for( AST** child = ast->children; *child; ++child )
+    collect_calls(graph, node, *child);
+}
+
+// 強連結成分が2つ以上の関数からなるか、自分自身を直接呼んでいれば再帰している
+static void find_recursion(Graph* graph, size_t v) {
+  Node* node = &graph->nodes[v];
+  node->index = node->low = graph->next_index++;
+  node->visited = true;
+  node->on_stack = true;
+  graph->stack[graph->stack_size++] = v;
+
+  bool self_call = false;
+  for( size_t i = 0; i < node->callees_size; ++i ) {
+    const size_t w = node->callees[i];
+    Node* callee = &graph->nodes[w];
+    if( w == v ) self_call = true;
+    if( !callee->visited ) {
+      find_recursion(graph, w);
+      if( callee->low < node->low ) node->low = callee->low;
+    } else if( callee->on_stack && callee->index < node->low ) {
+      node->low = callee->index;
+    }
+  }
+  if( node->low != node->index ) return;
+
+  // vが成分の根なので、スタックから成分を取り出す
+  size_t start = graph->stack_size;
+  do {
+    --start;
+  } while( graph->stack[start] != v );
+  const bool recursive = self_call || graph->stack_size - start > 1;
+  for( size_t i = start; i < graph->stack_size; ++i ) {
+    Node* member = &graph->nodes[graph->stack[i]];
+    member->on_stack = false;
+    if( recursive ) member->ast->val |= EFFECT_RECURSIVE;
+  }
+  graph->stack_size = start;
+}
+
+// astの中でnameがletで宣言されているか
+static bool declares(AST* ast, Token* name) {
+  if( ast == NULL ) return false;
+  if( ast->type == ST_LET && token_equals(get_lhs(ast)->token, name) ) return true;
+  for( AST** child = ast->children; *child; ++child ) {
+    if( declares(*child, name) ) return true;
+  }
+  return false;
+}
+
+// parforの本体astを調べる。各回は別のスレッドで走るので、回どうしで干渉するものは書けない。
+// 本体から呼ばれる関数には印を付けておく
+static void check_parallel(Graph* graph, AST* loop, AST* ast, Error* error) {
+  if( ast == NULL || error->failed ) return;
+  Token* tok = ast->token;
+  switch( ast->type ) {
+    case ST_RETURN:
+      set_error(error, tok->pos, "parforの中ではreturnできません(%zu文字目)。", tok->pos);
+      return;
+    case ST_PARFOR:
+      set_error(error, tok->pos, "parforの中にparforは書けません(%zu文字目)。", tok->pos);
+      return;
+    case ST_YIELD:
+      // 本体は別の関数に切り出されるので、genのforに戻れない
+      set_error(error, tok->pos, "parforの中ではyieldできません(%zu文字目)。", tok->pos);
+      return;
+    case ST_ASSIGN: {
+      // 代入できるのは各回に固有の変数だけ
+      Token* name = get_lhs(ast)->token;
+      if( !token_equals(name, get_lhs(loop)->token) && !declares(loop->children[3], name) ) {
+        set_error(error, name->pos, "parforの中から外の変数'%.*s'(%zu文字目)には代入できません。",
+          (int)name->len, name->buffer + name->pos, name->pos);
+        return;
+      }
+      break;
+    }
+    case ST_CALL: {
+      Node* callee = find_node(graph, tok);
+      if( callee ? callee->impure : !known_pure(graph, tok) ) {
+        set_error(error, tok->pos, "parforの中では副作用のある関数'%.*s'(%zu文字目)を呼べません。",
+          (int)tok->len, tok->buffer + tok->pos, tok->pos);
+        return;
+      }
+      if( callee ) callee->parallel = true;
+      break;
+    }
+    default:
+      break;
+  }
+  for( AST** child = ast->children; *child; ++child )
+    check_parallel(graph, loop, *child, error);
+}
+
+// 関数の本体astの中のparforを探して調べる
+static void find_parallel(Graph* graph, AST* ast, Error* error) {
+  if( ast == NULL ) return;
+  if( ast->type == ST_PARFOR ) {
+    find_parallel(graph, ast->children[1], error);
+    find_parallel(graph, ast->children[2], error);
+    check_parallel(graph, ast, ast->children[3], error);
+    return;
+  }
+  for( AST** child = ast->children; *child; ++child )
+    find_parallel(graph, *child, error);
+}
+
+// funcs[0..size)の関数を調べる。knownにある関数は呼び出し先として使うだけで、印は付けない
+static bool analyze(Arena* arena, AST** funcs, size_t size, EffectTable* known, Error* error) {
+  Graph graph;
+  graph.size = size;
+  graph.known = known;
+  if( graph.size == 0 ) return true;
+
+  graph.nodes = (Node*)arena_alloc(arena, sizeof(Node) * graph.size);
+  graph.sorted = (Node**)arena_alloc(arena, sizeof(Node*) * graph.size);
+  graph.stack = (size_t*)arena_alloc(arena, sizeof(size_t) * graph.size);
+  graph.stack_size = 0;
+  graph.next_index = 0;
+  for( size_t i = 0; i < graph.size; ++i ) {
+    Node* node = &graph.nodes[i];
+    memset(node, 0, sizeof(Node));
+    node->ast = funcs[i];
+    node->ast->val = 0;
+    graph.sorted[i] = node;
+  }
+  qsort(graph.sorted, graph.size, sizeof(Node*), compare_node);
+
+  for( size_t i = 0; i < graph.size; ++i ) {
+    Node* node = &graph.nodes[i];
+    AST* body = get_rhs(node->ast);
+    const size_t calls = count_calls(body);
+    node->callees = (size_t*)arena_alloc(arena, sizeof(size_t) * (calls ? calls : 1));
+    collect_calls(&graph, node, body);
+  }
+
+  // 副作用のある関数を呼ぶ関数にも副作用がある。変わらなくなるまで広げる
+  for( bool changed = true; changed; ) {
+    changed = false;
+    for( size_t i = 0; i < graph.size; ++i ) {
+      Node* node = &graph.nodes[i];
+      if( node->impure ) continue;
+      for( size_t j = 0; j < node->callees_size; ++j ) {
+        if( graph.nodes[node->callees[j]].impure ) {
+          node->impure = true;
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  for( size_t i = 0; i < graph.size; ++i ) {
+    if( !graph.nodes[i].visited ) find_recursion(&graph, i);
+    if( !graph.nodes[i].impure ) graph.nodes[i].ast->val |= EFFECT_PURE;
+  }
+
+  for( size_t i = 0; i < graph.size && !error->failed; ++i )
+    find_parallel(&graph, get_rhs(graph.nodes[i].ast), error);
+  if( error->failed ) return false;
+
+  // parforから呼ばれる関数が呼ぶ関数も、並列に呼ばれる
+  for( bool changed = true; changed; ) {
+    changed = false;
+    for( size_t i = 0; i < graph.size; ++i ) {
+      Node* node = &graph.nodes[i];
+      if( !node->parallel ) continue;
+      for( size_t j = 0; j < node->callees_size; ++j ) {
+        Node* callee = &graph.nodes[node->callees[j]];
+        if( callee->parallel ) continue;
+        callee->parallel = true;
+        changed = true;
+      }
+    }
+  }
+  for( size_t i = 0; i < graph.size; ++i ) {
+    if( graph.nodes[i].parallel ) graph.nodes[i].ast->val |= EFFECT_PARALLEL;
+  }
+  return true;
+}
+
+bool analyze_effects(Arena* arena, AST* root, Error* error) {
+  size_t size = 0;
+  while( root->children[size] ) ++size;
+  return analyze(arena, root->children, size, NULL, error);
+}
+
+EffectTable* create_effect_table(Arena* arena) {
+  EffectTable* table = (EffectTable*)arena_alloc(arena, sizeof(EffectTable));
+  table->arena = arena;
+  memset(table->buckets, 0, sizeof(table->buckets));
+  return table;
+}
+
+bool has_effect_summary(EffectTable* table, Token* name) {
+  return find_summary(table, name) != NULL;
+}
+
+bool analyze_function_effects(Arena* arena, AST* func, EffectTable* table, Error* error) {
+  if( !analyze(arena, &func, 1, table, error) ) return false;
+  EffectSummary* s = (EffectSummary*)arena_alloc(table->arena, sizeof(EffectSummary));
+  s->name = *func->token;
+  s->name.next = NULL;
+  s->pure = (func->val & EFFECT_PURE) != 0;
+  const size_t h = hash_name(func->token);
+  s->next = table->buckets[h];
+  table->buckets[h] = s;
+  return true;
+}
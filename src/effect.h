@@ -0,0 +1,37 @@
+#pragma once
+
+#include "parser.h"
+#include "util.h"
+
+// analyze_effectsがST_FUNCのvalに入れる関数の性質
+#define EFFECT_PURE      (1 << 0) // print/readなどを(間接的にも)呼ばない。同じ引数なら同じ結果になる
+#define EFFECT_RECURSIVE (1 << 1) // 自分自身を(間接的にも)呼ぶ
+#define EFFECT_PARALLEL  (1 << 2) // parforの本体から(間接的にも)呼ばれる。複数のスレッドから同時に呼ばれうる
+
+// rootの関数の呼び出し関係を調べて、それぞれのST_FUNCのvalにEFFECT_*を入れる。
+// 定義の見つからない関数(組み込み関数を含む)を呼ぶ関数は副作用があるものとする。
+// parforの本体が並列に実行できないもの(return、yield、副作用のある呼び出し、外の変数への代入、
+// parforの入れ子)を含んでいればerrorに入れてfalseを返す。genもforで回す関数と同じように扱う。
+bool analyze_effects(Arena* arena, AST* root, Error* error);
+
+// 関数を1つずつ調べるときに、それまでに調べた関数に副作用があったかを覚えておく表。
+// 関数のASTを捨てても使えるように、名前のtokenは写して持つ
+#define EFFECT_TABLE_SIZE (1024)
+
+typedef struct tEffectSummary {
+  Token name;
+  bool pure;
+  struct tEffectSummary* next;
+} EffectSummary;
+
+typedef struct {
+  Arena* arena;
+  EffectSummary* buckets[EFFECT_TABLE_SIZE];
+} EffectTable;
+
+EffectTable* create_effect_table(Arena* arena);
+// 同じ名前の関数をもう調べたか
+bool has_effect_summary(EffectTable* table, Token* name);
+// funcだけを調べてtableに足す。まだ調べていない関数(後ろに書かれた関数)の呼び出しは副作用ありとみなす。
+// 一時的な領域はarenaから、tableに足すものはtableのarenaから確保する
+bool analyze_function_effects(Arena* arena, AST* func, EffectTable* table, Error* error);
@@ -0,0 +1,277 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eval.h"
+#include "effect.h"
+
+// 全ての呼び出しのローカル変数を置く領域の大きさ
+#define EVAL_STACK_SIZE (65536)
+
+typedef struct {
+  Token* name;   // 評価し終えて呼び出しを待っている引数ならNULL
+  int32_t value;
+} Binding;
+
+// 評価中の関数呼び出し1つ分。変数はstackのbaseから上に積む
+typedef struct {
+  size_t base;
+  bool returned;
+  int32_t result;
+} Frame;
+
+typedef struct {
+  AST** funcs;      // 名前順
+  size_t funcs_size;
+  Binding* stack;
+  size_t stack_size;
+  size_t steps;     // 今の呼び出しで使える残りの手数
+  size_t total;     // コンパイル全体で使える残りの手数
+  size_t depth;
+} Evaluator;
+
+static int compare_func(const void* lhs, const void* rhs) {
+  return compare_tokens((*(AST* const*)lhs)->token, (*(AST* const*)rhs)->token);
+}
+
+static AST* find_func(Evaluator* e, Token* name) {
+  size_t lo = 0;
+  size_t hi = e->funcs_size;
+  while( lo < hi ) {
+    const size_t mid = (lo + hi) / 2;
+    const int c = compare_tokens(name, e->funcs[mid]->token);
+    if( c == 0 ) return e->funcs[mid];
+    if( c < 0 ) hi = mid;
+    else lo = mid + 1;
+  }
+  return NULL;
+}
+
+static Binding* lookup(Evaluator* e, Frame* f, Token* name) {
+  for( size_t i = f->base; i < e->stack_size; ++i ) {
+    if( e->stack[i].name && token_equals(e->stack[i].name, name) ) return &e->stack[i];
+  }
+  return NULL;
+}
+
+static bool push(Evaluator* e, Token* name, int32_t value) {
+  if( e->stack_size >= EVAL_STACK_SIZE ) return false;
+  Binding* b = &e->stack[e->stack_size++];
+  b->name = name;
+  b->value = value;
+  return true;
+}
+
+// 変数に値を入れる。初めてなら作る
+static bool bind(Evaluator* e, Frame* f, Token* name, int32_t value) {
+  Binding* b = lookup(e, f, name);
+  if( !b ) return push(e, name, value);
+  b->value = value;
+  return true;
+}
+
+// ST_NUMの値がi32に収まっていればそれを使う
+static bool literal(AST* ast, int32_t* out) {
+  if( ast->val < INT32_MIN || ast->val > INT32_MAX ) return false;
+  *out = (int32_t)ast->val;
+  return true;
+}
+
+// 生成されるコードと同じく、i32で桁あふれを折り返す
+static bool arithmetic(SyntaxType type, int32_t lhs, int32_t rhs, int32_t* out) {
+  switch( type ) {
+    case ST_ADD: *out = (int32_t)((uint32_t)lhs + (uint32_t)rhs); return true;
+    case ST_SUB: *out = (int32_t)((uint32_t)lhs - (uint32_t)rhs); return true;
+    case ST_MUL: *out = (int32_t)((uint32_t)lhs * (uint32_t)rhs); return true;
+    case ST_DIV:
+      // 実行時にトラップするものはそのまま残す
+      if( rhs == 0 || (lhs == INT32_MIN && rhs == -1) ) return false;
+      *out = lhs / rhs;
+      return true;
+    case ST_EQUAL: *out = lhs == rhs; return true;
+    case ST_NOT_EQUAL: *out = lhs != rhs; return true;
+    case ST_LT: *out = lhs < rhs; return true;
+    case ST_LTEQ: *out = lhs <= rhs; return true;
+    case ST_GT: *out = lhs > rhs; return true;
+    case ST_GTEQ: *out = lhs >= rhs; return true;
+    default: return false;
+  }
+}
+
+static bool call(Evaluator* e, AST* func, size_t base, int32_t* out);
+
+// astを評価する。評価できなければfalse。returnを評価したらf->returnedが立つ
+static bool eval(Evaluator* e, Frame* f, AST* ast, int32_t* out) {
+  if( e->steps == 0 || e->total == 0 ) return false;
+  --e->steps;
+  --e->total;
+
+  switch( ast->type ) {
+    case ST_NUM:
+      return literal(ast, out);
+    case ST_VAR: {
+      Binding* b = lookup(e, f, ast->token);
+      if( !b ) return false;
+      *out = b->value;
+      return true;
+    }
+    case ST_LET:
+    case ST_ASSIGN: {
+      AST* rhs = get_rhs(ast);
+      if( rhs ) {
+        int32_t value;
+        if( !eval(e, f, rhs, &value) ) return false;
+        if( f->returned ) return true;
+        if( !bind(e, f, get_lhs(ast)->token, value) ) return false;
+      }
+      // 初期化していない変数は読めない
+      Binding* b = lookup(e, f, get_lhs(ast)->token);
+      if( !b ) return false;
+      *out = b->value;
+      return true;
+    }
+    case ST_CALL: {
+      AST* func = find_func(e, ast->token);
+      if( !func || func->type != ST_FUNC || !(func->val & EFFECT_PURE) ) return false;
+      // 引数は評価した順にstackに積んでおき、そのまま呼び出し先の引数にする
+      const size_t base = e->stack_size;
+      for( AST** arg = ast->children; *arg; ++arg ) {
+        int32_t value;
+        if( !eval(e, f, *arg, &value) || !push(e, NULL, value) ) return false;
+        if( f->returned ) return true;
+      }
+      return call(e, func, base, out);
+    }
+    case ST_RETURN: {
+      int32_t value;
+      if( !eval(e, f, get_lhs(ast), &value) ) return false;
+      if( f->returned ) return true;
+      f->returned = true;
+      f->result = value;
+      *out = value;
+      return true;
+    }
+    case ST_IF: {
+      int32_t cond;
+      if( !eval(e, f, ast->children[0], &cond) ) return false;
+      if( f->returned ) return true;
+      return eval(e, f, ast->children[cond ? 1 : 2], out);
+    }
+    case ST_LOOP: {
+      // 本体の値が0になるまで繰り返す
+      do {
+        if( !eval(e, f, ast->children[0], out) ) return false;
+        if( f->returned ) return true;
+      } while( *out != 0 );
+      return true;
+    }
+    case ST_FOR: {
+      int32_t from, to;
+      if( !eval(e, f, ast->children[1], &from) ) return false;
+      if( f->returned ) return true;
+      if( !eval(e, f, ast->children[2], &to) ) return false;
+      if( f->returned ) return true;
+      for( int32_t i = from; i < to; ++i ) {
+        if( !bind(e, f, get_lhs(ast)->token, i) ) return false;
+        int32_t ignored;
+        if( !eval(e, f, ast->children[3], &ignored) ) return false;
+        if( f->returned ) return true;
+      }
+      *out = 0;
+      return true;
+    }
+    case ST_PARFOR:
+      // 並列に回すつもりで書かれたループは実行時に任せる
+      return false;
+    case ST_FOREACH:
+    case ST_YIELD:
+      // genはコード生成で展開するので、ここでは計算しない
+      return false;
+    case ST_BLOCK: {
+      // 空のblockは0になる
+      *out = 0;
+      for( AST** stmt = ast->children; *stmt; ++stmt ) {
+        if( !eval(e, f, *stmt, out) ) return false;
+        if( f->returned ) return true;
+      }
+      return true;
+    }
+    default: {
+      int32_t lhs, rhs;
+      if( !get_lhs(ast) || !get_rhs(ast) ) return false;
+      if( !eval(e, f, get_lhs(ast), &lhs) ) return false;
+      if( f->returned ) return true;
+      if( !eval(e, f, get_rhs(ast), &rhs) ) return false;
+      if( f->returned ) return true;
+      return arithmetic(ast->type, lhs, rhs, out);
+    }
+  }
+}
+
+// stackのbaseから上に積んだ引数でfuncを呼ぶ。戻るときに引数ごとstackから降ろす
+static bool call(Evaluator* e, AST* func, size_t base, int32_t* out) {
+  AST** params = get_lhs(func)->children;
+  size_t arity = 0;
+  while( params[arity] ) ++arity;
+  if( arity != e->stack_size - base || e->depth >= EVAL_MAX_DEPTH ) return false;
+
+  Frame frame = { base, false, 0 };
+  for( size_t i = 0; i < arity; ++i ) e->stack[base + i].name = params[i]->token;
+  ++e->depth;
+  int32_t value;
+  const bool ok = eval(e, &frame, get_rhs(func), &value);
+  --e->depth;
+  e->stack_size = base;
+  if( !ok ) return false;
+  *out = frame.returned ? frame.result : value;
+  return true;
+}
+
+// 子を先に畳んでから、自分が定数になるかを調べる
+static void fold(Evaluator* e, AST* ast) {
+  for( AST** child = ast->children; *child; ++child )
+    fold(e, *child);
+
+  int32_t value;
+  if( ast->type == ST_CALL ) {
+    // genの呼び出しはforで回すところに展開するので、値に畳まない
+    AST* func = find_func(e, ast->token);
+    if( !func || func->type != ST_FUNC || !(func->val & EFFECT_PURE) ) return;
+    e->steps = EVAL_MAX_STEPS;
+    e->depth = 0;
+    e->stack_size = 0;
+    for( AST** arg = ast->children; *arg; ++arg ) {
+      int32_t arg_value;
+      if( (*arg)->type != ST_NUM || !literal(*arg, &arg_value) || !push(e, NULL, arg_value) ) return;
+    }
+    if( !call(e, func, 0, &value) ) return;
+  } else {
+    AST* lhs = get_lhs(ast);
+    AST* rhs = get_rhs(ast);
+    int32_t l, r;
+    if( !lhs || !rhs || lhs->type != ST_NUM || rhs->type != ST_NUM ) return;
+    if( !literal(lhs, &l) || !literal(rhs, &r) ) return;
+    if( !arithmetic(ast->type, l, r, &value) ) return;
+  }
+
+  ast->type = ST_NUM;
+  ast->val = value;
+  ast->children[0] = NULL;
+}
+
+void evaluate_constants(Arena* arena, AST* root) {
+  Evaluator e;
+  e.funcs_size = 0;
+  for( AST** func = root->children; *func; ++func ) ++e.funcs_size;
+  if( e.funcs_size == 0 ) return;
+  e.funcs = (AST**)arena_alloc(arena, sizeof(AST*) * e.funcs_size);
+  memcpy(e.funcs, root->children, sizeof(AST*) * e.funcs_size);
+  qsort(e.funcs, e.funcs_size, sizeof(AST*), compare_func);
+  e.stack = (Binding*)arena_alloc(arena, sizeof(Binding) * EVAL_STACK_SIZE);
+  e.stack_size = 0;
+  e.total = EVAL_TOTAL_STEPS;
+  e.depth = 0;
+
+  for( AST** func = root->children; *func; ++func )
+    fold(&e, get_rhs(*func));
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "parser.h"
+#include "util.h"
+
+// 1つの呼び出しを評価するときの上限。超えたらその呼び出しは実行時に任せる
+#define EVAL_MAX_STEPS (1000000)
+#define EVAL_MAX_DEPTH (512)
+// 1回のコンパイル全体での上限
+#define EVAL_TOTAL_STEPS (20000000)
+
+// 副作用の無い関数(analyze_effectsでEFFECT_PUREが付いたもの)を定数の引数で呼んでいるところを
+// コンパイル時にASTのまま評価して、結果のST_NUMに置き換える。
+// 定数どうしの四則演算と比較も畳む。0除算のように実行時の振る舞いを変えてしまうものは畳まない。
+void evaluate_constants(Arena* arena, AST* root);
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+
+#include "freq.h"
+#include "compiler.h"
+
+struct FreqContext {
+  Compiler compiler;
+  FreqError error;
+};
+
+FreqContext* freq_create(void) {
+  FreqContext* ctx = (FreqContext*)malloc(sizeof(FreqContext));
+  if( !ctx ) return NULL;
+  init_compiler(&ctx->compiler, false, false);
+  ctx->error = (FreqError){ 0, 0, 0, "" };
+  return ctx;
+}
+
+void freq_destroy(FreqContext* ctx) {
+  if( !ctx ) return;
+  free_compiler(&ctx->compiler);
+  free(ctx);
+}
+
+static void set_flags(Compiler* c, unsigned flags) {
+  c->bitcode = (flags & FREQ_BITCODE) != 0;
+  c->debug = (flags & FREQ_DEBUG) != 0;
+  c->memoize = (flags & FREQ_NO_MEMO) == 0;
+}
+
+// コンパイラのエラーの位置から行と列を求めて、ctxのエラーにする
+static void set_compile_error(FreqContext* ctx, const char* source, size_t len) {
+  Compiler* c = &ctx->compiler;
+  const size_t pos = c->error.pos < len ? c->error.pos : len;
+  size_t line = 1, column = 1;
+  for( size_t i = 0; i < pos; ++i ) {
+    if( source[i] == '\n' ) {
+      ++line;
+      column = 1;
+    } else {
+      ++column;
+    }
+  }
+  ctx->error = (FreqError){ c->error.pos, line, column, c->error.message };
+}
+
+bool freq_compile(FreqContext* ctx, const char* source, size_t len, unsigned flags, FreqBuffer* output) {
+  Compiler* c = &ctx->compiler;
+  set_flags(c, flags);
+
+  if( compile(c, source, len) ) {
+    ctx->error = (FreqError){ 0, 0, 0, "" };
+    output->data = c->output.data;
+    output->size = c->output.size;
+    return true;
+  }
+
+  set_compile_error(ctx, source, len);
+  output->data = NULL;
+  output->size = 0;
+  return false;
+}
+
+bool freq_compile_stream(FreqContext* ctx, const char* source, size_t len, unsigned flags, FreqWriter write, void* user) {
+  Compiler* c = &ctx->compiler;
+  set_flags(c, flags);
+
+  if( compile_stream(c, source, len, write, user) ) {
+    ctx->error = (FreqError){ 0, 0, 0, "" };
+    return true;
+  }
+  set_compile_error(ctx, source, len);
+  return false;
+}
+
+void freq_set_instrument(FreqContext* ctx, const char* path) {
+  set_instrument(&ctx->compiler, path);
+}
+
+void freq_set_profiler(FreqContext* ctx, bool enabled, const char* stacks) {
+  set_profiler(&ctx->compiler, enabled, stacks);
+}
+
+void freq_set_select_cost(FreqContext* ctx, size_t cost) {
+  ctx->compiler.select_cost = cost;
+}
+
+void freq_set_threads(FreqContext* ctx, size_t threads) {
+  ctx->compiler.threads = threads;
+}
+
+bool freq_set_profile(FreqContext* ctx, const char* data, size_t len) {
+  if( set_profile(&ctx->compiler, data, len) ) return true;
+  ctx->error = (FreqError){ ctx->compiler.error.pos, 0, 0, ctx->compiler.error.message };
+  return false;
+}
+
+const FreqError* freq_error(const FreqContext* ctx) {
+  return &ctx->error;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// freqをライブラリとして使うための公開API。
+// libfreq.a / libfreq.so をリンクして使う。プロセスをexitすることはない。
+//
+//   FreqContext* ctx = freq_create();
+//   FreqBuffer out;
+//   if( freq_compile(ctx, src, len, FREQ_IR, &out) ) fwrite(out.data, 1, out.size, stdout);
+//   else fprintf(stderr, "%zu:%zu: %s\n", freq_error(ctx)->line, freq_error(ctx)->column, freq_error(ctx)->message);
+//   freq_destroy(ctx);
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FREQ_API __attribute__((visibility("default")))
+
+typedef struct FreqContext FreqContext;
+
+// freq_compileのflags
+#define FREQ_IR      (0)       // テキストのLLVM-IRを出力する
+#define FREQ_BITCODE (1 << 0)  // LLVM bitcodeを出力する
+#define FREQ_DEBUG   (1 << 1)  // tokenとASTをstderrに出し、IRにコメントを入れる
+#define FREQ_NO_MEMO (1 << 2)  // 副作用の無い再帰関数を自動でメモ化しない
+
+// コンパイル結果。次にそのcontextでfreq_compileを呼ぶまで有効。
+typedef struct {
+  const char* data;
+  size_t size;
+} FreqBuffer;
+
+// コンパイルエラー。line/columnは1始まり。
+typedef struct {
+  size_t pos;
+  size_t line;
+  size_t column;
+  const char* message;
+} FreqError;
+
+// contextはコンパイルをまたいでメモリを使い回す。
+// 1つのcontextを複数スレッドから同時に使ってはいけない。
+FREQ_API FreqContext* freq_create(void);
+FREQ_API void freq_destroy(FreqContext* ctx);
+
+FREQ_API bool freq_compile(FreqContext* ctx, const char* source, size_t len, unsigned flags, FreqBuffer* output);
+
+// freq_compile_streamの出力先。falseを返すとコンパイルをやめる
+typedef bool (*FreqWriter)(void* user, const char* data, size_t size);
+// 関数を1つparseするたびにその関数のIRを作ってwriteに渡し、tokenとASTを捨てる。
+// 使うメモリはsourceの他は一番大きな関数の分で済み、出力は最初の関数から流れ始める。
+// 全体を見ないとできない最適化(mainから使われない関数の省略、メモ化、コンパイル時の評価)はしない。
+// parforの本体から呼ぶ関数は、それより前に書いておく必要がある。FREQ_BITCODEは使えない。
+// 失敗したときも、それまでに出来た関数の分はwriteに渡している。
+FREQ_API bool freq_compile_stream(FreqContext* ctx, const char* source, size_t len, unsigned flags, FreqWriter write, void* user);
+// PGO: pathを指定すると以降のコンパイルで計装したコードを出す。
+// 計装したプログラムはmainの終了時にpathへプロファイルを書き出す。NULLで計装をやめる。
+FREQ_API void freq_set_instrument(FreqContext* ctx, const char* path);
+// PGO: 計装したプログラムが書き出したプロファイルを、以降のコンパイルで分岐の重みと
+// blockの並びに使う。dataがNULLなら捨てる。読めなければfalseを返してfreq_errorに理由が入る。
+FREQ_API bool freq_set_profile(FreqContext* ctx, const char* data, size_t len);
+// プロファイラ: enabledなら以降のコンパイルで関数ごとの呼び出し回数とサイクル数を測るコードを出す。
+// プログラムの終了時にselfの大きい順の表をstderrに出し、stacksがNULLでなければ
+// flamegraph用のcollapsed stackをそのパスに書く。
+FREQ_API void freq_set_profiler(FreqContext* ctx, bool enabled, const char* stacks);
+// 両腕が安くて副作用の無いifは、分岐せずに両方を計算してselectで選ぶ。
+// costは両腕で出す命令の数の目安の合計の上限で、0ならいつも分岐する。既定は8。
+FREQ_API void freq_set_select_cost(FreqContext* ctx, size_t cost);
+// 1MB以上の入力を、関数の境目で分けてthreads個のスレッドで並行に字句解析する。
+// 0ならCPUの数だけ使う。既定は1(分けない)。結果は分けないときと同じ。
+FREQ_API void freq_set_threads(FreqContext* ctx, size_t threads);
+
+// 直前のfreq_compileが失敗したときのエラー
+FREQ_API const FreqError* freq_error(const FreqContext* ctx);
+
+#ifdef __cplusplus
+}
+#endif
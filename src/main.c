@@ -1,16 +1,32 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "main.h"
-#include "tokenizer.h"
-#include "parser.h"
-#include "codegen.h"
+#include "batch.h"
+#include "freq.h"
+#include "server.h"
 #include "util.h"
 
-#define INPUT_BUFFER_SIZE (10240)
-#define OUTPUT_BUFFER_SIZE (10240)
+// 通常のファイルならmmapで読む。読めなければread_allにまかせてfalse
+static bool map_file(FILE* fp, const char** data, size_t* size) {
+  struct stat st;
+  if( fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ) return false;
+  void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+  if( p == MAP_FAILED ) return false;
+  *data = (const char*)p;
+  *size = (size_t)st.st_size;
+  return true;
+}
+
+static bool write_file(void* user, const char* data, size_t size) {
+  return fwrite(data, sizeof(char), size, (FILE*)user) == size;
+}
 
 int main(int argc, char **argv) {
   // 全体的にメモリ解放は頑張る必要がないのでやってないです(D言語方式)
@@ -18,21 +34,73 @@ int main(int argc, char **argv) {
   // デバッグモード？
   bool debug = false;
 
+  // テキストのIRではなくbitcode(.bc)を出力する？
+  bool bitcode = false;
+  // -M で副作用の無い再帰関数を自動でメモ化しない
+  bool memoize = true;
+  // -C cost で、両腕のコストの合計がcost以下のifを分岐せずselectで出す。0なら出さない
+  size_t select_cost = 8;
+  // -S で関数を1つ読むたびにIRを出す。大きな入力でもメモリを食わない
+  bool stream = false;
+
+  // -s path でサーバとして常駐する。"-"ならstdin/stdoutで要求を受ける。
+  const char* server_path = NULL;
+
+  // -B list でlistに書かれた(ディレクトリならその中の)プログラムをまとめてコンパイルする。
+  // -o dir を付けると出力はdirの下に書く。
+  const char* batch_list = NULL;
+
+  // サーバとバッチのworkerスレッド数(既定は4)。
+  // 1つだけコンパイルするときは、大きな入力を字句解析するスレッド数(既定はCPUの数)
+  size_t workers = 0;
+
+  // PGO: -G file で計装したコードを出し、実行するとfileにプロファイルが書かれる。
+  // -U file でそのプロファイルを使ってコンパイルする。
+  const char* instrument_path = NULL;
+  const char* profile_path = NULL;
+
+  // プロファイラ: -p で終了時に関数ごとのサイクル数をstderrに出す。
+  // -P file ならさらにflamegraph用のcollapsed stackをfileに書く。
+  bool profiler = false;
+  const char* stacks_path = NULL;
+
   // デフォルトはstdin。
   // -i file でそのファイルディスクリプタを扱う。
   // これも最後まで特に開放しないです。
   FILE* infile = stdin;
 
   // デフォルトはstdout。
-  // -o file でそのファイルディスクリプタを扱う。
+  // -o file でそのファイルディスクリプタを扱う。バッチのときは出力先のディレクトリ。
   // これも最後まで特に開放しないです。
+  const char* outpath = NULL;
   FILE* outfile = stdout;
 
   int opt;
-  while( (opt = getopt(argc, argv, "di:o:")) != -1 ) {
+  while( (opt = getopt(argc, argv, "dbi:o:s:j:G:U:pP:MSB:C:")) != -1 ) {
     switch (opt) {
       // デバッグモード。verboseな感じで標準エラー出力がうるさくなる。
       case 'd': debug = true; break;
+      // LLVM bitcodeを出力する
+      case 'b': bitcode = true; break;
+      // メモ化しない
+      case 'M': memoize = false; break;
+      // selectにするifのコストの上限
+      case 'C': select_cost = (size_t)strtoul(optarg, NULL, 10); break;
+      // 関数ごとに出力する
+      case 'S': stream = true; break;
+      // コンパイルサーバとして常駐する
+      case 's': server_path = optarg; break;
+      // まとめてコンパイルする
+      case 'B': batch_list = optarg; break;
+      // サーバとバッチのworker数、字句解析のスレッド数
+      case 'j': workers = (size_t)strtoul(optarg, NULL, 10); break;
+      // 計装する
+      case 'G': instrument_path = optarg; break;
+      // プロファイルを使う
+      case 'U': profile_path = optarg; break;
+      // プロファイラを埋め込む
+      case 'p': profiler = true; break;
+      case 'P': profiler = true; stacks_path = optarg; break;
       // 指定されたファイルから読み込む
       case 'i': {
         infile = fopen(optarg, "r");
@@ -43,40 +111,76 @@ int main(int argc, char **argv) {
       }
       break;
       // 指定されたファイルに書き出す
-      case 'o': {
-        outfile = fopen(optarg, "w");
-        if(outfile == NULL) {
-          fprintf(stderr, "Can't open output file.");
-          exit(EXIT_FAILURE);
-        }
-      }
-      break;
+      case 'o': outpath = optarg; break;
       default:
-        fprintf(stderr, "Usage: %s [-d] [-i infile] [-o outfile]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-d] [-b | -S] [-M] [-C cost] [-G profile | -U profile] [-p | -P stacks] [-i infile] [-o outfile] [-j threads] [-s socket|- [-j workers]] [-B list|dir [-o outdir] [-j workers]]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
   }
 
-  // 一定のバッファまで入力文字列を許す
-  // それ以上は許さないことで話を単純化する
-  char* input;
-  input = (char*)malloc(sizeof(char) * INPUT_BUFFER_SIZE);
-  fread(input, sizeof(char), INPUT_BUFFER_SIZE, infile);
-
-  // 入力からTokenを作成
-  Token* token = tokenize(input, INPUT_BUFFER_SIZE);
-  if( debug ) print_tokens(token);
-
-  // TokenをASTに変換
-  Parser* parser = parse(token);
-  if( debug ) {
-    for( AST** node = parser->ast->children; *node; ++node )
-      print_ast(*node, 0);
+  if( server_path ) return run_server(server_path, workers ? workers : 4);
+  if( batch_list ) {
+    // 計装やプロファイラの出力先は1つしか無いので、まとめてはコンパイルできない
+    if( stream || instrument_path || profile_path || profiler ) {
+      fprintf(stderr, "-Bと-S/-G/-U/-p/-Pは一緒に使えません。\n");
+      exit(EXIT_FAILURE);
+    }
+    const unsigned flags = (bitcode ? FREQ_BITCODE : FREQ_IR) | (debug ? FREQ_DEBUG : 0) | (memoize ? 0 : FREQ_NO_MEMO);
+    return run_batch(batch_list, outpath, flags, select_cost, workers ? workers : 4);
+  }
+  if( outpath ) {
+    outfile = fopen(outpath, "w");
+    if(outfile == NULL) {
+      fprintf(stderr, "Can't open output file.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if( stream && bitcode ) {
+    fprintf(stderr, "-Sと-bは一緒に使えません。\n");
+    exit(EXIT_FAILURE);
+  }
+
+  const char* source;
+  size_t source_size;
+  if( !map_file(infile, &source, &source_size) ) {
+    Buffer input;
+    init_buffer(&input);
+    read_all(infile, &input);
+    source = input.data;
+    source_size = input.size;
   }
 
-  // コード生成
-  CodeGen* gen = create_codegen(outfile, debug);
-  generate_code(gen, parser->ast);
+  FreqContext* ctx = freq_create();
+  if( instrument_path ) freq_set_instrument(ctx, instrument_path);
+  if( profiler ) freq_set_profiler(ctx, true, stacks_path);
+  freq_set_select_cost(ctx, select_cost);
+  freq_set_threads(ctx, workers);
+  if( profile_path ) {
+    FILE* fp = fopen(profile_path, "r");
+    if( fp == NULL ) {
+      fprintf(stderr, "Can't open profile file.\n");
+      exit(EXIT_FAILURE);
+    }
+    Buffer profile;
+    init_buffer(&profile);
+    read_all(fp, &profile);
+    fclose(fp);
+    if( !freq_set_profile(ctx, profile.data, profile.size) ) {
+      fprintf(stderr, "%s: %s\n", profile_path, freq_error(ctx)->message);
+      exit(EXIT_FAILURE);
+    }
+  }
+  const unsigned flags = (bitcode ? FREQ_BITCODE : FREQ_IR) | (debug ? FREQ_DEBUG : 0) | (memoize ? 0 : FREQ_NO_MEMO);
+  FreqBuffer output = { NULL, 0 };
+  const bool ok = stream
+    ? freq_compile_stream(ctx, source, source_size, flags, write_file, outfile)
+    : freq_compile(ctx, source, source_size, flags, &output);
+  if( !ok ) {
+    const FreqError* err = freq_error(ctx);
+    fprintf(stderr, "%zu:%zu: %s\n", err->line, err->column, err->message);
+    exit(EXIT_FAILURE);
+  }
+  fwrite(output.data, sizeof(char), output.size, outfile);
 
   return 0;
 }
@@ -1,18 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "parser.h"
 #include "util.h"
 
-static AST* create_ast(SyntaxType type, Token* token, AST* child, ...);
+static AST* create_ast(Parser* parser, SyntaxType type, Token* token, AST* child, ...);
 static AST* parse_stmt(Parser* parser);
 static AST* parse_assign(Parser* parser);
 
-static Parser* create_parser(Token* root) {
-  Parser* parser = (Parser*)malloc(sizeof(Parser));
-  parser->ast = create_ast( ST_ROOT, NULL, NULL );
+static Parser* create_parser(Arena* arena, Token* root, Error* error) {
+  Parser* parser = (Parser*)arena_alloc(arena, sizeof(Parser));
+  parser->arena = arena;
+  parser->error = error;
+  parser->ast = create_ast(parser, ST_ROOT, NULL, NULL );
   parser->current = parser->root = root;
+  parser->tokenizer = NULL;
+  parser->in_gen = false;
+  parser->in_args = 0;
   return parser;
 }
 
@@ -20,12 +28,46 @@ static Token* consume(Parser* parser, TokenType type) {
   if( !(parser->current) ) return NULL;
   if( parser->current->type != type ) return NULL;
   Token* consumed = parser->current;
-  parser->current = parser->current->next;
+  // tokenizerから読んでいるなら、次のtokenは必要になったときに読む
+  if( !consumed->next && parser->tokenizer ) consumed->next = next_token(parser->tokenizer);
+  parser->current = consumed->next;
   return consumed;
 }
 
-static AST* create_ast(SyntaxType type, Token* token, AST* child, ...) {
-  AST* node = (AST*)malloc(sizeof(AST));
+// 必要な構文要素が無かったのでエラーにする。最初のエラーだけ覚えておく
+static AST* unexpected(Parser* parser) {
+  Token* t = parser->current;
+  if( t->type == TT_EOF ) {
+    set_error(parser->error, t->pos, "Parse中に予想外の入力の終わり(%zu文字目)が来てしまいました。", t->pos);
+  } else {
+    set_error(parser->error, t->pos, "Parse中に予想外のトークン(%zu文字目の'%.*s')が来てしまいました。", t->pos, (int)t->len, t->buffer + t->pos);
+  }
+  return NULL;
+}
+
+static AST* require(Parser* parser, AST* node) {
+  if( node ) return node;
+  return unexpected(parser);
+}
+
+static bool expect(Parser* parser, TokenType type) {
+  if( consume(parser, type) ) return true;
+  unexpected(parser);
+  return false;
+}
+
+// childrenは固定長なので、溢れるならエラーにする
+static bool push_child(Parser* parser, AST* node, size_t* i, AST* child) {
+  if( *i >= MAX_BLOCK_SIZE - 1 ) {
+    set_error(parser->error, parser->current->pos, "要素が多すぎます(%zu文字目、最大%d個)。", parser->current->pos, MAX_BLOCK_SIZE - 1);
+    return false;
+  }
+  node->children[ (*i)++ ] = child;
+  return true;
+}
+
+static AST* create_ast(Parser* parser, SyntaxType type, Token* token, AST* child, ...) {
+  AST* node = (AST*)arena_alloc(parser->arena, sizeof(AST));
   node->type = type;
   node->token = token;
   // 数値ノードならtokenをstrtolで解釈する
@@ -62,7 +104,7 @@ AST* get_rhs(AST* node) {
 static AST* parse_lvar(Parser* parser) {
   Token* tok;
   if( (tok = consume( parser, TT_IDENT )) )
-    return create_ast(ST_VAR, tok, NULL, NULL );
+    return create_ast(parser, ST_VAR, tok, NULL, NULL );
   return NULL;
 }
 
@@ -70,29 +112,31 @@ static AST* parse_expr(Parser* parser);
 static AST* parse_factor(Parser* parser) {
   Token* tok;
   if( consume( parser, TT_LEFT_PAREN ) ) {
-    AST* node = parse_expr( parser );
+    AST* node = require( parser, parse_expr( parser ) );
     if( consume( parser, TT_RIGHT_PAREN ) ) {
       return node;
     }
-    return NULL;
+    return unexpected( parser );
   }
 
   if( (tok = consume( parser, TT_NUM )) )
-    return create_ast( ST_NUM, tok, NULL, NULL );
+    return create_ast(parser, ST_NUM, tok, NULL, NULL );
 
   if( (tok = consume( parser, TT_IDENT )) ) {
     if( consume( parser, TT_LEFT_PAREN ) ) {
-      AST* node = create_ast( ST_CALL, tok, NULL );
+      AST* node = create_ast(parser, ST_CALL, tok, NULL );
       size_t i = 0;
       do {
+        ++parser->in_args;
         AST* arg = parse_stmt( parser );
+        --parser->in_args;
         if( !arg ) break;
-        node->children[ i++ ] = arg;
+        if( !push_child( parser, node, &i, arg ) ) return NULL;
       } while( consume(parser, TT_COMMA) );
-      consume( parser, TT_RIGHT_PAREN );
+      if( !expect( parser, TT_RIGHT_PAREN ) ) return NULL;
       return node;
     } else {
-      return create_ast( ST_VAR, tok, NULL, NULL );
+      return create_ast(parser, ST_VAR, tok, NULL, NULL );
     }
   }
 
@@ -107,8 +151,8 @@ static AST* parse_unary(Parser* parser) {
   if( (tok = consume( parser, TT_MINUS )) ) {
     // ここはシンタックスシュガーとして生成されるので
     // 後で解釈されるときのためにダミーのトークンを登録しておく
-    Token* dummy = create_token(TT_NUM, "0", 0, 1);
-    return create_ast( ST_SUB, tok, create_ast( ST_NUM, dummy, NULL, NULL ), parse_unary( parser ), NULL );
+    Token* dummy = create_token(parser->arena, TT_NUM, "0", 0, 1);
+    return create_ast(parser, ST_SUB, tok, create_ast(parser, ST_NUM, dummy, NULL, NULL ), require( parser, parse_unary( parser ) ), NULL );
   }
 
   return parse_factor( parser );
@@ -119,9 +163,9 @@ static AST* parse_term(Parser* parser) {
   for( ; ; ) {
     Token* tok;
     if( (tok = consume( parser, TT_MUL )) )
-      node = create_ast( ST_MUL, tok, node, parse_unary(parser), NULL );
+      node = create_ast(parser, ST_MUL, tok, node, require(parser, parse_unary(parser)), NULL );
     else if( (tok = consume( parser, TT_DIV )) )
-      node = create_ast( ST_DIV, tok, node, parse_unary(parser), NULL );
+      node = create_ast(parser, ST_DIV, tok, node, require(parser, parse_unary(parser)), NULL );
     else
       return node;
   }
@@ -132,9 +176,9 @@ static AST* parse_expr(Parser* parser) {
   for( ; ; ) {
     Token* tok;
     if( (tok = consume( parser, TT_PLUS )) )
-      node = create_ast( ST_ADD, tok, node, parse_term(parser), NULL );
+      node = create_ast(parser, ST_ADD, tok, node, require(parser, parse_term(parser)), NULL );
     else if( (tok = consume( parser, TT_MINUS )) )
-      node = create_ast( ST_SUB, tok, node, parse_term(parser), NULL );
+      node = create_ast(parser, ST_SUB, tok, node, require(parser, parse_term(parser)), NULL );
     else
       return node;
   }
@@ -146,13 +190,13 @@ static AST* parse_rational(Parser* parser) {
   for( ; ; ) {
     Token* tok;
     if( (tok = consume( parser, TT_LT )) )
-      node = create_ast( ST_LT, tok, node, parse_expr(parser), NULL );
+      node = create_ast(parser, ST_LT, tok, node, require(parser, parse_expr(parser)), NULL );
     else if( (tok = consume( parser, TT_LTEQ )) )
-      node = create_ast( ST_LTEQ, tok, node, parse_expr(parser), NULL );
+      node = create_ast(parser, ST_LTEQ, tok, node, require(parser, parse_expr(parser)), NULL );
     else if( (tok = consume( parser, TT_GT )) )
-      node = create_ast( ST_GT, tok, node, parse_expr(parser), NULL );
+      node = create_ast(parser, ST_GT, tok, node, require(parser, parse_expr(parser)), NULL );
     else if( (tok = consume( parser, TT_GTEQ )) )
-      node = create_ast( ST_GTEQ, tok, node, parse_expr(parser), NULL );
+      node = create_ast(parser, ST_GTEQ, tok, node, require(parser, parse_expr(parser)), NULL );
     else
       return node;
   }
@@ -163,9 +207,9 @@ static AST* parse_equality(Parser* parser) {
   for( ; ; ) {
     Token* tok;
     if( (tok = consume( parser, TT_EQUAL )) )
-      node = create_ast( ST_EQUAL, tok, node, parse_rational(parser), NULL );
+      node = create_ast(parser, ST_EQUAL, tok, node, require(parser, parse_rational(parser)), NULL );
     else if( (tok = consume( parser, TT_NOT_EQUAL )) )
-      node = create_ast( ST_NOT_EQUAL, tok, node, parse_rational(parser), NULL );
+      node = create_ast(parser, ST_NOT_EQUAL, tok, node, require(parser, parse_rational(parser)), NULL );
     else
       return node;
   }
@@ -175,7 +219,7 @@ static AST* parse_assign(Parser* parser) {
   AST* node = parse_equality(parser);
   Token* tok;
   if( (tok = consume(parser, TT_ASSIGN)) ) {
-    return create_ast( ST_ASSIGN, tok, node, parse_assign(parser), NULL );
+    return create_ast(parser, ST_ASSIGN, tok, node, require(parser, parse_assign(parser)), NULL );
   } else {
     return node;
   }
@@ -189,48 +233,129 @@ static AST* parse_let(Parser* parser) {
     Token* assign;
     if( (assign = consume(parser, TT_ASSIGN)) )
       rhs = parse_assign(parser);
-    return create_ast( ST_LET, tok, lhs, rhs, NULL );
+    return create_ast(parser, ST_LET, tok, lhs, rhs, NULL );
   } else {
     return parse_assign(parser);
   }
 }
 
+// [unroll 4, vectorize 8] のようなforのヒント。同じヒントは1回しか書けない
+static AST* parse_loop_hint(Parser* parser, AST** hints, size_t hints_size) {
+  Token* name = consume(parser, TT_IDENT);
+  if( !name ) return unexpected(parser);
+  SyntaxType type;
+  if( name->len == 6 && strncmp(name->buffer + name->pos, "unroll", 6) == 0 ) {
+    type = ST_UNROLL;
+  } else if( name->len == 9 && strncmp(name->buffer + name->pos, "vectorize", 9) == 0 ) {
+    type = ST_VECTORIZE;
+  } else {
+    set_error(parser->error, name->pos, "知らないループのヒント(%zu文字目の'%.*s')です。", name->pos, (int)name->len, name->buffer + name->pos);
+    return NULL;
+  }
+  for( size_t i = 0; i < hints_size; ++i ) {
+    if( hints[i]->type == type ) {
+      set_error(parser->error, name->pos, "ループのヒント(%zu文字目の'%.*s')が2回書かれています。", name->pos, (int)name->len, name->buffer + name->pos);
+      return NULL;
+    }
+  }
+  Token* count = consume(parser, TT_NUM);
+  if( !count ) return unexpected(parser);
+  // 桁あふれしたときはLONG_MAXになるので、これも範囲外として弾ける
+  const long val = strtol(count->buffer + count->pos, NULL, 10);
+  if( val < 1 || val > INT32_MAX ) {
+    set_error(parser->error, count->pos, "ループのヒントの値(%zu文字目の'%.*s')は1から%dまでです。", count->pos, (int)count->len, count->buffer + count->pos, INT32_MAX);
+    return NULL;
+  }
+  AST* hint = create_ast(parser, type, count, NULL);
+  hint->val = val;
+  return hint;
+}
+
+// forとparforの共通部分。ヒントを書けるのはforだけ
+static AST* parse_for(Parser* parser, Token* tok, SyntaxType type) {
+  AST* var = require(parser, parse_lvar(parser));
+  if( !expect(parser, TT_IN) ) return NULL;
+  AST* from = require(parser, parse_expr(parser));
+  // 範囲ではなくgenの呼び出しなら、yieldされる値を順に回す
+  if( type == ST_FOR && from && from->type == ST_CALL && parser->current->type != TT_DOTDOT ) {
+    AST* stmt = require(parser, parse_stmt(parser));
+    return create_ast(parser, ST_FOREACH, tok, var, from, stmt, NULL);
+  }
+  if( !expect(parser, TT_DOTDOT) ) return NULL;
+  AST* to = require(parser, parse_expr(parser));
+
+  AST* hints[2];
+  size_t hints_size = 0;
+  if( type == ST_FOR && consume(parser, TT_LEFT_BRACKET) ) {
+    do {
+      if( hints_size >= 2 ) return unexpected(parser);
+      AST* hint = parse_loop_hint(parser, hints, hints_size);
+      if( !hint ) return NULL;
+      hints[hints_size++] = hint;
+    } while( consume(parser, TT_COMMA) );
+    if( !expect(parser, TT_RIGHT_BRACKET) ) return NULL;
+  }
+
+  AST* stmt = require(parser, parse_stmt(parser));
+  AST* node = create_ast(parser, type, tok, var, from, to, stmt, NULL);
+  for( size_t i = 0; i < hints_size; ++i ) node->children[4 + i] = hints[i];
+  return node;
+}
+
 static AST* parse_stmt(Parser* parser) {
   Token* tok;
   if( (tok = consume(parser, TT_LOOP)) ) {
-    AST* stmt = parse_stmt(parser);
-    return create_ast(ST_LOOP, tok, stmt, NULL);
+    AST* stmt = require(parser, parse_stmt(parser));
+    return create_ast(parser, ST_LOOP, tok, stmt, NULL);
+  } else if( (tok = consume(parser, TT_FOR)) ) {
+    return parse_for(parser, tok, ST_FOR);
+  } else if( (tok = consume(parser, TT_PARFOR)) ) {
+    return parse_for(parser, tok, ST_PARFOR);
   } else if( (tok = consume(parser, TT_IF)) ) {
-    consume(parser, TT_LEFT_PAREN);
-    AST* cond = parse_stmt(parser);
-    consume(parser, TT_RIGHT_PAREN);
-    AST* when_true = parse_stmt(parser);
+    if( !expect(parser, TT_LEFT_PAREN) ) return NULL;
+    AST* cond = require(parser, parse_stmt(parser));
+    if( !expect(parser, TT_RIGHT_PAREN) ) return NULL;
+    AST* when_true = require(parser, parse_stmt(parser));
     AST* when_false = NULL;
     if( consume(parser, TT_ELSE) ) {
-      when_false = parse_stmt(parser);
+      when_false = require(parser, parse_stmt(parser));
     } else {
-      Token* dummy = create_token(TT_NUM, "0", 0, 1);
-      when_false = create_ast( ST_NUM, dummy, NULL );
+      Token* dummy = create_token(parser->arena, TT_NUM, "0", 0, 1);
+      when_false = create_ast(parser, ST_NUM, dummy, NULL );
     }
-    return create_ast(ST_IF, tok, cond, when_true, when_false, NULL);
+    return create_ast(parser, ST_IF, tok, cond, when_true, when_false, NULL);
   } else if( (tok = consume(parser, TT_LEFT_BRACE)) ) {
-    AST* node = create_ast(ST_BLOCK, tok, NULL);
+    AST* node = create_ast(parser, ST_BLOCK, tok, NULL);
     size_t i = 0;
     do {
-      node->children[ i++ ] = parse_stmt(parser);
+      AST* stmt = parse_stmt(parser);
+      if( !stmt ) break;
+      if( !push_child(parser, node, &i, stmt) ) return NULL;
     } while( consume(parser, TT_SEMICOLON) );
-    consume(parser, TT_RIGHT_BRACE);
+    if( !expect(parser, TT_RIGHT_BRACE) ) return NULL;
     return node;
   } else if( (tok = consume(parser, TT_LET)) ) {
-    AST* lhs = parse_lvar(parser);
+    AST* lhs = require(parser, parse_lvar(parser));
     AST* rhs = NULL;
     Token* assign;
     if( (assign = consume(parser, TT_ASSIGN)) )
-      rhs = parse_stmt(parser);
-    return create_ast( ST_LET, tok, lhs, rhs, NULL );
+      rhs = require(parser, parse_stmt(parser));
+    return create_ast(parser, ST_LET, tok, lhs, rhs, NULL );
+  } else if( (tok = consume(parser, TT_YIELD)) ) {
+    if( !parser->in_gen ) {
+      set_error(parser->error, tok->pos, "yieldはgenの中でしか書けません(%zu文字目)。", tok->pos);
+      return NULL;
+    }
+    // 引数の途中で止まると、先に評価した引数を再開したところまで持ち越せない
+    if( parser->in_args ) {
+      set_error(parser->error, tok->pos, "yieldは関数の引数には書けません(%zu文字目)。", tok->pos);
+      return NULL;
+    }
+    AST* node = require(parser, parse_assign(parser));
+    return create_ast(parser, ST_YIELD, tok, node, NULL );
   } else if( (tok = consume(parser, TT_RETURN) ) ){
-    AST* node = parse_assign(parser);
-    return create_ast( ST_RETURN, tok, node, NULL );
+    AST* node = require(parser, parse_assign(parser));
+    return create_ast(parser, ST_RETURN, tok, node, NULL );
   } else {
     return parse_assign(parser);
   }
@@ -238,38 +363,182 @@ static AST* parse_stmt(Parser* parser) {
 
 static AST* parse_args(Parser* parser) {
   Token* tok = consume(parser, TT_LEFT_PAREN);
-  AST* node = create_ast(ST_ARGS, tok, NULL);
+  if( !tok ) return unexpected(parser);
+  AST* node = create_ast(parser, ST_ARGS, tok, NULL);
   size_t i = 0;
   do {
     if( !(tok = consume( parser, TT_IDENT )) ) break;
-    node->children[i++] = create_ast(ST_VAR, tok, NULL );
+    if( !push_child(parser, node, &i, create_ast(parser, ST_VAR, tok, NULL )) ) return NULL;
   } while( consume(parser, TT_COMMA) );
-  consume(parser, TT_RIGHT_PAREN);
+  if( !expect(parser, TT_RIGHT_PAREN) ) return NULL;
   return node;
 }
 
 static AST* parse_func(Parser* parser) {
-  if( consume(parser, TT_FUN) ) {
+  Token* kind = consume(parser, TT_FUN);
+  if( !kind ) kind = consume(parser, TT_GEN);
+  if( kind ) {
     Token* name = consume(parser, TT_IDENT);
+    if( !name ) return unexpected(parser);
     AST* args = parse_args(parser);
-    AST* stmt = parse_stmt(parser);
-    return create_ast(ST_FUNC, name, args, stmt);
+    if( !args ) return NULL;
+    parser->in_gen = kind->type == TT_GEN;
+    AST* stmt = require(parser, parse_stmt(parser));
+    parser->in_gen = false;
+    if( !stmt ) return NULL;
+    return create_ast(parser, kind->type == TT_GEN ? ST_GEN : ST_FUNC, name, args, stmt, NULL);
   }
   return NULL;
 }
 
-Parser* parse(Token* token) {
-  Parser* parser = create_parser(token);
+// 先読みで見つけた関数(genを含む)。bodyは必要になるまでparseしない
+typedef struct {
+  Token* start; // funかgenのトークン
+  Token* end;   // 次の関数のfunかgenのトークンかEOF
+  Token* name;
+  AST* ast;
+  bool queued; // worklistに積んだか
+} FuncEntry;
+
+typedef struct {
+  FuncEntry* entries;
+  size_t size;
+  FuncEntry** table; // 名前で引くためのopen addressingのハッシュ表
+  size_t table_size;
+} FuncTable;
+
+static size_t hash_token(Token* token) {
+  size_t h = 14695981039346656037ULL;
+  for( size_t i = 0; i < token->len; ++i )
+    h = (h ^ (unsigned char)token->buffer[token->pos + i]) * 1099511628211ULL;
+  return h;
+}
+
+static FuncEntry* find_func(FuncTable* funcs, Token* name) {
+  const size_t mask = funcs->table_size - 1;
+  for( size_t i = hash_token(name) & mask; funcs->table[i]; i = (i + 1) & mask ) {
+    if( token_equals(funcs->table[i]->name, name) ) return funcs->table[i];
+  }
+  return NULL;
+}
+
+// ASTを作らずにtokenだけを見て、各関数の名前とbodyの範囲を記録する。
+// 括弧の深さが0のfunかgenが次の関数の始まり。
+static bool scan_funcs(Parser* parser, FuncTable* funcs) {
+  size_t capacity = 0;
+  funcs->entries = NULL;
+  funcs->size = 0;
+
+  Token* t = parser->current;
+  while( t->type != TT_EOF ) {
+    if( (t->type != TT_FUN && t->type != TT_GEN) || t->next->type != TT_IDENT ) {
+      parser->current = t;
+      unexpected(parser);
+      return false;
+    }
+    if( funcs->size == capacity ) {
+      capacity = capacity ? capacity * 2 : 64;
+      FuncEntry* entries = (FuncEntry*)arena_alloc(parser->arena, sizeof(FuncEntry) * capacity);
+      if( funcs->size ) memcpy(entries, funcs->entries, sizeof(FuncEntry) * funcs->size);
+      funcs->entries = entries;
+    }
+    FuncEntry* entry = &funcs->entries[ funcs->size++ ];
+    entry->start = t;
+    entry->name = t->next;
+    entry->ast = NULL;
+    entry->queued = false;
+
+    size_t depth = 0;
+    for( t = t->next; t->type != TT_EOF; t = t->next ) {
+      if( t->type == TT_LEFT_PAREN || t->type == TT_LEFT_BRACE ) ++depth;
+      else if( (t->type == TT_RIGHT_PAREN || t->type == TT_RIGHT_BRACE) && depth > 0 ) --depth;
+      else if( (t->type == TT_FUN || t->type == TT_GEN) && depth == 0 ) break;
+    }
+    entry->end = t;
+  }
+
+  // 表の大きさは要素数の2倍以上の2のべき乗にする
+  funcs->table_size = 16;
+  while( funcs->table_size < funcs->size * 2 ) funcs->table_size *= 2;
+  funcs->table = (FuncEntry**)arena_alloc(parser->arena, sizeof(FuncEntry*) * funcs->table_size);
+  memset(funcs->table, 0, sizeof(FuncEntry*) * funcs->table_size);
+  const size_t mask = funcs->table_size - 1;
+  for( size_t i = 0; i < funcs->size; ++i ) {
+    FuncEntry* entry = &funcs->entries[i];
+    // 同名の関数は先に書かれた方を使う
+    if( find_func(funcs, entry->name) ) continue;
+    size_t h = hash_token(entry->name) & mask;
+    while( funcs->table[h] ) h = (h + 1) & mask;
+    funcs->table[h] = entry;
+  }
+  return true;
+}
+
+// 記録しておいた範囲から関数を1つparseする
+static bool parse_entry(Parser* parser, FuncEntry* entry) {
+  parser->current = entry->start;
+  entry->ast = require(parser, parse_func(parser));
+  if( !entry->ast ) return false;
+  consume(parser, TT_SEMICOLON);
+  if( parser->current != entry->end ) {
+    unexpected(parser);
+    return false;
+  }
+  return true;
+}
+
+// astの中の呼び出し先で、まだparseしていない関数をworklistに積む
+static void push_callees(FuncTable* funcs, AST* ast, FuncEntry** worklist, size_t* size) {
+  if( ast == NULL ) return;
+  if( ast->type == ST_CALL ) {
+    FuncEntry* callee = find_func(funcs, ast->token);
+    // 組み込み関数などは見つからない
+    if( callee && !callee->queued ) {
+      callee->queued = true;
+      worklist[ (*size)++ ] = callee;
+    }
+  }
+  for( AST** child = ast->children; *child; ++child )
+    push_callees(funcs, *child, worklist, size);
+}
+
+Parser* parse(Arena* arena, Token* token, Error* error) {
+  Parser* parser = create_parser(arena, token, error);
 
   // ROOTから始まる
   if( !consume( parser, TT_ROOT ) )
     return NULL;
 
-  // funcをすべて読み込む
+  // まず関数の範囲だけを調べる
+  FuncTable funcs;
+  if( !scan_funcs(parser, &funcs) ) return NULL;
+
+  Token main_name = { TT_IDENT, "main", 0, 4, NULL };
+  FuncEntry* main_func = find_func(&funcs, &main_name);
+  if( main_func ) {
+    // mainから呼ばれる関数だけを辿ってparseする
+    FuncEntry** worklist = (FuncEntry**)arena_alloc(arena, sizeof(FuncEntry*) * funcs.size);
+    size_t size = 0;
+    main_func->queued = true;
+    worklist[ size++ ] = main_func;
+    while( size > 0 ) {
+      FuncEntry* entry = worklist[ --size ];
+      if( !parse_entry(parser, entry) ) return NULL;
+      push_callees(&funcs, get_rhs(entry->ast), worklist, &size);
+    }
+  } else {
+    // mainが無ければ全部parseする
+    for( size_t i = 0; i < funcs.size; ++i ) {
+      if( !parse_entry(parser, &funcs.entries[i]) ) return NULL;
+    }
+  }
+
+  // 書かれた順に並べる
   size_t i = 0;
-  while( !consume(parser, TT_EOF) ) {
-    parser->ast->children[i++] = parse_func(parser);
-    consume(parser, TT_SEMICOLON);
+  for( size_t j = 0; j < funcs.size; ++j ) {
+    FuncEntry* entry = &funcs.entries[j];
+    if( !entry->ast ) continue;
+    if( !push_child(parser, parser->ast, &i, entry->ast) ) return NULL;
   }
 
   // NULLで終端しておくことで後続で処理できるようにする
@@ -278,6 +547,24 @@ Parser* parse(Token* token) {
   return parser;
 }
 
+Parser* create_stream_parser(Arena* arena, Tokenizer* tokenizer, Error* error) {
+  Parser* parser = create_parser(arena, NULL, error);
+  parser->tokenizer = tokenizer;
+  parser->current = next_token(tokenizer);
+  return parser;
+}
+
+AST* parse_next_func(Parser* parser) {
+  if( parser->error->failed || parser->current->type == TT_EOF ) return NULL;
+  AST* func = require(parser, parse_func(parser));
+  if( !func ) return NULL;
+  consume(parser, TT_SEMICOLON);
+  // 先読みしたtokenは次の関数の始まりなので、この関数のtokenを捨てても残るように写しておく
+  parser->lookahead = *parser->current;
+  parser->current = &parser->lookahead;
+  return func;
+}
+
 void print_ast(AST* ast, size_t level) {
   if( ast == NULL ) return;
   indent(level); fprintf(stderr, "SyntaxType: %u (%ld)\n", ast->type, ast->val);
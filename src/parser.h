@@ -7,10 +7,17 @@
 typedef enum {
   ST_ROOT,
   ST_FUNC,
+  ST_GEN,       // gen name(args) stmt。childrenはST_FUNCと同じ。関数としては出さず、forで回すところに展開する
   ST_ARGS,
   ST_BLOCK,
   ST_IF,
   ST_LOOP,
+  ST_FOR,       // for i in from..to [hints] stmt。childrenは var, from, to, stmt, hints...
+  ST_UNROLL,    // forのヒント。valが回数
+  ST_VECTORIZE, // forのヒント。valが幅
+  ST_PARFOR,    // parfor i in from..to stmt。childrenは var, from, to, stmt。値は各回のstmtの値の合計
+  ST_FOREACH,   // for x in gen(args) stmt。childrenは var, call, stmt。genがyieldするたびにxに入れてstmtを実行する。値は0
+  ST_YIELD,     // yield expr。genの中だけに書ける。関数の引数には書けない。値はexprの値
   ST_NUM,
   ST_ADD,
   ST_SUB,
@@ -37,12 +44,25 @@ typedef struct tAST {
 } AST;
 
 typedef struct {
+  Arena* arena;
+  Error* error;
   AST* ast;
   Token* root;
   Token* current;
+  Tokenizer* tokenizer; // create_stream_parserで作ったときだけ。tokenをここから1つずつ読む
+  Token lookahead;      // parse_next_funcが返した関数の次のtoken
+  bool in_gen;          // genの本体をparseしている
+  size_t in_args;       // 関数の引数をparseしている深さ
 } Parser;
 
-Parser* parse(Token* token);
+// tokenの列全体からmainで使う関数だけをparseして、ST_ROOTの下に書かれた順に並べる
+Parser* parse(Arena* arena, Token* token, Error* error);
+// 関数を1つずつparseするためのParserを作る。Parser自体はarenaに置き、
+// tokenとASTもarenaから確保する
+Parser* create_stream_parser(Arena* arena, Tokenizer* tokenizer, Error* error);
+// 次の関数を1つparseしてST_FUNCかST_GENを返す。入力の終わりかエラーならNULL。
+// 返した関数のtokenとASTは、次に呼ぶまでならarenaから捨ててもよい
+AST* parse_next_func(Parser* parser);
 AST* get_lhs(AST* node);
 AST* get_rhs(AST* node);
 void print_ast(AST* ast, size_t level);
@@ -0,0 +1,80 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+static int compare_name(const char* lname, size_t llen, const char* rname, size_t rlen) {
+  const int c = memcmp(lname, rname, llen < rlen ? llen : rlen);
+  if( c != 0 ) return c;
+  return (llen > rlen) - (llen < rlen);
+}
+
+static int compare_func_profile(const void* lhs, const void* rhs) {
+  const FuncProfile* l = (const FuncProfile*)lhs;
+  const FuncProfile* r = (const FuncProfile*)rhs;
+  return compare_name(l->name, l->len, r->name, r->len);
+}
+
+bool parse_profile(Arena* arena, const char* text, size_t len, Profile* profile, Error* error) {
+  // 行数を数えて、関数の数の上限にする
+  size_t lines = 1;
+  for( size_t i = 0; i < len; ++i ) if( text[i] == '\n' ) ++lines;
+  profile->funcs = (FuncProfile*)arena_alloc(arena, sizeof(FuncProfile) * lines);
+  profile->size = 0;
+
+  size_t pos = 0;
+  while( pos < len ) {
+    size_t end = pos;
+    while( end < len && text[end] != '\n' ) ++end;
+    const size_t next = end + 1;
+    while( pos < end && isspace((unsigned char)text[pos]) ) ++pos;
+    // 空行と#から始まる行は読み飛ばす
+    if( pos == end || text[pos] == '#' ) {
+      pos = next;
+      continue;
+    }
+
+    FuncProfile* f = &profile->funcs[profile->size++];
+    f->name = text + pos;
+    while( pos < end && !isspace((unsigned char)text[pos]) ) ++pos;
+    f->len = (size_t)(text + pos - f->name);
+
+    // 数は高々 (行の長さ / 2 + 1) 個
+    f->counts = (uint64_t*)arena_alloc(arena, sizeof(uint64_t) * ((end - pos) / 2 + 1));
+    f->size = 0;
+    for( ; ; ) {
+      while( pos < end && isspace((unsigned char)text[pos]) ) ++pos;
+      if( pos == end ) break;
+      uint64_t value = 0;
+      const size_t start = pos;
+      while( pos < end && isdigit((unsigned char)text[pos]) ) value = value * 10 + (uint64_t)(text[pos++] - '0');
+      if( pos == start || (pos < end && !isspace((unsigned char)text[pos])) ) {
+        set_error(error, start, "profile: '%.*s'の回数が読めません。", (int)f->len, f->name);
+        return false;
+      }
+      f->counts[f->size++] = value;
+    }
+    if( f->size == 0 ) {
+      set_error(error, pos, "profile: '%.*s'に呼ばれた回数がありません。", (int)f->len, f->name);
+      return false;
+    }
+    pos = next;
+  }
+
+  qsort(profile->funcs, profile->size, sizeof(FuncProfile), compare_func_profile);
+  return true;
+}
+
+FuncProfile* find_func_profile(Profile* profile, Token* name) {
+  size_t lo = 0, hi = profile->size;
+  while( lo < hi ) {
+    const size_t mid = (lo + hi) / 2;
+    FuncProfile* f = &profile->funcs[mid];
+    const int c = compare_name(f->name, f->len, name->buffer + name->pos, name->len);
+    if( c == 0 ) return f;
+    if( c < 0 ) lo = mid + 1;
+    else hi = mid;
+  }
+  return NULL;
+}
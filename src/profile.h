@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tokenizer.h"
+#include "util.h"
+
+// 計装したプログラムが書き出すプロファイル。1行に1関数で
+//   <関数名> <呼ばれた回数> <分岐0のtrue> <分岐0のfalse> <分岐1のtrue> ...
+// 分岐の番号は関数の中でif/loop/forが現れる順(前順)。
+typedef struct {
+  const char* name;
+  size_t len;
+  uint64_t* counts;
+  size_t size;
+} FuncProfile;
+
+typedef struct {
+  FuncProfile* funcs; // 名前順
+  size_t size;
+} Profile;
+
+bool parse_profile(Arena* arena, const char* text, size_t len, Profile* profile, Error* error);
+FuncProfile* find_func_profile(Profile* profile, Token* name);
@@ -0,0 +1,407 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "compiler.h"
+#include "util.h"
+
+// 1回の要求で受け付けるソースの最大サイズ
+#define MAX_REQUEST_SIZE (64 * 1024 * 1024)
+#define MAX_HEADER_SIZE (64)
+#define READER_BUFFER_SIZE (4096)
+#define LISTEN_BACKLOG (128)
+
+// 終了要求が来たか。シグナルハンドラかシグナル待ちのスレッドから立てる
+static volatile sig_atomic_t stopping = 0;
+
+// 標準入出力で動くときだけ使う。止まっているreadをEINTRで抜けさせる
+static void on_signal(int signo) {
+  (void)signo;
+  stopping = 1;
+}
+
+// ------------------------------------------------------------------ 入出力
+
+// 1バイトずつreadすると遅いので、まとめて読んでおく
+typedef struct {
+  int fd;
+  char data[READER_BUFFER_SIZE];
+  size_t pos;
+  size_t len;
+} Reader;
+
+static bool fill(Reader* r) {
+  for( ; ; ) {
+    const ssize_t n = read(r->fd, r->data, sizeof(r->data));
+    if( n > 0 ) {
+      r->pos = 0;
+      r->len = (size_t)n;
+      return true;
+    }
+    if( n < 0 && errno == EINTR && !stopping ) continue;
+    return false;
+  }
+}
+
+// 改行までを読む(改行は含めない)。sizeに収まらなければtoo_longを立ててfalseを返す
+static bool read_line(Reader* r, char* line, size_t size, bool* too_long) {
+  size_t i = 0;
+  for( ; ; ) {
+    if( r->pos == r->len && !fill(r) ) return false;
+    const char c = r->data[r->pos++];
+    if( c == '\n' ) break;
+    if( i + 1 >= size ) {
+      *too_long = true;
+      return false;
+    }
+    line[i++] = c;
+  }
+  line[i] = '\0';
+  return true;
+}
+
+static bool read_exact(Reader* r, Buffer* out, size_t size) {
+  reserve_buffer(out, size + 1);
+  while( size > 0 ) {
+    if( r->pos == r->len && !fill(r) ) return false;
+    size_t n = r->len - r->pos;
+    if( n > size ) n = size;
+    append_buffer(out, r->data + r->pos, n);
+    r->pos += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool write_all(int fd, const char* data, size_t size) {
+  while( size > 0 ) {
+    const ssize_t n = write(fd, data, size);
+    if( n < 0 ) {
+      if( errno == EINTR ) continue;
+      return false;
+    }
+    data += n;
+    size -= (size_t)n;
+  }
+  return true;
+}
+
+static bool respond(int fd, const char* status, const char* data, size_t size) {
+  char header[MAX_HEADER_SIZE];
+  const int len = snprintf(header, sizeof(header), "%s %zu\n", status, size);
+  return write_all(fd, header, (size_t)len) && write_all(fd, data, size);
+}
+
+// ------------------------------------------------------------------ 統計
+
+typedef struct {
+  pthread_mutex_t lock;
+  double* latencies; // マイクロ秒
+  size_t size;
+  size_t capacity;
+  size_t failures;
+} Stats;
+
+static double elapsed_us(const struct timespec* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void record_latency(Stats* stats, double us, bool ok) {
+  pthread_mutex_lock(&stats->lock);
+  if( stats->size == stats->capacity ) {
+    stats->capacity = stats->capacity ? stats->capacity * 2 : 1024;
+    stats->latencies = (double*)realloc(stats->latencies, sizeof(double) * stats->capacity);
+  }
+  stats->latencies[stats->size++] = us;
+  if( !ok ) ++(stats->failures);
+  pthread_mutex_unlock(&stats->lock);
+}
+
+static int compare_double(const void* lhs, const void* rhs) {
+  const double l = *(const double*)lhs;
+  const double r = *(const double*)rhs;
+  return (l > r) - (l < r);
+}
+
+// nearest-rank法でのパーセンタイル
+static double percentile(const double* sorted, size_t size, size_t p) {
+  const size_t rank = (size * p + 99) / 100;
+  return sorted[rank ? rank - 1 : 0];
+}
+
+static void format_stats(Stats* stats, Buffer* out) {
+  pthread_mutex_lock(&stats->lock);
+  const size_t size = stats->size;
+  const size_t failures = stats->failures;
+  double* sorted = (double*)malloc(sizeof(double) * (size ? size : 1));
+  if( size ) memcpy(sorted, stats->latencies, sizeof(double) * size);
+  pthread_mutex_unlock(&stats->lock);
+
+  buffer_printf(out, "requests: %zu, failed: %zu", size, failures);
+  if( size ) {
+    qsort(sorted, size, sizeof(double), compare_double);
+    double sum = 0;
+    for( size_t i = 0; i < size; ++i ) sum += sorted[i];
+    buffer_printf(out, ", mean: %.1fus, p50: %.1fus, p90: %.1fus, p99: %.1fus, max: %.1fus",
+      sum / size, percentile(sorted, size, 50), percentile(sorted, size, 90), percentile(sorted, size, 99), sorted[size - 1]);
+  }
+  buffer_printf(out, "\n");
+  free(sorted);
+}
+
+// ------------------------------------------------------------------ 要求の処理
+
+// 1本の接続から要求を読めなくなるまで処理する
+static void serve_connection(Stats* stats, Compiler* compiler, int in_fd, int out_fd) {
+  Reader reader = { .fd = in_fd, .pos = 0, .len = 0 };
+  Buffer source;
+  init_buffer(&source);
+
+  char line[MAX_HEADER_SIZE];
+  bool too_long = false;
+  while( !stopping && read_line(&reader, line, sizeof(line), &too_long) ) {
+    // 空行は読み飛ばす
+    if( line[0] == '\0' ) continue;
+    if( strcmp(line, "stats") == 0 ) {
+      Buffer text;
+      init_buffer(&text);
+      format_stats(stats, &text);
+      const bool ok = respond(out_fd, "ok", text.data, text.size);
+      free_buffer(&text);
+      if( !ok ) break;
+      continue;
+    }
+
+    bool bitcode;
+    const char* size_str;
+    if( strncmp(line, "compile ", 8) == 0 ) {
+      bitcode = false;
+      size_str = line + 8;
+    } else if( strncmp(line, "bitcode ", 8) == 0 ) {
+      bitcode = true;
+      size_str = line + 8;
+    } else {
+      // 区切りがわからなくなったので、この接続はもう読めない
+      const char* message = "unknown request";
+      respond(out_fd, "error", message, strlen(message));
+      break;
+    }
+    char* end;
+    const unsigned long long size = strtoull(size_str, &end, 10);
+    if( end == size_str || *end != '\0' || size > MAX_REQUEST_SIZE ) {
+      const char* message = "invalid request size";
+      respond(out_fd, "error", message, strlen(message));
+      break;
+    }
+
+    clear_buffer(&source);
+    if( !read_exact(&reader, &source, (size_t)size) ) break;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    compiler->bitcode = bitcode;
+    const bool ok = compile(compiler, source.data, source.size);
+    const bool sent = ok
+      ? respond(out_fd, "ok", compiler->output.data, compiler->output.size)
+      : respond(out_fd, "error", compiler->error.message, strlen(compiler->error.message));
+    record_latency(stats, elapsed_us(&start), ok);
+    if( !sent ) break;
+  }
+  if( too_long ) {
+    // 区切りがわからなくなったので、理由を返してからこの接続を閉じる
+    const char* message = "header too long";
+    respond(out_fd, "error", message, strlen(message));
+  }
+
+  free_buffer(&source);
+}
+
+// ソケットで動くときは、シグナルを全スレッドで止めておいて専用のスレッドがsigwaitで受ける。
+// ハンドラの中ではロックを取れないので、接続を閉じるのと起こすのが入れ違わないように
+// 普通のスレッドで受けてConnections::lockの下で触る
+typedef struct {
+  pthread_mutex_t lock;
+  int listen_fd;
+  int* fds;        // workerごとに今つないでいる接続のfd。無ければ-1
+  size_t size;
+} Connections;
+
+typedef struct {
+  Stats* stats;
+  Connections* connections;
+  size_t slot;     // connections->fdsの添字
+} Worker;
+
+typedef struct {
+  Connections* connections;
+  sigset_t signals;
+} SignalWaiter;
+
+static void* wait_signal(void* arg) {
+  SignalWaiter* waiter = (SignalWaiter*)arg;
+  Connections* connections = waiter->connections;
+  int signo;
+  while( sigwait(&waiter->signals, &signo) != 0 ) {}
+
+  pthread_mutex_lock(&connections->lock);
+  stopping = 1;
+  // acceptで止まっているworkerを起こす
+  shutdown(connections->listen_fd, SHUT_RDWR);
+  // 接続のreadで止まっているworkerも、接続を閉じて起こす
+  for( size_t i = 0; i < connections->size; ++i ) {
+    if( connections->fds[i] >= 0 ) shutdown(connections->fds[i], SHUT_RDWR);
+  }
+  pthread_mutex_unlock(&connections->lock);
+  return NULL;
+}
+
+static void* run_worker(void* arg) {
+  Worker* worker = (Worker*)arg;
+  Connections* connections = worker->connections;
+  // Compilerはworkerごとに持って、接続をまたいで使い回す
+  Compiler compiler;
+  init_compiler(&compiler, false, false);
+
+  while( !stopping ) {
+    const int fd = accept(connections->listen_fd, NULL, NULL);
+    if( fd < 0 ) {
+      if( errno == EINTR || errno == ECONNABORTED ) continue;
+      // shutdownされた
+      break;
+    }
+    // 登録と止まっているかの確認をロックの下でやれば、シグナルと入れ違っても取りこぼさない
+    pthread_mutex_lock(&connections->lock);
+    const bool stopped = stopping;
+    if( !stopped ) connections->fds[worker->slot] = fd;
+    pthread_mutex_unlock(&connections->lock);
+    if( !stopped ) serve_connection(worker->stats, &compiler, fd, fd);
+    // closeしたfdの番号が使い回されてからshutdownされないように、外すのと閉じるのは一緒にやる
+    pthread_mutex_lock(&connections->lock);
+    connections->fds[worker->slot] = -1;
+    close(fd);
+    pthread_mutex_unlock(&connections->lock);
+  }
+
+  free_compiler(&compiler);
+  return NULL;
+}
+
+static int open_socket(const char* path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if( strlen(path) >= sizeof(addr.sun_path) ) {
+    fprintf(stderr, "Socket path is too long.\n");
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if( fd < 0 ) {
+    perror("socket");
+    return -1;
+  }
+  unlink(path);
+  if( bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, LISTEN_BACKLOG) < 0 ) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int run_server(const char* path, size_t workers) {
+  // 相手が先に切断してもwriteの失敗として扱う
+  signal(SIGPIPE, SIG_IGN);
+
+  Stats stats = { .latencies = NULL, .size = 0, .capacity = 0, .failures = 0 };
+  pthread_mutex_init(&stats.lock, NULL);
+
+  if( strcmp(path, "-") == 0 ) {
+    // SA_RESTARTを付けないことで、止まっているreadをEINTRで抜けさせる
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    Compiler compiler;
+    init_compiler(&compiler, false, false);
+    serve_connection(&stats, &compiler, STDIN_FILENO, STDOUT_FILENO);
+    free_compiler(&compiler);
+  } else {
+    const int fd = open_socket(path);
+    if( fd < 0 ) return EXIT_FAILURE;
+
+    // 以降に作るスレッドはこのマスクを引き継ぐので、シグナルはwait_signalだけが受ける
+    SignalWaiter waiter;
+    sigemptyset(&waiter.signals);
+    sigaddset(&waiter.signals, SIGINT);
+    sigaddset(&waiter.signals, SIGTERM);
+    sigset_t old_signals;
+    pthread_sigmask(SIG_BLOCK, &waiter.signals, &old_signals);
+
+    if( workers == 0 ) workers = 1;
+    Connections connections = { .listen_fd = fd, .size = workers };
+    pthread_mutex_init(&connections.lock, NULL);
+    connections.fds = (int*)malloc(sizeof(int) * workers);
+    waiter.connections = &connections;
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * workers);
+    Worker* slots = (Worker*)malloc(sizeof(Worker) * workers);
+    for( size_t i = 0; i < workers; ++i ) {
+      connections.fds[i] = -1;
+      slots[i] = (Worker){ .stats = &stats, .connections = &connections, .slot = i };
+    }
+    pthread_t signal_thread;
+    const bool waiting = pthread_create(&signal_thread, NULL, wait_signal, &waiter) == 0;
+    size_t started = 0;
+    if( waiting ) {
+      for( ; started < workers; ++started ) {
+        if( pthread_create(&threads[started], NULL, run_worker, &slots[started]) != 0 ) break;
+      }
+    }
+    if( started == 0 ) {
+      fprintf(stderr, "Can't start workers.\n");
+      stopping = 1;
+    }
+    for( size_t i = 0; i < started; ++i ) {
+      pthread_join(threads[i], NULL);
+    }
+    if( waiting ) {
+      // シグナル以外でworkerが止まったときは、待っているスレッドを自分で起こす
+      pthread_kill(signal_thread, SIGTERM);
+      pthread_join(signal_thread, NULL);
+    }
+    free(threads);
+    free(slots);
+    free(connections.fds);
+    pthread_mutex_destroy(&connections.lock);
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    close(fd);
+    unlink(path);
+  }
+
+  Buffer text;
+  init_buffer(&text);
+  format_stats(&stats, &text);
+  fprintf(stderr, "%s", text.data);
+  free_buffer(&text);
+
+  free(stats.latencies);
+  pthread_mutex_destroy(&stats.lock);
+  return 0;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+
+// 常駐してコンパイル要求を受け付ける。
+// pathが"-"ならstdin/stdoutで1本の接続として、
+// それ以外ならそのパスのUnix domain socketで待ち受けて、workers個のスレッドで並行に処理する。
+//
+// 要求:  "compile <len>\n" <len bytesのソース>   テキストのIRを返す
+//        "bitcode <len>\n" <len bytesのソース>   bitcodeを返す
+//        "stats\n"                                レイテンシの統計を返す
+// 応答:  "ok <len>\n" <len bytes> か "error <len>\n" <len bytesのメッセージ>
+//
+// SIGINT/SIGTERM(stdinならEOF)で終了し、終了時に統計をstderrに出す。
+int run_server(const char* path, size_t workers);
@@ -2,12 +2,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <string.h>
 
 #include "tokenizer.h"
 #include "util.h"
 
-Token* create_token(TokenType type, const char* buffer, size_t pos, size_t len) {
-  Token* token = (Token*)malloc(sizeof(Token));
+Token* create_token(Arena* arena, TokenType type, const char* buffer, size_t pos, size_t len) {
+  Token* token = (Token*)arena_alloc(arena, sizeof(Token));
   token->type = type;
   token->buffer = buffer;
   token->pos = pos;
@@ -16,32 +18,44 @@ Token* create_token(TokenType type, const char* buffer, size_t pos, size_t len)
   return token;
 }
 
-typedef struct {
+// 2つのtokenが同じ文字列を指しているか
+bool token_equals(Token* lhs, Token* rhs) {
+  if( lhs->len != rhs->len ) return false;
+  return memcmp(lhs->buffer + lhs->pos, rhs->buffer + rhs->pos, lhs->len) == 0;
+}
+
+int compare_tokens(Token* lhs, Token* rhs) {
+  const int c = memcmp(lhs->buffer + lhs->pos, rhs->buffer + rhs->pos, lhs->len < rhs->len ? lhs->len : rhs->len);
+  if( c != 0 ) return c;
+  return (lhs->len > rhs->len) - (lhs->len < rhs->len);
+}
+
+struct tTokenizer {
+  Arena* arena;
+  Error* error;
   const char* buffer;
-  Token* root;
-  Token* current;
+  Token* token; // 最後に読んだtoken
   size_t pos;
   size_t len;
-} Tokenizer;
+};
 
-static Tokenizer* create_tokenizer(const char* buffer, size_t len) {
+Tokenizer* create_tokenizer(Arena* arena, const char* buffer, size_t len, Error* error) {
   // ステートマシンとして全体の処理を行う
-  Tokenizer* tn = (Tokenizer*)malloc(sizeof(Tokenizer));
+  Tokenizer* tn = (Tokenizer*)arena_alloc(arena, sizeof(Tokenizer));
 
+  tn->arena = arena;
+  tn->error = error;
   tn->buffer = buffer;
-
-  // トークンは常に0文字目のTT_ROOTから
-  // 始まってると考えることにして
-  // 何かと楽をしましょう。
-  tn->current = tn->root = create_token(TT_ROOT, buffer, 0, 0);
-
+  tn->token = NULL;
   tn->pos = 0;
   tn->len = len;
 
   return tn;
 }
 
-char read(Tokenizer* tn, size_t diff) {
+// 入力の終わりより先は'\0'が続いているものとして扱う
+static char read(Tokenizer* tn, size_t diff) {
+  if( tn->pos + diff >= tn->len ) return '\0';
   return *(tn->buffer + tn->pos + diff);
 }
 
@@ -50,15 +64,12 @@ static void skip(Tokenizer* tn, size_t size) {
 }
 
 static void accept(Tokenizer* tn, TokenType type, size_t size) {
-  Token* t = create_token(type, tn->buffer, tn->pos, size);
-  tn->current->next = t;
-  tn->current = t;
+  tn->token = create_token(tn->arena, type, tn->buffer, tn->pos, size);
   skip(tn, size);
 }
 
 static void error(Tokenizer* tn, char c) {
-  fprintf(stderr, "Tokenize中に予想外の文字(%zu文字目の'%c')が着てしまいました。\n", tn->pos, c);
-  exit(EXIT_FAILURE);
+  set_error(tn->error, tn->pos, "Tokenize中に予想外の文字(%zu文字目の'%c')が着てしまいました。", tn->pos, c);
 }
 
 typedef struct {
@@ -67,7 +78,7 @@ typedef struct {
   TokenType type;
 } Reserved;
 
-bool skip_space(Tokenizer* tn) {
+static bool skip_space(Tokenizer* tn) {
   char c = read(tn, 0);
   if( ' ' == c || '\t' == c || '\r' == c || '\n' == c ) {
     skip(tn, 1);
@@ -79,11 +90,17 @@ bool skip_space(Tokenizer* tn) {
 
 static const Reserved reserved[] = {
   { 6, "return", TT_RETURN },
+  { 6, "parfor", TT_PARFOR },
+  { 5, "yield", TT_YIELD },
   { 4, "loop", TT_LOOP },
   { 4, "else", TT_ELSE },
   { 3, "let", TT_LET },
   { 3, "fun", TT_FUN },
+  { 3, "gen", TT_GEN },
+  { 3, "for", TT_FOR },
   { 2, "if", TT_IF },
+  { 2, "in", TT_IN },
+  { 2, "..", TT_DOTDOT },
   { 2, "==", TT_EQUAL },
   { 2, "!=", TT_NOT_EQUAL },
   { 2, "<=", TT_LTEQ },
@@ -105,7 +122,7 @@ static const Reserved reserved[] = {
   { 1, ",", TT_COMMA },
 };
 
-bool match_reserved(Tokenizer* tn) {
+static bool match_reserved(Tokenizer* tn) {
   for( size_t i = 0; i < (sizeof(reserved) / sizeof(Reserved)); ++i ) {
     const Reserved r = reserved[ i ];
 
@@ -123,7 +140,7 @@ bool match_reserved(Tokenizer* tn) {
   return false;
 }
 
-bool match_num(Tokenizer* tn) {
+static bool match_num(Tokenizer* tn) {
   if( !isdigit( read( tn, 0 ) ) ) return false;
 
   size_t size;
@@ -132,7 +149,7 @@ bool match_num(Tokenizer* tn) {
   return true;
 }
 
-bool match_ident(Tokenizer* tn) {
+static bool match_ident(Tokenizer* tn) {
   if( !isalpha( read( tn, 0 ) ) ) return false;
 
   size_t size;
@@ -141,19 +158,180 @@ bool match_ident(Tokenizer* tn) {
   return true;
 }
 
-Token* tokenize(const char* buffer, size_t len) {
-  Tokenizer* tn = create_tokenizer(buffer, len);
-
+Token* next_token(Tokenizer* tn) {
   while( read( tn, 0 ) != '\0' ) {
     if( skip_space( tn ) ) continue;
-    if( match_reserved( tn ) ) continue;
-    if( match_num( tn ) ) continue;
-    if( match_ident( tn ) ) continue;
+    if( match_reserved( tn ) ) return tn->token;
+    if( match_num( tn ) ) return tn->token;
+    if( match_ident( tn ) ) return tn->token;
+    // 読めない文字はエラーにして、そこで入力が終わったことにする
     error( tn, read( tn, 0 ) );
+    break;
+  }
+
+  // 位置は進めないので、何度呼んでもEOFが返る
+  return create_token( tn->arena, TT_EOF, tn->buffer, tn->pos, 1 );
+}
+
+Token* tokenize(Arena* arena, const char* buffer, size_t len, Error* err) {
+  Tokenizer* tn = create_tokenizer(arena, buffer, len, err);
+
+  // トークンは常に0文字目のTT_ROOTから
+  // 始まってると考えることにして
+  // 何かと楽をしましょう。
+  Token* root = create_token(arena, TT_ROOT, buffer, 0, 0);
+  for( Token* last = root; last->type != TT_EOF; last = last->next ) {
+    last->next = next_token(tn);
+    if( err->failed ) return NULL;
   }
+  return root;
+}
 
-  accept( tn, TT_EOF, 1 );
-  return tn->root;
+// ------------------------------------------------------------------ 並行に読む
+
+// これより小さい入力は分けずに読む
+#define TOKENIZE_PARALLEL_MIN (1024 * 1024)
+// 1つのchunkの大きさの下限と、スレッドあたりのchunkの数の目安
+#define TOKENIZE_CHUNK_MIN (64 * 1024)
+#define TOKENIZE_CHUNKS_PER_THREAD (4)
+#define TOKENIZE_MAX_THREADS (64)
+#define TOKENIZE_MAX_CHUNKS (TOKENIZE_MAX_THREADS * TOKENIZE_CHUNKS_PER_THREAD)
+
+// 入力の[begin, end)を読んだ結果
+typedef struct {
+  size_t begin;
+  size_t end;
+  Token* first; // 空ならNULL
+  Token* last;
+  size_t stop;  // 読み終えた位置。endより手前なら、そこで入力が終わったことになる
+  Error error;
+} Chunk;
+
+typedef struct {
+  const char* buffer;
+  Chunk* chunks;
+  size_t size;
+  pthread_mutex_t lock;
+  size_t next;  // 次に読むchunk
+} Split;
+
+typedef struct {
+  Split* split;
+  Arena arena;  // このスレッドで作ったtoken。最後に呼び出し側のArenaに移す
+} Lexer;
+
+static bool is_word_char(char c) {
+  return isalnum((unsigned char)c) != 0;
+}
+
+// 括弧の深さが0のところにあるfunの位置で、だいたいtargetずつに分ける。
+// funの前は英数字でなく、英数字以外とfで始まるtokenは無いので、分け目をまたぐtokenは無い
+static size_t split_chunks(const char* buffer, size_t len, size_t target, size_t* starts) {
+  size_t size = 0;
+  starts[size++] = 0;
+  long depth = 0;
+  size_t next = target;
+  for( size_t i = 0; i < len && size < TOKENIZE_MAX_CHUNKS; ++i ) {
+    const char c = buffer[i];
+    if( c == '{' ) {
+      ++depth;
+    } else if( c == '}' ) {
+      --depth;
+    } else if( c == 'f' && i >= next && depth == 0 && i + 3 <= len && buffer[i + 1] == 'u' && buffer[i + 2] == 'n'
+      && !is_word_char(buffer[i - 1]) && (i + 3 == len || !is_word_char(buffer[i + 3])) ) {
+      starts[size++] = i;
+      next = i + target;
+    }
+  }
+  return size;
+}
+
+static void lex_chunk(Arena* arena, const char* buffer, Chunk* chunk) {
+  init_error(&chunk->error);
+  Tokenizer tn = { .arena = arena, .error = &chunk->error, .buffer = buffer, .token = NULL, .pos = chunk->begin, .len = chunk->end };
+  chunk->first = chunk->last = NULL;
+  for( ; ; ) {
+    Token* token = next_token(&tn);
+    if( token->type == TT_EOF ) break;
+    if( chunk->last ) chunk->last->next = token;
+    else chunk->first = token;
+    chunk->last = token;
+  }
+  chunk->stop = tn.pos;
+}
+
+static void* run_lexer(void* arg) {
+  Lexer* lexer = (Lexer*)arg;
+  Split* split = lexer->split;
+  for( ; ; ) {
+    pthread_mutex_lock(&split->lock);
+    const size_t i = split->next++;
+    pthread_mutex_unlock(&split->lock);
+    if( i >= split->size ) break;
+    lex_chunk(&lexer->arena, split->buffer, &split->chunks[i]);
+  }
+  return NULL;
+}
+
+Token* tokenize_parallel(Arena* arena, const char* buffer, size_t len, size_t threads, Error* err) {
+  if( threads > TOKENIZE_MAX_THREADS ) threads = TOKENIZE_MAX_THREADS;
+  if( threads < 2 || len < TOKENIZE_PARALLEL_MIN ) return tokenize(arena, buffer, len, err);
+
+  size_t target = len / (threads * TOKENIZE_CHUNKS_PER_THREAD);
+  if( target < TOKENIZE_CHUNK_MIN ) target = TOKENIZE_CHUNK_MIN;
+  size_t starts[TOKENIZE_MAX_CHUNKS];
+  const size_t size = split_chunks(buffer, len, target, starts);
+  // 分けられなければ普通に読む
+  if( size < 2 ) return tokenize(arena, buffer, len, err);
+
+  Split split = { .buffer = buffer, .size = size, .next = 0 };
+  split.chunks = (Chunk*)arena_alloc(arena, sizeof(Chunk) * size);
+  for( size_t i = 0; i < size; ++i ) {
+    split.chunks[i].begin = starts[i];
+    split.chunks[i].end = i + 1 < size ? starts[i + 1] : len;
+  }
+  pthread_mutex_init(&split.lock, NULL);
+
+  // 呼び出したスレッドもlexers[0]として読む
+  if( threads > size ) threads = size;
+  Lexer lexers[TOKENIZE_MAX_THREADS];
+  pthread_t ids[TOKENIZE_MAX_THREADS];
+  for( size_t i = 0; i < threads; ++i ) {
+    lexers[i].split = &split;
+    init_arena(&lexers[i].arena);
+  }
+  size_t started = 1;
+  for( ; started < threads; ++started ) {
+    if( pthread_create(&ids[started], NULL, run_lexer, &lexers[started]) != 0 ) break;
+  }
+  run_lexer(&lexers[0]);
+  for( size_t i = 1; i < started; ++i ) {
+    pthread_join(ids[i], NULL);
+  }
+  pthread_mutex_destroy(&split.lock);
+  for( size_t i = 0; i < threads; ++i ) {
+    arena_adopt(arena, &lexers[i].arena);
+  }
+
+  // chunkの列を順に繋ぐ。途中で終わったchunkがあれば、1つで読んだときと同じくそこで終わり
+  Token* root = create_token(arena, TT_ROOT, buffer, 0, 0);
+  Token* last = root;
+  size_t eof = len;
+  for( size_t i = 0; i < size; ++i ) {
+    Chunk* chunk = &split.chunks[i];
+    if( chunk->first ) {
+      last->next = chunk->first;
+      last = chunk->last;
+    }
+    if( chunk->stop < chunk->end ) {
+      eof = chunk->stop;
+      if( chunk->error.failed ) *err = chunk->error;
+      break;
+    }
+  }
+  if( err->failed ) return NULL;
+  last->next = create_token(arena, TT_EOF, buffer, eof, 1);
+  return root;
 }
 
 // 指定されたtokenから先のtokenのメモリをすべて開放する
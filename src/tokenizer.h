@@ -1,5 +1,10 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "util.h"
+
 typedef enum {
   // メタなtoken
   TT_ROOT, // ROOTトークン。tokenizerの実装を簡単にするのに最初に必ず入っている
@@ -9,6 +14,10 @@ typedef enum {
   TT_IF,
   TT_ELSE,
   TT_LOOP,
+  TT_FOR,
+  TT_PARFOR,
+  TT_IN,
+  TT_DOTDOT,
   TT_NUM,
   TT_PLUS,
   TT_MINUS,
@@ -17,6 +26,8 @@ typedef enum {
   TT_LET,
   TT_RETURN,
   TT_FUN,
+  TT_GEN,
+  TT_YIELD,
   TT_LEFT_PAREN,
   TT_RIGHT_PAREN,
   TT_LEFT_BRACKET,
@@ -43,7 +54,20 @@ typedef struct tToken {
   struct tToken* next;
 } Token;
 
-Token* tokenize(const char* buffer, size_t len);
-Token* create_token(TokenType type, const char* buffer, size_t pos, size_t len);
+// 入力全体を先に読んで、TT_ROOTから始まりTT_EOFで終わるtokenの列を作る
+Token* tokenize(Arena* arena, const char* buffer, size_t len, Error* error);
+// tokenizeと同じ列を作る。入力が大きければ、括弧の外のfunの位置で分けてthreads個のスレッドで並行に読み、
+// 後で繋ぐ。threadsが1以下なら分けない
+Token* tokenize_parallel(Arena* arena, const char* buffer, size_t len, size_t threads, Error* error);
+
+// tokenを1つずつ取り出すためのもの。tokenはarenaに作る
+typedef struct tTokenizer Tokenizer;
+Tokenizer* create_tokenizer(Arena* arena, const char* buffer, size_t len, Error* error);
+// 次のtokenを読む。tokenどうしは繋がない。入力の終わりか読めない文字に来たら、以降はずっとTT_EOFを返す
+Token* next_token(Tokenizer* tn);
+Token* create_token(Arena* arena, TokenType type, const char* buffer, size_t pos, size_t len);
+bool token_equals(Token* lhs, Token* rhs);
+// 名前の辞書順で比べる。名前で二分探索するときに使う
+int compare_tokens(Token* lhs, Token* rhs);
 
 void print_tokens(Token* token);
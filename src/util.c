@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "util.h"
 
@@ -6,3 +8,185 @@ void indent(size_t level) {
   for( size_t i = 0; i < level; ++i )
     fprintf(stderr, "  ");
 }
+
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+#define READ_CHUNK_SIZE (65536)
+#define ARENA_ALIGN (16)
+
+// chunkのヘッダの直後からが使える領域
+#define ARENA_HEADER_SIZE ((sizeof(ArenaChunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static char* chunk_data(ArenaChunk* chunk) {
+  return (char*)chunk + ARENA_HEADER_SIZE;
+}
+
+void init_arena(Arena* arena) {
+  arena->head = NULL;
+  arena->current = NULL;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  // 今のchunkに入らなければ、後ろの使っていないchunkを探す
+  ArenaChunk* chunk = arena->current;
+  while( chunk && chunk->used + size > chunk->size ) {
+    chunk = chunk->next;
+    if( chunk ) chunk->used = 0;
+  }
+
+  if( !chunk ) {
+    const size_t data_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+    chunk = (ArenaChunk*)malloc(ARENA_HEADER_SIZE + data_size);
+    chunk->size = data_size;
+    chunk->used = 0;
+    // 今のchunkの直後に繋ぐ
+    if( arena->current ) {
+      chunk->next = arena->current->next;
+      arena->current->next = chunk;
+    } else {
+      chunk->next = arena->head;
+      arena->head = chunk;
+    }
+  }
+
+  arena->current = chunk;
+  void* p = chunk_data(chunk) + chunk->used;
+  chunk->used += size;
+  return p;
+}
+
+void reset_arena(Arena* arena) {
+  arena->current = arena->head;
+  if( arena->head ) arena->head->used = 0;
+}
+
+ArenaMark arena_mark(Arena* arena) {
+  ArenaMark mark = { arena->current, arena->current ? arena->current->used : 0 };
+  return mark;
+}
+
+void arena_release(Arena* arena, ArenaMark mark) {
+  if( !mark.chunk ) {
+    reset_arena(arena);
+    return;
+  }
+  arena->current = mark.chunk;
+  mark.chunk->used = mark.used;
+}
+
+void arena_adopt(Arena* arena, Arena* other) {
+  if( !other->head ) return;
+  ArenaChunk* tail = other->head;
+  while( tail->next ) tail = tail->next;
+  // 今のchunkの後ろに差し込んで、otherで使っていたところまでを使用済みにする
+  if( arena->current ) {
+    tail->next = arena->current->next;
+    arena->current->next = other->head;
+  } else {
+    tail->next = arena->head;
+    arena->head = other->head;
+  }
+  arena->current = other->current;
+  init_arena(other);
+}
+
+void free_arena(Arena* arena) {
+  ArenaChunk* chunk = arena->head;
+  while( chunk ) {
+    ArenaChunk* next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  init_arena(arena);
+}
+
+void init_buffer(Buffer* buffer) {
+  buffer->data = NULL;
+  buffer->size = 0;
+  buffer->capacity = 0;
+}
+
+void clear_buffer(Buffer* buffer) {
+  buffer->size = 0;
+}
+
+void reserve_buffer(Buffer* buffer, size_t capacity) {
+  if( capacity <= buffer->capacity ) return;
+  size_t next = buffer->capacity ? buffer->capacity : 4096;
+  while( next < capacity ) next *= 2;
+  buffer->data = (char*)realloc(buffer->data, next);
+  buffer->capacity = next;
+}
+
+void append_buffer(Buffer* buffer, const char* data, size_t size) {
+  reserve_buffer(buffer, buffer->size + size + 1);
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+  buffer->data[buffer->size] = '\0';
+}
+
+void move_buffer_tail(Buffer* buffer, size_t pos, size_t from) {
+  const size_t len = buffer->size - from;
+  if( pos >= from || len == 0 ) return;
+  char* tail = (char*)malloc(len);
+  memcpy(tail, buffer->data + from, len);
+  memmove(buffer->data + pos + len, buffer->data + pos, from - pos);
+  memcpy(buffer->data + pos, tail, len);
+  free(tail);
+}
+
+void buffer_vprintf(Buffer* buffer, const char* format, va_list va) {
+  reserve_buffer(buffer, buffer->size + 256);
+
+  va_list copy;
+  va_copy(copy, va);
+  const int len = vsnprintf(buffer->data + buffer->size, buffer->capacity - buffer->size, format, copy);
+  va_end(copy);
+  if( len < 0 ) return;
+
+  // 入り切らなかったら広げて書き直す
+  if( buffer->size + (size_t)len + 1 > buffer->capacity ) {
+    reserve_buffer(buffer, buffer->size + (size_t)len + 1);
+    vsnprintf(buffer->data + buffer->size, buffer->capacity - buffer->size, format, va);
+  }
+  buffer->size += (size_t)len;
+}
+
+void buffer_printf(Buffer* buffer, const char* format, ...) {
+  va_list va;
+  va_start(va, format);
+  buffer_vprintf(buffer, format, va);
+  va_end(va);
+}
+
+void free_buffer(Buffer* buffer) {
+  free(buffer->data);
+  init_buffer(buffer);
+}
+
+void read_all(FILE* fp, Buffer* buffer) {
+  for( ; ; ) {
+    reserve_buffer(buffer, buffer->size + READ_CHUNK_SIZE);
+    const size_t n = fread(buffer->data + buffer->size, sizeof(char), buffer->capacity - buffer->size - 1, fp);
+    if( n == 0 ) break;
+    buffer->size += n;
+  }
+}
+
+void init_error(Error* error) {
+  error->failed = false;
+  error->pos = 0;
+  error->message[0] = '\0';
+}
+
+void set_error(Error* error, size_t pos, const char* format, ...) {
+  if( error->failed ) return;
+  error->failed = true;
+  error->pos = pos;
+
+  va_list va;
+  va_start(va, format);
+  vsnprintf(error->message, sizeof(error->message), format, va);
+  va_end(va);
+}
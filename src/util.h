@@ -1,3 +1,68 @@
 #pragma once
 
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
 void indent(size_t level);
+
+// 一括で確保して一括で捨てるためのメモリ領域。
+// resetしてもchunkは手放さないので、同じArenaで何度もコンパイルすると
+// 2回目以降はmallocがほぼ起きない。
+typedef struct tArenaChunk {
+  struct tArenaChunk* next;
+  size_t size;
+  size_t used;
+} ArenaChunk;
+
+typedef struct {
+  ArenaChunk* head;
+  ArenaChunk* current;
+} Arena;
+
+// arena_markを取った時点の位置。arena_releaseでそこまで戻せる
+typedef struct {
+  ArenaChunk* chunk;
+  size_t used;
+} ArenaMark;
+
+void init_arena(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size);
+void reset_arena(Arena* arena);
+ArenaMark arena_mark(Arena* arena);
+// markより後に確保したものをまとめて捨てる。chunkは手放さずに使い回す
+void arena_release(Arena* arena, ArenaMark mark);
+// otherのchunkを全部arenaに移す。otherに確保したものは、arenaをresetするまでそのまま使える。
+// 別のスレッドで別のArenaに作ったものを、後から1つのArenaにまとめるときに使う
+void arena_adopt(Arena* arena, Arena* other);
+void free_arena(Arena* arena);
+
+// 伸びるバイト列。clearしても確保済みの領域はそのまま使い回す。
+typedef struct {
+  char* data;
+  size_t size;
+  size_t capacity;
+} Buffer;
+
+void init_buffer(Buffer* buffer);
+void clear_buffer(Buffer* buffer);
+void reserve_buffer(Buffer* buffer, size_t capacity);
+void append_buffer(Buffer* buffer, const char* data, size_t size);
+void buffer_printf(Buffer* buffer, const char* format, ...);
+void buffer_vprintf(Buffer* buffer, const char* format, va_list va);
+void free_buffer(Buffer* buffer);
+// fromから後ろをposの位置に移して、[pos, from)をその後ろにずらす。後から書いたものを前に差し込むときに使う
+void move_buffer_tail(Buffer* buffer, size_t pos, size_t from);
+// fpを最後まで読んでbufferの後ろに足す
+void read_all(FILE* fp, Buffer* buffer);
+
+// コンパイルエラー。最初に起きたものだけを覚えておく。
+typedef struct {
+  bool failed;
+  size_t pos;
+  char message[256];
+} Error;
+
+void init_error(Error* error);
+void set_error(Error* error, size_t pos, const char* format, ...);
@@ -32,6 +32,93 @@ try_except() {
   fi
 }
 
+# 計装して実行したプロファイルを使って、もう一度コンパイルする
+try_pgo() {
+  expected="$1"
+  input="$2"
+
+  rm -f tmp.prof
+  echo "$input" | $TARGET $OPT -G tmp.prof > tmp.ll
+  actual=`lli tmp.ll`
+  if [ "$actual" != "$expected" ]; then
+    echo "$input => $expected expected, but got $actual (instrumented)"
+    exit 1
+  fi
+  echo "$input" | $TARGET $OPT -U tmp.prof > tmp.ll
+  actual=`lli tmp.ll`
+  if [ "$actual" != "$expected" ]; then
+    echo "$input => $expected expected, but got $actual (with profile)"
+    exit 1
+  fi
+  echo "$input => $actual (pgo)"
+}
+
+# プロファイラを埋め込んでも出力が変わらず、stderrに表が出ること
+try_profiler() {
+  expected="$1"
+  input="$2"
+
+  echo "$input" | $TARGET $OPT -p > tmp.ll
+  actual=`lli tmp.ll 2> tmp.profile`
+  if [ "$actual" != "$expected" ]; then
+    echo "$input => $expected expected, but got $actual (profiler)"
+    exit 1
+  fi
+  if ! grep -q "^freq profile: " tmp.profile || ! grep -q " main$" tmp.profile; then
+    echo "$input => profile is not printed"
+    exit 1
+  fi
+  echo "$input => $actual (profiler)"
+}
+
+# ワーカーの数を変えても結果が変わらないこと
+try_threads() {
+  expected="$1"
+  input="$2"
+
+  echo "$input" | $TARGET $OPT > tmp.ll
+  for threads in 1 2 4 7; do
+    actual=`FREQ_THREADS=$threads lli tmp.ll`
+    if [ "$actual" != "$expected" ]; then
+      echo "$input => $expected expected, but got $actual ($threads threads)"
+      exit 1
+    fi
+  done
+  echo "$input => $actual (threads)"
+}
+
+# 関数ごとに出力(-S)しても結果が変わらないこと
+try_stream() {
+  expected="$1"
+  input="$2"
+
+  echo "$input" | $TARGET -S > tmp.ll
+  actual=`lli tmp.ll`
+
+  if [ "$actual" == "$expected" ]; then
+    echo "$input => $actual (stream)"
+  else
+    echo "$input => $expected expected, but got $actual (stream)"
+    exit 1
+  fi
+}
+
+# ifをselectにする上限を変えても結果が変わらないこと
+try_select() {
+  expected="$1"
+  input="$2"
+
+  for cost in 0 2 8 100; do
+    echo "$input" | $TARGET $OPT -C $cost > tmp.ll
+    actual=`lli tmp.ll`
+    if [ "$actual" != "$expected" ]; then
+      echo "$input => $expected expected, but got $actual (-C $cost)"
+      exit 1
+    fi
+  done
+  echo "$input => $actual (select)"
+}
+
 try_file() {
   expected="$1"
   input="$2"
@@ -47,6 +134,90 @@ try_file() {
   fi
 }
 
+try_input() {
+  expected="$1"
+  stdin="$2"
+  input="$3"
+
+  echo "$input" | $TARGET $OPT > tmp.ll
+  actual=`printf -- "$stdin" | lli tmp.ll`
+
+  if [ "$actual" == "$expected" ]; then
+    echo "$input < $stdin => $actual"
+  else
+    echo "$input < $stdin => $expected expected, but got $actual"
+    exit 1
+  fi
+}
+
+# -bで書いたbitcodeが、テキストのIRをllvm-asに通したものと同じモジュールになること。
+# 値の名前はbitcodeに書かないので、どちらもopt -stripで消してから比べる
+try_bitcode() {
+  flags="$1"
+  input="$2"
+
+  echo "$input" | $TARGET $flags > tmp.ll
+  echo "$input" | $TARGET -b $flags > tmp.bc
+  llvm-as tmp.ll -o - | opt -strip -o - | llvm-dis -o - | grep -v "^; ModuleID\|^source_filename" > tmp.expected.ll
+  opt -strip tmp.bc -o - | llvm-dis -o - | grep -v "^; ModuleID\|^source_filename" > tmp.actual.ll
+  if ! diff tmp.expected.ll tmp.actual.ll > /dev/null; then
+    echo "$input ($flags) => bitcode differs from the text IR"
+    diff tmp.expected.ll tmp.actual.ll | head -20
+    exit 1
+  fi
+  echo "$input ($flags) => same module"
+}
+
+# サーバモード(-s -)に同じ要求を2回送って、2回目の応答を実行する
+try_server() {
+  expected="$1"
+  input="$2"
+  verb=compile
+  if [ "$OPT" == "-b" ]; then verb=bitcode; fi
+
+  { printf "$verb %d\n%s" ${#input} "$input"; printf "$verb %d\n%s" ${#input} "$input"; } \
+    | $TARGET -s - 2>/dev/null > tmp.frames
+  header=`head -n 1 tmp.frames`
+  tail -c +$(( ${#header} + 1 + ${header#* } + 1 )) tmp.frames > tmp.frame
+  header=`head -n 1 tmp.frame`
+  tail -c +$(( ${#header} + 2 )) tmp.frame > tmp.ll
+  actual=`lli tmp.ll`
+
+  if [ "${header% *}" == "ok" ] && [ "$actual" == "$expected" ]; then
+    echo "server: $input => $actual"
+  else
+    echo "server: $input => $expected expected, but got ${header% *} $actual"
+    exit 1
+  fi
+}
+
+try_server_error() {
+  input="$1"
+
+  header=`printf "compile %d\n%s" ${#input} "$input" | $TARGET -s - 2>/dev/null | head -n 1`
+  if [ "${header% *}" == "error" ]; then
+    echo "server: $input return error, correctly"
+  else
+    echo "server: $input should return error, but got $header"
+    exit 1
+  fi
+}
+
+try_lines() {
+  expected="$1"
+  input="$2"
+
+  echo "$input" | $TARGET $OPT > tmp.ll
+  actual=`lli tmp.ll | wc -l | tr -d ' '`
+
+  if [ "$actual" == "$expected" ]; then
+    echo "$input => $actual lines"
+  else
+    echo "$input => $expected lines expected, but got $actual"
+    exit 1
+  fi
+}
+
 # --------- tests for num
 try 0 "fun main(){ print(0) }"
 try 42 "fun main(){ print(42) }"
@@ -212,4 +383,436 @@ try "2
 1
 0" "fun main() { let a = 3; loop if (a != 0) { a = a - 1; print(a) } }"
 
+try "1
+0" "fun main() { let a = 2; loop { let b = a - 1; a = b; print(a) } }"
+
+# --------- tests for print buffering
+try "-2147483647" "fun main(){ print( -2147483647 ) }"
+try_lines 1000000 "fun main() { let a = 1000000; loop { a = a - 1; print(a); a } }"
+
+# --------- tests for multiple arguments
+try 7 "fun sub(a, b) a - b fun main() { print( sub(10, 3) ) }"
+try 6 "fun three(a, b, c) a + b + c fun main() { print( three(1, 2, 3) ) }"
+
+# --------- tests for function names
+# ランタイムが宣言するlibcの関数と同じ名前でも定義できる
+try 3 "fun write(x) x fun main() print(write(3))"
+try_profiler 5 "fun fprintf(x) x + 1 fun dprintf(x) x * 2 fun main() print( fprintf(dprintf(2)) )"
+try 6 "fun atoi(x) x * 2 fun getenv(x) x fun main() print( parfor i in 0..3 atoi(getenv(i)) )"
+
+# --------- tests for read
+try_input 42 "42" "fun main() { print( read() ) }"
+try_input "-7" "  -7\\n" "fun main() { print( read() ) }"
+try_input 0 "" "fun main() { print( read() ) }"
+try_input 1 "" "fun main() { read(); print( eof() ) }"
+try_input 0 "5" "fun main() { read(); print( eof() ) }"
+# 数字が続かない'-'は読み飛ばす
+try_input "$(printf '5\n0\n0\n1')" "- 5" "fun main() { print( read() ); print( eof() ); print( read() ); print( eof() ) }"
+try_input "$(printf '0\n1')" "-" "fun main() { print( read() ); print( eof() ) }"
+try_input "$(printf -- '-5\n-3\n-4')" "--5 -x -3-4" "fun main() { print( read() ); print( read() ); print( read() ) }"
+try_except "fun read() { 3 } fun main() { print(read()) }"
+try_except "fun eof() 1 fun main() { print(eof()) }"
+try_except "fun print(x) x fun main() print(1)"
+if [ "$OPT" == "" ]; then
+  # 入力を待つ前に、それまでのprintが出ている
+  echo "fun main() { print(1); print( read() ) }" | $TARGET > tmp.ll
+  { sleep 2; echo 2; } | lli tmp.ll > tmp.out &
+  sleep 1
+  if [ "$(cat tmp.out)" != "1" ]; then
+    echo "read: prompt is not flushed before reading"
+    exit 1
+  fi
+  wait
+  echo "read: prompt is flushed => OK"
+fi
+try_input "48
+0" "1 2\\n-3, 48" "fun main() { let s = 0; loop { let x = read(); if (eof()) 0 else { s = s + x; 1 } }; print(s); print(x) }"
+
+# --------- tests for server mode
+try_server 3 "fun main() { print(1+2) }"
+try_server 55 "fun fib(n) if (n < 2) n else fib(n-1) + fib(n-2) fun main() { print( fib(10) ) }"
+try_server_error "fun main("
+try_server_error "fun main() { 1 + }"
+# 長すぎるヘッダにも理由を返してから切る
+actual=`printf "compile %0100d\n" 0 | $TARGET -s - 2>/dev/null`
+if [ "$actual" != "$(printf 'error 15\nheader too long')" ]; then
+  echo "server: too long header should return error, but got $actual"
+  exit 1
+fi
+if [ "$OPT" == "" ]; then
+  # 何も送らずにつないだままのクライアントがいても、SIGTERMで止まる
+  rm -f tmp.sock tmp.connected
+  $TARGET -s tmp.sock -j 2 2>/dev/null &
+  server=$!
+  for i in `seq 1 50`; do [ -S tmp.sock ] && break; sleep 0.1; done
+  perl -MIO::Socket::UNIX -e '$s = IO::Socket::UNIX->new(Peer => "tmp.sock") or die; open(F, ">tmp.connected"); close(F); sleep 10' &
+  client=$!
+  for i in `seq 1 50`; do [ -e tmp.connected ] && break; sleep 0.1; done
+  kill -TERM $server
+  for i in `seq 1 30`; do kill -0 $server 2>/dev/null || break; sleep 0.1; done
+  if kill -0 $server 2>/dev/null; then
+    echo "server: does not stop on SIGTERM while a client is connected"
+    kill -KILL $server $client
+    exit 1
+  fi
+  kill $client 2>/dev/null
+  wait $client 2>/dev/null
+  echo "server: stops on SIGTERM with an idle client"
+fi
+
+# --------- tests for lazy parsing
+try 3 "fun unused() { 1 + } fun main() { print(3) }"
+try 10 "fun a(x) b(x) * 2 fun b(x) { x + 1 } fun main() { print( a(4) ) }"
+try 120 "fun main() { print( fact(5) ) } fun fact(n) if (n < 2) 1 else n * fact(n - 1)"
+try_except "fun f() 1 fun main() { f() 2 }"
+if [ "$OPT" == "" ]; then
+  if echo "fun unused() 1 fun main() print(1)" | $TARGET | grep -q "@fq.unused"; then
+    echo "unreachable function is emitted"
+    exit 1
+  fi
+fi
+
+# --------- tests for for
+try 45 "fun main() { let s = 0; for i in 0..10 s = s + i; print(s) }"
+try 0 "fun main() { let s = 0; for i in 5..5 s = s + 1; print(s) }"
+try 9 "fun main() { for i in 0..10 0; print(i) }"
+try 6 "fun main() { let s = 0; for i in 0..4 for j in 0..i s = s + 1; print(s) }"
+try 30 "fun main() { let s = 0; for i in 0..5 [unroll 2, vectorize 4] s = s + i * 3; print(s) }"
+try 7 "fun main() { print( if (1) { for i in 0..3 { if (i) 1 else 2 }; 7 } else 8 ) }"
+try 3 "fun f(n) { for i in 0..n if (i == 3) return i; 0 } fun main() print( f(10) )"
+try_except "fun main() { for i in 0..3 [inline 2] 0 }"
+try_except "fun main() { for i in 0..3 [unroll 0] 0 }"
+try_except "fun main() { for i in 0..3 [vectorize 2147483648] 0 }"
+try_except "fun main() { for i in 0..3 [vectorize 99999999999999999999] 0 }"
+try_except "fun main() { for i in 0..3 [unroll 2, unroll 3] 0 }"
+try 3 "fun main() { let s = 0; for i in 0..3 [unroll 2147483647, vectorize 1] s = s + i; print(s) }"
+
+# --------- tests for pgo
+try_pgo 1900 "fun f(n) if (n / 10 * 10 == n) 1 else 2 fun main() { let s = 0; for i in 0..1000 s = s + f(i); print(s) }"
+try_pgo 0 "fun main() { let k = 5; loop { k = k - 1; k }; print(k) }"
+try_pgo 55 "fun fib(n) if (n < 2) n else fib(n-1) + fib(n-2) fun main() { print( fib(10) ) }"
+if [ "$OPT" == "" ]; then
+  echo "fun f(n) if (n < 3) 1 else 2 fun main() { for i in 0..10 f(i); print(0) }" > tmp.fq
+  $TARGET -G tmp.prof -i tmp.fq > tmp.ll && lli tmp.ll > /dev/null
+  if ! grep -q "^f 10 3 7$" tmp.prof; then
+    echo "unexpected profile: `cat tmp.prof`"
+    exit 1
+  fi
+  if ! $TARGET -U tmp.prof -i tmp.fq | grep -q 'branch_weights", i32 3, i32 7'; then
+    echo "branch weights are not emitted"
+    exit 1
+  fi
+  echo "f 1 2" > tmp.prof
+  if $TARGET -U tmp.prof -i tmp.fq > /dev/null 2>&1; then
+    echo "mismatched profile is accepted"
+    exit 1
+  fi
+  echo "f x" > tmp.prof
+  if $TARGET -U tmp.prof -i tmp.fq > /dev/null 2>&1; then
+    echo "broken profile is accepted"
+    exit 1
+  fi
+fi
+
+# --------- tests for profiler
+try_profiler 6765 "fun fib(n) if (n < 2) n else fib(n-1) + fib(n-2) fun main() { print( fib(20) ) }"
+try_profiler 18 "fun f(n) { for i in 0..n if (i == 3) return i; 0 } fun main() { let s = 0; for k in 0..10 s = s + f(k); print(s) }"
+try_profiler 3 "fun main() { print(3) }"
+if [ "$OPT" == "" ]; then
+  echo "fun g(n) n * 2 fun f(n) if (n) g(n) + f(n - 1) else 0 fun main() { let n = 3; print( f(n) ) }" > tmp.fq
+  rm -f tmp.stacks
+  $TARGET -P tmp.stacks -G tmp.prof -i tmp.fq > tmp.ll && lli tmp.ll > /dev/null 2> tmp.profile
+  # 呼び出し回数の列
+  if ! grep -qE " 4  f$" tmp.profile || ! grep -qE " 3  g$" tmp.profile; then
+    echo "unexpected call counts: `cat tmp.profile`"
+    exit 1
+  fi
+  if ! grep -qE "^main;f;f;g [0-9]+$" tmp.stacks || grep -qvE "^main(;[fg])* [0-9]+$" tmp.stacks; then
+    echo "unexpected collapsed stacks: `cat tmp.stacks`"
+    exit 1
+  fi
+  if ! grep -q "^f 4 " tmp.prof; then
+    echo "profile is broken with the profiler: `cat tmp.prof`"
+    exit 1
+  fi
+fi
+
+# --------- tests for memoization
+try 102334155 "fun fib(n) if (n < 2) n else fib(n-1) + fib(n-2) fun main() print( fib(40) )"
+try 601080390 "fun paths(r, c) { if (r == 0) return 1; if (c == 0) return 1; paths(r - 1, c) + paths(r, c - 1) } fun main() print( paths(16, 16) )"
+try 1 "fun even(n) if (n == 0) 1 else odd(n - 1) fun odd(n) if (n == 0) 0 else even(n - 1) fun main() print( even(10) )"
+try 200010000 "fun sum(n) if (n == 0) 0 else n + sum(n - 1) fun main() { sum(20000); print( sum(20000) ) }"
+try "$(printf '0\n1\n0')" "fun noisy(n) { print(n); n } fun f(n) if (n < 1) 0 else noisy(0) + f(n - 1) + 0 * noisy(1) fun main() { f(1); print(f(0)) }"
+try "$(printf '3\n3\n0')" "fun f(n) if (n < 1) 0 else { print(3); f(n - 1) } fun main() { f(1); f(1); print(0) }"
+if [ "$OPT" == "" ]; then
+  src="fun fib(n) if (n < 2) n else fib(n-1) + fib(n-2) fun show(n) if (n < 1) 0 else { print(n); show(n - 1) } fun twice(n) n * 2 fun main() { show(fib(twice(3))) }"
+  echo "$src" | $TARGET > tmp.ll
+  if ! grep -q "^@freq.memo.fib " tmp.ll || grep -qE "^@freq.memo.(show|twice|main) " tmp.ll; then
+    echo "only pure recursive functions should be memoized"
+    exit 1
+  fi
+  if echo "$src" | $TARGET -M | grep -q "@freq.memo"; then
+    echo "memoization is not disabled by -M"
+    exit 1
+  fi
+fi
+
+# --------- tests for compile-time evaluation
+try 49 "fun sq(x) x * x fun main() print( sq(7) )"
+try 3 "fun f(n) { for i in 0..n if (i == 3) return i; 0 } fun main() print( f(10) )"
+try 0 "fun w(x) x * 65536 fun main() print( w(65536) )"
+try 55 "fun sum(n) { let s = 0; let i = n; loop { s = s + i; i = i - 1 }; s } fun main() print( sum(10) )"
+try 120 "fun fact(n) if (n < 2) 1 else n * fact(n - 1) fun twice(x) x * 2 fun main() print( fact(twice(1 + 1) + 1) )"
+try 100000 "fun big(n) if (n == 0) 0 else 1 + big(n - 1) fun main() print( big(100000) )"
+try 5 "fun p(x) print(x) fun main() { p(5); 0 }"
+try_except "fun d(x) 10 / x fun main() print( d(0) )"
+if [ "$OPT" == "" ]; then
+  check_calls() {
+    src="$1"
+    callee="$2"
+    expected="$3"
+    actual=`echo "$src" | $TARGET | grep -c "call i32 @fq.$callee("`
+    if [ "$actual" != "$expected" ]; then
+      echo "$src => $expected calls to $callee expected, but got $actual"
+      exit 1
+    fi
+  }
+  # 定数で呼んだ副作用の無い関数は消える
+  check_calls "fun sq(x) x * x fun main() print( sq(7) )" sq 0
+  check_calls "fun sq(x) x * x fun main() { let a = 7; print( sq(a) ) }" sq 1
+  # 再帰が深すぎるもの、時間がかかりすぎるもの、0除算は実行時に任せる
+  check_calls "fun big(n) if (n == 0) 0 else 1 + big(n - 1) fun main() print( big(100000) )" big 2
+  check_calls "fun fib(n) if (n < 2) n else fib(n-1) + fib(n-2) fun main() print( fib(40) )" fib 3
+  check_calls "fun d(x) 10 / x fun main() print( d(0) )" d 1
+  check_calls "fun p(x) print(x) fun main() p(5)" p 1
+  $TARGET -i test/if.fq > tmp.ll
+  if grep -q "call i32 @fq.sub(" tmp.ll; then
+    echo "test/if.fq: sub(5) is not evaluated at compile time"
+    exit 1
+  fi
+fi
+
+# --------- tests for parallel loops
+try_threads 332836500 "fun sq(x) x * x fun main() { let k = 3; print( parfor i in 0..1000 sq(i) + k ) }"
+try_threads "$(printf '0\n0')" "fun main() { print( parfor i in 0..0 1 ); print( parfor i in 5..3 1 ) }"
+try_threads 1409965408 "fun main() { let y = 7; print( parfor i in 0..100000 { let y = i; y = y * 2; y } ); y }"
+try_threads 121399 "fun fib(n) if (n < 2) n else fib(n-1) + fib(n-2) fun main() { let t = parfor i in 0..30 fib(i - i / 25 * 25); print(t) }"
+try_threads -1051431380 "fun inner(n) parfor j in 0..n j fun main() { let total = 0; for r in 0..2000 { let s = parfor i in 0..r inner(i); total = total + s }; print(total) }"
+try_threads "$(printf -- '-5\n42')" "fun main() { let i = 42; print( parfor i in -5..5 i ); print(i) }"
+try_pgo -25 "fun f(x) if (x < 5) x else 0 - x fun main() { let n = 10; print( parfor i in 0..n f(i) ) }"
+try_profiler 285 "fun f(x) if (x < 5) x * x else x * x fun main() { let n = 10; print( parfor i in 0..n f(i) ) }"
+try_except "fun main() { parfor i in 0..3 return 1 }"
+try_except "fun main() { parfor i in 0..3 parfor j in 0..2 1 }"
+try_except "fun main() { let s = 0; parfor i in 0..3 s = i }"
+try_except "fun main() { parfor i in 0..3 print(i) }"
+try_except "fun f(x) read() fun main() { parfor i in 0..3 f(i) }"
+if [ "$OPT" == "" ]; then
+  # 本体から呼ばれる関数は複数のスレッドから呼ばれるのでメモ化しない
+  if echo "fun fib(n) if (n < 2) n else fib(n-1) + fib(n-2) fun main() { let n = 20; print( parfor i in 0..n fib(i) ) }" | $TARGET | grep -q "@freq.memo"; then
+    echo "functions called from parfor should not be memoized"
+    exit 1
+  fi
+  # 手が空いたワーカーは回り続けずに条件変数で眠る
+  if echo "fun main() print( parfor i in 0..100 i )" | $TARGET | grep -q "sched_yield"; then
+    echo "idle parfor workers should sleep instead of spinning"
+    exit 1
+  fi
+fi
+
+# --------- tests for streaming
+if [ "$OPT" == "" ]; then
+  try_stream 3 "fun main() { print(1+2) }"
+  try_stream 120 "fun main() { print( fact(5) ) } fun fact(n) if (n < 2) 1 else n * fact(n - 1)"
+  try_stream 1 "fun f() 1 fun f() 2 fun main() print(f())"
+  try_stream 6 "fun unused(x) x / 0 fun main() { let s = 0; for i in 0..4 s = s + i; print(s) }"
+  try_stream 328350 "fun sq(x) x * x fun main() { let n = 100; print( parfor i in 0..n sq(i) ) }"
+  try_stream 55 "fun fib(n) if (n < 2) n else fib(n-1) + fib(n-2) fun main() { print( fib(10) ) }"
+  # parforから呼ぶ関数は先に書いておかないと副作用があるか分からない
+  if echo "fun main() { let n = 3; print( parfor i in 0..n sq(i) ) } fun sq(x) x * x" | $TARGET -S > /dev/null 2>&1; then
+    echo "forward reference from parfor should be rejected in stream mode"
+    exit 1
+  fi
+  if echo "fun main() 1" | $TARGET -S -b > /dev/null 2>&1; then
+    echo "-S with -b should be rejected"
+    exit 1
+  fi
+  # 関数の数が増えても、使うメモリはほとんど増えない
+  awk 'BEGIN { for( i = 0; i < 20000; i++ ) printf "fun f%d(x) { let y = x * %d; y + 1 }\n", i, i; print "fun main() print(f19999(2))" }' > tmp.fq
+  if ! ( ulimit -v 40000; $TARGET -S -i tmp.fq -o tmp.ll ) || [ `grep -c "^define i32 @fq.f[0-9]" tmp.ll` != 20000 ]; then
+    echo "large input is not compiled in bounded memory"
+    exit 1
+  fi
+fi
+
+# --------- tests for batch mode
+ext=ll
+if [ "$OPT" == "-b" ]; then ext=bc; fi
+rm -rf tmp_batch && mkdir -p tmp_batch/out
+# ディレクトリを渡すと中の*.fqを全部コンパイルする
+$TARGET $OPT -B test -o tmp_batch/out -j 3 2> tmp_batch/summary || { cat tmp_batch/summary; exit 1; }
+for expected in "add 20" "if 20" "if_2 10"; do
+  actual=`lli tmp_batch/out/${expected% *}.$ext`
+  if [ "$actual" != "${expected#* }" ]; then
+    echo "batch: test/${expected% *}.fq => ${expected#* } expected, but got $actual"
+    exit 1
+  fi
+done
+cat tmp_batch/summary
+# 失敗したものがあっても残りは出力し、エラーは位置付きでまとめて出す
+for i in `seq 1 200`; do echo "fun f(x) x * $i fun main() print( f(3) )" > tmp_batch/p$i.fq; done
+echo "fun main() { 1 + }" > tmp_batch/bad.fq
+{ ls tmp_batch/p*.fq; echo "# comment"; echo; echo tmp_batch/bad.fq; echo tmp_batch/missing.fq; } > tmp_batch/list
+if $TARGET $OPT -B tmp_batch/list -j 4 2> tmp_batch/summary; then
+  echo "batch: failures should make the exit status non-zero"
+  exit 1
+fi
+if ! grep -q "^tmp_batch/bad.fq:1:18: " tmp_batch/summary || ! grep -q "^tmp_batch/missing.fq: " tmp_batch/summary \
+  || ! grep -q "^batch: 202 programs, 2 failed, 4 workers" tmp_batch/summary; then
+  cat tmp_batch/summary
+  exit 1
+fi
+for i in 1 77 200; do
+  actual=`lli tmp_batch/p$i.$ext`
+  if [ "$actual" != "$(( i * 3 ))" ]; then
+    echo "batch: tmp_batch/p$i.fq => $(( i * 3 )) expected, but got $actual"
+    exit 1
+  fi
+done
+if [ `ls tmp_batch/p*.$ext | wc -l` != 200 ]; then
+  echo "batch: some outputs are missing"
+  exit 1
+fi
+tail -n 1 tmp_batch/summary
+# -oで出力先が同じになる入力は、最初のもの以外を失敗にする
+mkdir -p tmp_batch/a tmp_batch/b
+echo "fun main() print(1)" > tmp_batch/a/x.fq
+echo "fun main() print(2)" > tmp_batch/b/x.fq
+printf "tmp_batch/a/x.fq\ntmp_batch/b/x.fq\n" | $TARGET $OPT -B - -o tmp_batch/out -j 2 2> tmp_batch/summary
+if ! grep -q "^tmp_batch/b/x.fq: Output file 'tmp_batch/out/x.$ext' is also written for 'tmp_batch/a/x.fq'." tmp_batch/summary \
+  || ! grep -q "^batch: 2 programs, 1 failed" tmp_batch/summary || [ "`lli tmp_batch/out/x.$ext`" != 1 ]; then
+  cat tmp_batch/summary
+  exit 1
+fi
+echo "batch: duplicate output paths are rejected"
+
+# --------- tests for select
+try_select 10 "fun main() { let a = 3; print( if (a > 2) 10 else 20 ) }"
+try_select "$(printf '7\n-7')" "fun abs(x) if (x < 0) 0 - x else x fun main() { print( abs(0 - 7) ); print( 0 - abs(7) ) }"
+try_select 40 "fun f(a, b) if (a) { if (b) 10 else 20 } else { if (b) 30 else 40 } fun main() print( f(0, 0) )"
+try_select 5 "fun f(x) if (x) x / 2 else {} fun main() print( f(10) + f(0) )"
+try_select -29982728 "`cat bench/select.fq`"
+# 0除算や呼び出しは、選ばれない方を先に計算してはいけない
+try_select 1 "fun f(x) if (x) 100 / x else 1 fun main() print( f(0) )"
+try_select 1 "fun f(x) if (x != -1) 5 / (x + 1) * 0 + 1 else 7 / x fun main() print( f(-1) * 0 + 1 )"
+try_select 2 "fun main() { let x = 2; print( if (x) x else print(1) ) }"
+try_select 3 "fun main() { let x = 0; let y = if (x) { x = 5; 1 } else 3; print(y + x) }"
+try_pgo 50 "fun g(i) if (i < 5) i else 1 fun f(n) { let s = 0; for i in 0..n s = s + g(i); s } fun main() print( f(50) - 5 )"
+if [ "$OPT" == "" ]; then
+  # test/if_2.fqのifは全部selectになり、上限を下げると外側だけ分岐に戻る
+  for expected in "8 3" "4 2" "0 0"; do
+    actual=`$TARGET -d -C ${expected% *} -i test/if_2.fq 2>/dev/null | grep -c "; ST_IF (select)"`
+    if [ "$actual" != "${expected#* }" ]; then
+      echo "test/if_2.fq: ${expected#* } selects expected with -C ${expected% *}, but got $actual"
+      exit 1
+    fi
+  done
+fi
+
+# --------- tests for parallel tokenization
+if [ "$OPT" == "" ]; then
+  # 1MB以上の入力は関数の境目で分けて読むが、1つのスレッドで読んだときと同じ結果になること
+  awk 'BEGIN { for( i = 0; i < 12000; i++ ) printf "fun f%d(funny, x) {\n  let xfun = funny * %d;\n  for k in 0..2 xfun = xfun + k;\n  if (x >= 2) { xfun / 3 } else xfun != 1\n}\n", i, i; print "fun main() print( f7(6, 1) + f11999(2, 5) )" }' > tmp.fq
+  $TARGET -j 1 -i tmp.fq > tmp.ll
+  for threads in 2 4 7; do
+    if ! $TARGET -j $threads -i tmp.fq | cmp -s - tmp.ll; then
+      echo "tokenizing with $threads threads changes the output"
+      exit 1
+    fi
+  done
+  try_file 8000 tmp.fq
+  # エラーの位置も同じ。読めない文字の後ろの関数は読まない
+  awk 'NR == 30000 { print "fun bad() { 1 $ 2 }" } { print }' tmp.fq > tmp.bc
+  for threads in 1 4; do
+    actual=`$TARGET -j $threads -i tmp.bc 2>&1 >/dev/null`
+    if [ "$actual" != "30000:15: Tokenize中に予想外の文字(753792文字目の'\$')が着てしまいました。" ]; then
+      echo "unexpected error with $threads threads: $actual"
+      exit 1
+    fi
+  done
+  # NULで入力が終わったことになるのも同じ
+  { head -n 30000 tmp.fq; printf 'fun main() print(1)\0'; tail -n +30001 tmp.fq; } > tmp.bc
+  for threads in 1 4; do
+    $TARGET -j $threads -i tmp.bc > tmp.ll
+    actual=`lli tmp.ll`
+    if [ "$actual" != 1 ]; then
+      echo "input after NUL should be ignored with $threads threads, but got $actual"
+      exit 1
+    fi
+  done
+  echo "parallel tokenization => OK"
+fi
+
+# --------- tests for generators
+try 45 "gen range(a, b) for i in a..b yield i fun main() { let s = 0; for x in range(0, 10) s = s + x; print(s) }"
+try 120 "gen range(a, b) for i in a..b yield i gen squares(n) for x in range(0, n) yield x * x gen evens(n) for x in squares(n) if (x / 2 * 2 == x) yield x fun main() { let s = 0; for v in evens(10) s = s + v; print(s) }"
+try "$(printf '1\n2')" "gen g() { yield 1; yield 2; return 0; yield 3 } fun main() { for x in g() print(x); 0 }"
+try 400 "gen g(n) { let i = 0; loop { yield i; i = i + 1; i < n } } fun f() { for x in g(10) if (x == 4) return x * 100; 7 } fun main() print( f() )"
+try 8 "gen g(n) for i in 0..n yield i fun main() { let i = 5; for x in g(3) i = i + x; print(i) }"
+try "$(printf '20\n21\n22')" "gen g(n) for i in 0..n yield i fun main() { for x in g(3) for y in g(3) if (x == 2) print(x * 10 + y) }"
+try 6 "fun main() { let s = 0; for x in later(4) s = s + x; print(s) } gen later(n) for i in 0..n yield i"
+try 28 "gen g(n) { let t = parfor i in 0..n i * n; yield t; yield n } fun main() { let s = 0; for x in g(4) s = s + x; print(s) }"
+# genの変数はentry blockに置くので、何度展開しても回してもスタックは伸びない
+try 3000000 "gen one() yield 1 fun main() { let s = 0; for i in 0..3000000 for x in one() s = s + x; print(s) }"
+# yieldが何箇所もあっても、forの本体は1つだけ出してswitchで戻る
+try 114 "gen g(n) { for i in 0..n { if (i == 1) yield 10 else yield i }; yield 99 } fun main() { let s = 0; for x in g(4) s = s + x; print(s) }"
+try 106 "gen h(n) for i in 0..n yield i gen g(n) { for x in h(n) yield x; yield 100 } fun main() { let s = 0; for x in g(4) s = s + x; print(s) }"
+try "$(printf '3\n4\n7')" "gen g(n) { let a = yield 3; let b = yield a + 1; yield a + b } fun main() { for x in g(0) print(x) }"
+try 39 "gen h(n) { yield n; yield n + 1 } gen g(n) { for i in 0..n for x in h(i) yield x } fun main() { let s = 0; for x in g(3) s = s * 2 + x; print(s) }"
+try "$(printf '5\n10\n15\n20\n21\n25\n50\n51\n52\n53\n54\n55')" "gen g(n) { for i in 0..n yield i; yield 5 } fun main() { for x in g(3) { for y in g(x) print(x * 10 + y) } }"
+try 3 "gen g(n) { for i in 0..n yield i; yield 100 } fun f() { for x in g(5) if (x == 3) return x; 7 } fun main() print(f())"
+NESTED_GENS="gen g0(n) for i in 0..n { yield i; yield i + 1; yield i + 2; yield i + 3 }"
+for k in 1 2 3 4 5 6 7; do
+  NESTED_GENS="$NESTED_GENS gen g$k(n) for x in g$((k-1))(n) { yield x; yield x + 1; yield x + 2; yield x + 3 }"
+done
+NESTED_GENS="$NESTED_GENS fun main() { let s = 0; for x in g7(2) s = s + x; print(s) }"
+try 1638400 "$NESTED_GENS"
+try_stream 6 "gen g(n) for i in 0..n yield i fun main() { let s = 0; for x in g(4) s = s + x; print(s) }"
+try_pgo 1275 "gen g(n) for i in 0..n if (i / 3 * 3 == i) yield i fun main() { let s = 0; for x in g(100) if (x > 50) s = s + x; print(s) }"
+try_except "gen g(n) for i in 0..n yield i fun main() print( g(3) )"
+try_except "gen g(n) for i in g(n) yield i fun main() for x in g(3) print(x)"
+try_except "fun h(n) n fun main() for x in h(3) print(x)"
+try_except "fun main() { yield 3 }"
+try_except "gen g(n) for i in 0..n yield i fun main() for x in g(3, 4) print(x)"
+try_except "gen g(n) parfor i in 0..n yield i fun main() for x in g(3) print(x)"
+try_except "gen g(n) { f(1, yield 2) } fun f(a, b) a fun main() for x in g(1) print(x)"
+if [ "$OPT" == "" ]; then
+  # yieldを4つずつ持つgenを8段重ねても、IRは段数に比例する大きさで収まる
+  lines=`echo "$NESTED_GENS" | $TARGET | wc -l`
+  if [ "$lines" -gt 1000 ]; then
+    echo "nested generators => $lines lines of IR"
+    exit 1
+  fi
+  echo "nested generators => $lines lines of IR"
+  # genは関数として出さずに、回しているところに展開する
+  if echo "gen g(n) for i in 0..n yield i fun main() for x in g(3) print(x)" | $TARGET | grep -q "@fq.g\b"; then
+    echo "generator is emitted as a function"
+    exit 1
+  fi
+  try_file 90780 bench/gen.fq
+fi
+
+# --------- tests for bitcode
+if [ "$OPT" == "" ]; then
+  # nsw/nuwなどのフラグやnounwindも落とさずに書く
+  try_bitcode "" "fun f(x) if (x < 5) x else 0 - x fun main() { let n = 10; print( parfor i in 0..n f(i) ); for i in 0..3 [unroll 2] print(read() * 3 - i); 0 }"
+  try_bitcode "-p" "fun fib(n) if (n < 2) n else fib(n-1) + fib(n-2) fun main() print( fib(10) )"
+  try_bitcode "" "gen g(n) { for i in 0..n yield i; yield 7 } fun main() { let s = 0; for x in g(4) s = s + x; print(s) }"
+fi
+
+# --------- tests for libfreq
+if [ "$OPT" == "" ]; then
+  cc -std=c11 -o tmp_libfreq test/libfreq.c bin/libfreq.a -pthread && ./tmp_libfreq || exit 1
+  cc -std=c11 -o tmp_libfreq test/libfreq.c -Lbin -lfreq -pthread && LD_LIBRARY_PATH=bin ./tmp_libfreq || exit 1
+fi
+
 echo OK
@@ -0,0 +1,107 @@
+// libfreqのAPIのテスト。test.shからビルドして実行する。
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/freq.h"
+
+#define CHECK(cond) \
+  if( !(cond) ) { fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); return 1; }
+
+// freq_compile_streamの出力を数える
+typedef struct {
+  size_t calls;
+  size_t size;
+  bool has_main;
+} Sink;
+
+static bool contains(const char* data, size_t size, const char* word) {
+  const size_t len = strlen(word);
+  for( size_t i = 0; i + len <= size; ++i ) {
+    if( memcmp(data + i, word, len) == 0 ) return true;
+  }
+  return false;
+}
+
+// irの中のheaderで始まる関数の本体にwordがあるか
+static bool func_contains(const char* ir, const char* header, const char* word) {
+  const char* begin = strstr(ir, header);
+  if( begin == NULL ) return false;
+  const char* end = strstr(begin, "\n}\n");
+  return contains(begin, end ? (size_t)(end - begin) : strlen(begin), word);
+}
+
+static bool count_output(void* user, const char* data, size_t size) {
+  Sink* sink = (Sink*)user;
+  ++sink->calls;
+  sink->size += size;
+  if( contains(data, size, "define i32 @main") ) sink->has_main = true;
+  return true;
+}
+
+static bool refuse_output(void* user, const char* data, size_t size) {
+  (void)user; (void)data; (void)size;
+  return false;
+}
+
+int main(void) {
+  FreqContext* ctx = freq_create();
+  CHECK(ctx);
+
+  // 同じcontextで何度もコンパイルできる
+  const char* ok = "fun main() { print(1+2) }";
+  FreqBuffer out;
+  for( int i = 0; i < 3; ++i ) {
+    CHECK(freq_compile(ctx, ok, strlen(ok), FREQ_IR, &out));
+    CHECK(out.size > 0 && strstr(out.data, "define i32 @main"));
+  }
+  CHECK(freq_compile(ctx, ok, strlen(ok), FREQ_BITCODE, &out));
+  CHECK(out.size > 4 && memcmp(out.data, "BC\xc0\xde", 4) == 0);
+
+  // エラーはexitせずに位置付きで返る
+  const char* ng = "fun main() {\n  1 + }";
+  CHECK(!freq_compile(ctx, ng, strlen(ng), FREQ_IR, &out));
+  const FreqError* err = freq_error(ctx);
+  CHECK(err->line == 2 && err->column == 7);
+  CHECK(err->message[0] != '\0');
+
+  // エラーの後でも使える
+  CHECK(freq_compile(ctx, ok, strlen(ok), FREQ_IR, &out));
+
+  // 副作用の無い再帰関数はメモ化され、FREQ_NO_MEMOで止められる
+  const char* fib = "fun fib(n) if (n < 2) n else fib(n-1) + fib(n-2) fun main() print(fib(10))";
+  CHECK(freq_compile(ctx, fib, strlen(fib), FREQ_IR, &out));
+  CHECK(strstr(out.data, "@freq.memo.fib"));
+  CHECK(freq_compile(ctx, fib, strlen(fib), FREQ_IR | FREQ_NO_MEMO, &out));
+  CHECK(!strstr(out.data, "@freq.memo.fib"));
+
+  // プロファイラは設定した後のコンパイルにだけ入る
+  freq_set_profiler(ctx, true, NULL);
+  CHECK(freq_compile(ctx, ok, strlen(ok), FREQ_IR, &out));
+  CHECK(strstr(out.data, "@freq.cyc.enter") && !strstr(out.data, "@freq.cyc.stacks"));
+  freq_set_profiler(ctx, false, NULL);
+  CHECK(freq_compile(ctx, ok, strlen(ok), FREQ_IR, &out));
+  CHECK(!strstr(out.data, "@freq.cyc.enter"));
+
+  // 安いifはselectになり、上限を0にすると分岐に戻る
+  const char* choose = "fun f(x) if (x < 0) 0 - x else x fun main() print(f(0 - 3))";
+  CHECK(freq_compile(ctx, choose, strlen(choose), FREQ_IR, &out));
+  CHECK(func_contains(out.data, "define i32 @fq.f(", "select i1") && !func_contains(out.data, "define i32 @fq.f(", "phi i32"));
+  freq_set_select_cost(ctx, 0);
+  CHECK(freq_compile(ctx, choose, strlen(choose), FREQ_IR, &out));
+  CHECK(!func_contains(out.data, "define i32 @fq.f(", "select i1") && func_contains(out.data, "define i32 @fq.f(", "phi i32"));
+  freq_set_select_cost(ctx, 8);
+
+  // 関数ごとに出力される
+  const char* two = "fun f(x) x * 2 fun main() print(f(3))";
+  Sink sink = { 0, 0, false };
+  CHECK(freq_compile_stream(ctx, two, strlen(two), FREQ_IR, count_output, &sink));
+  CHECK(sink.calls >= 3 && sink.size > 0 && sink.has_main);
+  CHECK(!freq_compile_stream(ctx, two, strlen(two), FREQ_BITCODE, count_output, &sink));
+  CHECK(!freq_compile_stream(ctx, two, strlen(two), FREQ_IR, refuse_output, NULL));
+  CHECK(!freq_compile_stream(ctx, ng, strlen(ng), FREQ_IR, count_output, &sink));
+  CHECK(freq_error(ctx)->line == 2 && freq_error(ctx)->column == 7);
+
+  freq_destroy(ctx);
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,291 @@
+
+@0 = internal global [65536 x i8] zeroinitializer, align 16
+@1 = internal global i64 0, align 8
+@2 = internal global [65536 x i8] zeroinitializer, align 16
+@3 = internal global i64 0, align 8
+@4 = internal global i64 0, align 8
+@5 = internal global i32 0, align 4
+@llvm.global_dtors = appending global [1 x { i32, void ()*, i8* }] [{ i32, void ()*, i8* } { i32 65535, void ()* @6, i8* null }]
+
+declare i64 @write(i32, i8*, i64)
+
+; Function Attrs: argmemonly nofree nounwind willreturn
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8* noalias nocapture writeonly, i8* noalias nocapture readonly, i64, i1 immarg) #0
+
+; Function Attrs: nounwind
+define internal void @6() #1 {
+  %1 = load i64, i64* @1, align 8
+  %2 = getelementptr inbounds [65536 x i8], [65536 x i8]* @0, i64 0, i64 0
+  br label %3
+
+3:                                                ; preds = %7, %0
+  %4 = phi i64 [ 0, %0 ], [ %10, %7 ]
+  %5 = sub i64 %1, %4
+  %6 = icmp sle i64 %5, 0
+  br i1 %6, label %12, label %7
+
+7:                                                ; preds = %3
+  %8 = getelementptr inbounds i8, i8* %2, i64 %4
+  %9 = call i64 @write(i32 1, i8* %8, i64 %5)
+  %10 = add i64 %4, %9
+  %11 = icmp sle i64 %9, 0
+  br i1 %11, label %12, label %3
+
+12:                                               ; preds = %7, %3
+  store i64 0, i64* @1, align 8
+  ret void
+}
+
+; Function Attrs: nounwind
+define i32 @print(i32 %0) #1 {
+  %2 = alloca [16 x i8], align 1
+  %3 = load i64, i64* @1, align 8
+  %4 = icmp ugt i64 %3, 65520
+  br i1 %4, label %5, label %6
+
+5:                                                ; preds = %1
+  call void @6()
+  br label %6
+
+6:                                                ; preds = %5, %1
+  %7 = icmp slt i32 %0, 0
+  %8 = sext i32 %0 to i64
+  %9 = sub i64 0, %8
+  %10 = select i1 %7, i64 %9, i64 %8
+  %11 = getelementptr inbounds [16 x i8], [16 x i8]* %2, i64 0, i64 15
+  store i8 10, i8* %11, align 1
+  br label %12
+
+12:                                               ; preds = %12, %6
+  %13 = phi i64 [ 15, %6 ], [ %15, %12 ]
+  %14 = phi i64 [ %10, %6 ], [ %16, %12 ]
+  %15 = sub i64 %13, 1
+  %16 = udiv i64 %14, 10
+  %17 = urem i64 %14, 10
+  %18 = trunc i64 %17 to i8
+  %19 = add i8 %18, 48
+  %20 = getelementptr inbounds [16 x i8], [16 x i8]* %2, i64 0, i64 %15
+  store i8 %19, i8* %20, align 1
+  %21 = icmp ne i64 %16, 0
+  br i1 %21, label %12, label %22
+
+22:                                               ; preds = %12
+  %23 = sub i64 %15, 1
+  %24 = getelementptr inbounds [16 x i8], [16 x i8]* %2, i64 0, i64 %23
+  store i8 45, i8* %24, align 1
+  %25 = select i1 %7, i64 %23, i64 %15
+  %26 = sub i64 16, %25
+  %27 = getelementptr inbounds [16 x i8], [16 x i8]* %2, i64 0, i64 %25
+  %28 = load i64, i64* @1, align 8
+  %29 = getelementptr inbounds [65536 x i8], [65536 x i8]* @0, i64 0, i64 %28
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %29, i8* %27, i64 %26, i1 false)
+  %30 = add i64 %28, %26
+  store i64 %30, i64* @1, align 8
+  ret i32 %0
+}
+
+declare i64 @read(i32, i8*, i64)
+
+; Function Attrs: nounwind
+define internal i1 @7() #1 {
+  call void @6()
+  %1 = getelementptr inbounds [65536 x i8], [65536 x i8]* @2, i64 0, i64 0
+  %2 = call i64 @read(i32 0, i8* %1, i64 65536)
+  %3 = icmp sgt i64 %2, 0
+  %4 = select i1 %3, i64 %2, i64 0
+  store i64 0, i64* @3, align 8
+  store i64 %4, i64* @4, align 8
+  ret i1 %3
+}
+
+; Function Attrs: nounwind
+define i32 @freq.read() #1 {
+  %1 = load i64, i64* @3, align 8
+  br label %2
+
+2:                                                ; preds = %23, %17, %8, %0
+  %3 = phi i64 [ %1, %0 ], [ %12, %17 ], [ 0, %8 ], [ %24, %23 ]
+  %4 = load i64, i64* @4, align 8
+  %5 = icmp uge i64 %3, %4
+  br i1 %5, label %6, label %9
+
+6:                                                ; preds = %2
+  %7 = call i1 @7()
+  br i1 %7, label %8, label %57
+
+8:                                                ; preds = %6
+  br label %2
+
+9:                                                ; preds = %2
+  %10 = getelementptr inbounds [65536 x i8], [65536 x i8]* @2, i64 0, i64 %3
+  %11 = load i8, i8* %10, align 1
+  %12 = add i64 %3, 1
+  %13 = icmp eq i8 %11, 45
+  %14 = sub i8 %11, 48
+  %15 = icmp ult i8 %14, 10
+  br i1 %15, label %30, label %16
+
+16:                                               ; preds = %9
+  br i1 %13, label %18, label %17
+
+17:                                               ; preds = %16
+  br label %2
+
+18:                                               ; preds = %16
+  %19 = load i64, i64* @4, align 8
+  %20 = icmp uge i64 %12, %19
+  br i1 %20, label %21, label %23
+
+21:                                               ; preds = %18
+  %22 = call i1 @7()
+  br i1 %22, label %23, label %57
+
+23:                                               ; preds = %21, %18
+  %24 = phi i64 [ %12, %18 ], [ 0, %21 ]
+  %25 = getelementptr inbounds [65536 x i8], [65536 x i8]* @2, i64 0, i64 %24
+  %26 = load i8, i8* %25, align 1
+  %27 = sub i8 %26, 48
+  %28 = icmp ult i8 %27, 10
+  %29 = add i64 %24, 1
+  br i1 %28, label %30, label %2
+
+30:                                               ; preds = %23, %9
+  %31 = phi i64 [ %12, %9 ], [ %29, %23 ]
+  %32 = phi i8 [ %14, %9 ], [ %27, %23 ]
+  %33 = phi i1 [ false, %9 ], [ true, %23 ]
+  %34 = zext i8 %32 to i32
+  br label %35
+
+35:                                               ; preds = %48, %42, %30
+  %36 = phi i64 [ %31, %30 ], [ %52, %48 ], [ 0, %42 ]
+  %37 = phi i32 [ %34, %30 ], [ %51, %48 ], [ %37, %42 ]
+  %38 = load i64, i64* @4, align 8
+  %39 = icmp uge i64 %36, %38
+  br i1 %39, label %40, label %43
+
+40:                                               ; preds = %35
+  %41 = call i1 @7()
+  br i1 %41, label %42, label %54
+
+42:                                               ; preds = %40
+  br label %35
+
+43:                                               ; preds = %35
+  %44 = getelementptr inbounds [65536 x i8], [65536 x i8]* @2, i64 0, i64 %36
+  %45 = load i8, i8* %44, align 1
+  %46 = sub i8 %45, 48
+  %47 = icmp ult i8 %46, 10
+  br i1 %47, label %48, label %53
+
+48:                                               ; preds = %43
+  %49 = mul i32 %37, 10
+  %50 = zext i8 %46 to i32
+  %51 = add i32 %49, %50
+  %52 = add i64 %36, 1
+  br label %35
+
+53:                                               ; preds = %43
+  store i64 %36, i64* @3, align 8
+  br label %54
+
+54:                                               ; preds = %53, %40
+  %55 = sub i32 0, %37
+  %56 = select i1 %33, i32 %55, i32 %37
+  store i32 0, i32* @5, align 4
+  ret i32 %56
+
+57:                                               ; preds = %21, %6
+  store i32 1, i32* @5, align 4
+  ret i32 0
+}
+
+; Function Attrs: nounwind
+define i32 @freq.eof() #1 {
+  %1 = load i32, i32* @5, align 4
+  ret i32 %1
+}
+
+; Function Attrs: nounwind
+define i32 @main() #1 {
+  %1 = alloca i32, align 4
+  %2 = alloca i32, align 4
+  %3 = alloca i32, align 4
+  %4 = alloca i32, align 4
+  %5 = alloca i32, align 4
+  %6 = alloca i32, align 4
+  %7 = alloca i32, align 4
+  %8 = alloca i32, align 4
+  %9 = add i32 0, 0
+  store i32 %9, i32* %1, align 4
+  %10 = load i32, i32* %1, align 4
+  %11 = add i32 0, 4
+  store i32 %11, i32* %3, align 4
+  %12 = add i32 0, 0
+  %13 = load i32, i32* %3, align 4
+  store i32 %12, i32* %5, align 4
+  store i32 %13, i32* %6, align 4
+  br label %14
+
+14:                                               ; preds = %0
+  br label %15
+
+15:                                               ; preds = %23, %14
+  %16 = load i32, i32* %5, align 4
+  %17 = load i32, i32* %6, align 4
+  %18 = icmp slt i32 %16, %17
+  br i1 %18, label %19, label %26
+
+19:                                               ; preds = %15
+  store i32 %16, i32* %4, align 4
+  %20 = load i32, i32* %4, align 4
+  store i32 %20, i32* %7, align 4
+  store i32 8, i32* %8, align 4
+  br label %31
+
+21:                                               ; preds = %31
+  %22 = load i32, i32* %7, align 4
+  br label %23
+
+23:                                               ; preds = %21
+  %24 = load i32, i32* %5, align 4
+  %25 = add nsw i32 %24, 1
+  store i32 %25, i32* %5, align 4
+  br label %15, !llvm.loop !0
+
+26:                                               ; preds = %15
+  %27 = add i32 0, 0
+  %28 = add i32 0, 7
+  store i32 %28, i32* %7, align 4
+  store i32 9, i32* %8, align 4
+  br label %31
+
+29:                                               ; preds = %31
+  %30 = load i32, i32* %7, align 4
+  br label %38
+
+31:                                               ; preds = %26, %19
+  %32 = load i32, i32* %7, align 4
+  store i32 %32, i32* %2, align 4
+  %33 = load i32, i32* %1, align 4
+  %34 = load i32, i32* %2, align 4
+  %35 = add i32 %33, %34
+  store i32 %35, i32* %1, align 4
+  %36 = load i32, i32* %1, align 4
+  %37 = load i32, i32* %8, align 4
+  switch i32 %37, label %38 [
+    i32 8, label %21
+    i32 9, label %29
+  ]
+
+38:                                               ; preds = %31, %29
+  %39 = add i32 0, 0
+  %40 = load i32, i32* %1, align 4
+  %41 = call i32 @print(i32 %40)
+  ret i32 %41
+}
+
+attributes #0 = { argmemonly nofree nounwind willreturn }
+attributes #1 = { nounwind }
+
+!0 = distinct !{!0, !1}
+!1 = !{!"llvm.loop.mustprogress"}
@@ -0,0 +1,4 @@
+freq profile: 188256 cycles
+   self%           self      inclusive       calls  function
+   99.7%         187698         188256           1  main
+    0.2%            558            558          10  f
@@ -0,0 +1,262 @@
+@freq.out.buf = internal global [65536 x i8] zeroinitializer, align 16
+@freq.out.len = internal global i64 0, align 8
+
+declare i64 @write(i32, i8*, i64)
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i1)
+
+define internal void @freq.flush() nounwind {
+entry:
+  %len = load i64, i64* @freq.out.len, align 8
+  %buf = getelementptr inbounds [65536 x i8], [65536 x i8]* @freq.out.buf, i64 0, i64 0
+  br label %loop
+loop:
+  %off = phi i64 [ 0, %entry ], [ %next, %more ]
+  %rest = sub i64 %len, %off
+  %done = icmp sle i64 %rest, 0
+  br i1 %done, label %end, label %more
+more:
+  %ptr = getelementptr inbounds i8, i8* %buf, i64 %off
+  %written = call i64 @write(i32 1, i8* %ptr, i64 %rest)
+  %next = add i64 %off, %written
+  %failed = icmp sle i64 %written, 0
+  br i1 %failed, label %end, label %loop
+end:
+  store i64 0, i64* @freq.out.len, align 8
+  ret void
+}
+
+define i32 @print(i32) nounwind {
+entry:
+  %digits = alloca [16 x i8], align 1
+  %used = load i64, i64* @freq.out.len, align 8
+  %full = icmp ugt i64 %used, 65520
+  br i1 %full, label %flush, label %format
+flush:
+  call void @freq.flush()
+  br label %format
+format:
+  %neg = icmp slt i32 %0, 0
+  %wide = sext i32 %0 to i64
+  %negated = sub i64 0, %wide
+  %abs = select i1 %neg, i64 %negated, i64 %wide
+  %newline = getelementptr inbounds [16 x i8], [16 x i8]* %digits, i64 0, i64 15
+  store i8 10, i8* %newline, align 1
+  br label %digit
+digit:
+  %pos = phi i64 [ 15, %format ], [ %next.pos, %digit ]
+  %rest = phi i64 [ %abs, %format ], [ %quot, %digit ]
+  %next.pos = sub i64 %pos, 1
+  %quot = udiv i64 %rest, 10
+  %rem = urem i64 %rest, 10
+  %rem8 = trunc i64 %rem to i8
+  %char = add i8 %rem8, 48
+  %slot = getelementptr inbounds [16 x i8], [16 x i8]* %digits, i64 0, i64 %next.pos
+  store i8 %char, i8* %slot, align 1
+  %more = icmp ne i64 %quot, 0
+  br i1 %more, label %digit, label %copy
+copy:
+  %minus.pos = sub i64 %next.pos, 1
+  %minus = getelementptr inbounds [16 x i8], [16 x i8]* %digits, i64 0, i64 %minus.pos
+  store i8 45, i8* %minus, align 1
+  %start = select i1 %neg, i64 %minus.pos, i64 %next.pos
+  %count = sub i64 16, %start
+  %src = getelementptr inbounds [16 x i8], [16 x i8]* %digits, i64 0, i64 %start
+  %len = load i64, i64* @freq.out.len, align 8
+  %dst = getelementptr inbounds [65536 x i8], [65536 x i8]* @freq.out.buf, i64 0, i64 %len
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %dst, i8* %src, i64 %count, i1 false)
+  %new.len = add i64 %len, %count
+  store i64 %new.len, i64* @freq.out.len, align 8
+  ret i32 %0
+}
+
+@freq.in.buf = internal global [65536 x i8] zeroinitializer, align 16
+@freq.in.pos = internal global i64 0, align 8
+@freq.in.len = internal global i64 0, align 8
+@freq.in.eof = internal global i32 0, align 4
+
+declare i64 @read(i32, i8*, i64)
+
+define internal i1 @freq.fill() nounwind {
+entry:
+  %buf = getelementptr inbounds [65536 x i8], [65536 x i8]* @freq.in.buf, i64 0, i64 0
+  %got = call i64 @read(i32 0, i8* %buf, i64 65536)
+  %ok = icmp sgt i64 %got, 0
+  %len = select i1 %ok, i64 %got, i64 0
+  store i64 0, i64* @freq.in.pos, align 8
+  store i64 %len, i64* @freq.in.len, align 8
+  ret i1 %ok
+}
+
+define i32 @freq.read() nounwind {
+entry:
+  %pos = load i64, i64* @freq.in.pos, align 8
+  br label %skip
+skip:
+  %p = phi i64 [ %pos, %entry ], [ %p.next, %skip.next ], [ 0, %skip.filled ]
+  %len = load i64, i64* @freq.in.len, align 8
+  %empty = icmp uge i64 %p, %len
+  br i1 %empty, label %skip.fill, label %skip.char
+skip.fill:
+  %skip.ok = call i1 @freq.fill()
+  br i1 %skip.ok, label %skip.filled, label %eof
+skip.filled:
+  br label %skip
+skip.char:
+  %ptr = getelementptr inbounds [65536 x i8], [65536 x i8]* @freq.in.buf, i64 0, i64 %p
+  %c = load i8, i8* %ptr, align 1
+  %p.next = add i64 %p, 1
+  %is.minus = icmp eq i8 %c, 45
+  %digit = sub i8 %c, 48
+  %is.digit = icmp ult i8 %digit, 10
+  %start = or i1 %is.minus, %is.digit
+  br i1 %start, label %number, label %skip.next
+skip.next:
+  br label %skip
+number:
+  %first = zext i8 %digit to i32
+  %value = select i1 %is.minus, i32 0, i32 %first
+  br label %num
+num:
+  %q = phi i64 [ %p.next, %number ], [ %q.next, %num.digit ], [ 0, %num.filled ]
+  %v = phi i32 [ %value, %number ], [ %v.next, %num.digit ], [ %v, %num.filled ]
+  %num.len = load i64, i64* @freq.in.len, align 8
+  %end = icmp uge i64 %q, %num.len
+  br i1 %end, label %num.fill, label %num.char
+num.fill:
+  %num.ok = call i1 @freq.fill()
+  br i1 %num.ok, label %num.filled, label %finish
+num.filled:
+  br label %num
+num.char:
+  %num.ptr = getelementptr inbounds [65536 x i8], [65536 x i8]* @freq.in.buf, i64 0, i64 %q
+  %num.c = load i8, i8* %num.ptr, align 1
+  %num.d = sub i8 %num.c, 48
+  %num.is.digit = icmp ult i8 %num.d, 10
+  br i1 %num.is.digit, label %num.digit, label %done
+num.digit:
+  %v.mul = mul i32 %v, 10
+  %v.add = zext i8 %num.d to i32
+  %v.next = add i32 %v.mul, %v.add
+  %q.next = add i64 %q, 1
+  br label %num
+done:
+  store i64 %q, i64* @freq.in.pos, align 8
+  br label %finish
+finish:
+  %negated = sub i32 0, %v
+  %result = select i1 %is.minus, i32 %negated, i32 %v
+  store i32 0, i32* @freq.in.eof, align 4
+  ret i32 %result
+eof:
+  store i32 1, i32* @freq.in.eof, align 4
+  ret i32 0
+}
+
+define i32 @freq.eof() nounwind {
+  %flag = load i32, i32* @freq.in.eof, align 4
+  ret i32 %flag
+}
+
+define i32 @main() nounwind {
+  %s = alloca i32, align 4
+  %v = alloca i32, align 4
+  %gen.1.seed = alloca i32, align 4
+  %gen.1.n = alloca i32, align 4
+  %gen.1.v = alloca i32, align 4
+  %gen.2.seed = alloca i32, align 4
+  %gen.2.n = alloca i32, align 4
+  %gen.2.x = alloca i32, align 4
+  %gen.2.i = alloca i32, align 4
+  %gen.3.from = alloca i32, align 4
+  %gen.3.to = alloca i32, align 4
+  %gen.3.i = alloca i32, align 4
+  %1 = add i32 0, 0
+  store i32 %1, i32* %s, align 4
+  %2 = load i32, i32* %s, align 4
+  %3 = add i32 0, 12345
+  %4 = add i32 0, 30000000
+  store i32 %3, i32* %gen.1.seed, align 4
+  store i32 %4, i32* %gen.1.n, align 4
+  %5 = load i32, i32* %gen.1.seed, align 4
+  %6 = load i32, i32* %gen.1.n, align 4
+  store i32 %5, i32* %gen.2.seed, align 4
+  store i32 %6, i32* %gen.2.n, align 4
+  %7 = load i32, i32* %gen.2.seed, align 4
+  store i32 %7, i32* %gen.2.x, align 4
+  %8 = load i32, i32* %gen.2.x, align 4
+  %9 = add i32 0, 0
+  %10 = load i32, i32* %gen.2.n, align 4
+  store i32 %9, i32* %gen.3.from, align 4
+  store i32 %10, i32* %gen.3.to, align 4
+  %11 = load i32, i32* %gen.3.from, align 4
+  %12 = load i32, i32* %gen.3.to, align 4
+  br label %label.4
+label.4:
+  br label %label.5
+label.5:
+  %for.5.iv = phi i32 [ %11, %label.4 ], [ %for.5.next, %label.7 ]
+  %13 = icmp slt i32 %for.5.iv, %12
+  br i1 %13, label %label.6, label %label.8
+label.6:
+  store i32 %for.5.iv, i32* %gen.3.i, align 4
+  %14 = load i32, i32* %gen.3.i, align 4
+  store i32 %14, i32* %gen.2.i, align 4
+  %15 = load i32, i32* %gen.2.x, align 4
+  %16 = add i32 0, 1103515245
+  %17 = mul i32 %15, %16
+  %18 = add i32 0, 12345
+  %19 = add i32 %17, %18
+  store i32 %19, i32* %gen.2.x, align 4
+  %20 = load i32, i32* %gen.2.x, align 4
+  %21 = load i32, i32* %gen.2.x, align 4
+  %22 = add i32 0, 65536
+  %23 = sdiv i32 %21, %22
+  store i32 %23, i32* %gen.1.v, align 4
+  %24 = load i32, i32* %gen.1.v, align 4
+  %25 = load i32, i32* %gen.1.v, align 4
+  %26 = add i32 0, 2
+  %27 = sdiv i32 %25, %26
+  %28 = add i32 0, 2
+  %29 = mul i32 %27, %28
+  %30 = sub i32 %24, %29
+  %31 = icmp ne i32 %30, 0
+  br i1 %31, label %label.9, label %label.10
+label.9:
+  %32 = load i32, i32* %gen.1.v, align 4
+  store i32 %32, i32* %v, align 4
+  %33 = load i32, i32* %s, align 4
+  %34 = load i32, i32* %v, align 4
+  %35 = add i32 0, 1024
+  %36 = sdiv i32 %34, %35
+  %37 = add i32 %33, %36
+  store i32 %37, i32* %s, align 4
+  %38 = load i32, i32* %s, align 4
+  br label %label.11
+label.10:
+  %39 = add i32 0, 0
+  br label %label.11
+label.11:
+  %40 = phi i32 [ %32, %label.9 ], [ %39, %label.10 ]
+  br label %label.7
+label.7:
+  %for.5.next = add nsw i32 %for.5.iv, 1
+  br label %label.5, !llvm.loop !0
+label.8:
+  %41 = add i32 0, 0
+  br label %label.3
+label.3:
+  %42 = add i32 0, 0
+  br label %label.2
+label.2:
+  %43 = add i32 0, 0
+  br label %label.1
+label.1:
+  %44 = add i32 0, 0
+  %45 = load i32, i32* %s, align 4
+  %46 = call i32 @print(i32 %45)
+  %47 = add i32 0, 0
+  ret i32 %47
+}
+@llvm.global_dtors = appending global [1 x { i32, void ()*, i8* }] [{ i32, void ()*, i8* } { i32 65535, void ()* @freq.flush, i8* null }]
+!0 = distinct !{!0, !1}
+!1 = !{!"llvm.loop.mustprogress"}